@@ -0,0 +1,118 @@
+/*
+file: alarm.c
+
+Description:
+	Per channel alarm state machines, see alarm.h. Runs on the sampler
+	thread only.
+*/
+
+#include <string.h>
+
+#include "alarm.h"
+
+struct alarm_check;
+
+// FUNCTION SIGNATURES
+static enum record_alarm_state	target_state(const struct alarm_check *check, int value);
+
+struct alarm_check {
+	struct alarm_limits limits;	// debounce 0 means not configured
+	enum record_alarm_state state;
+	enum record_alarm_state pending;
+	int pending_count;
+};
+
+static struct alarm_check checks[ALARM_MAX_CHANNELS][ALARM_SOURCES];
+
+static const char *const source_names[ALARM_SOURCES] = { "Value", "Raw" };
+
+// New limits apply from the next sample, the current state is kept so a
+// reload does not repeat alarms that are already active
+void alarm_configure(int channel, enum alarm_source source, const struct alarm_limits *limits) {
+	struct alarm_check *check;
+
+	if (channel < 0 || channel >= ALARM_MAX_CHANNELS || source >= ALARM_SOURCES) {
+		return;
+	}
+
+	check = &checks[channel][source];
+	check->limits = *limits;
+	if (check->limits.debounce < 1) {
+		check->limits.debounce = 1;
+	}
+	if (check->limits.hysteresis < 0) {
+		check->limits.hysteresis = 0;
+	}
+	if (!limits->low_enabled && !limits->high_enabled) {
+		check->state = check->pending = ALARM_NORMAL;
+		check->pending_count = 0;
+	}
+}
+
+void alarm_evaluate(int channel, int raw, struct record *record) {
+	struct alarm_check *check;
+	struct record_alarm *alarm;
+	enum record_alarm_state target, previous;
+	int value;
+	int source;
+
+	if (channel < 0 || channel >= ALARM_MAX_CHANNELS) {
+		return;
+	}
+
+	for (source = 0; source < ALARM_SOURCES; source++) {
+		check = &checks[channel][source];
+		if (!check->limits.low_enabled && !check->limits.high_enabled) {
+			continue;
+		}
+
+		value = (source == ALARM_SOURCE_RAW) ? raw : record->value;
+		target = target_state(check, value);
+		if (target == check->state) {
+			check->pending_count = 0;
+			continue;
+		}
+
+		// Debounce: the same new state for limits.debounce samples in a row
+		if (target != check->pending || check->pending_count == 0) {
+			check->pending = target;
+			check->pending_count = 0;
+		}
+		if (++check->pending_count < check->limits.debounce) {
+			continue;
+		}
+
+		previous = check->state;
+		check->state = target;
+		check->pending_count = 0;
+
+		alarm = &record->alarms[record->num_alarms++];
+		alarm->source = source_names[source];
+		alarm->state = target;
+		alarm->value = value;
+		// the limit that was crossed, or the one the value is back within
+		alarm->limit = (target == ALARM_LOW || (target == ALARM_NORMAL && previous == ALARM_LOW))
+			? check->limits.low : check->limits.high;
+		record->flags |= RECORD_HAS_ALARM;
+	}
+}
+
+// State the value asks for, leaving an alarm needs the hysteresis margin
+static enum record_alarm_state target_state(const struct alarm_check *check, int value) {
+	const struct alarm_limits *limits = &check->limits;
+
+	if (check->state == ALARM_HIGH && limits->high_enabled && value >= limits->high - limits->hysteresis) {
+		return ALARM_HIGH;
+	}
+	if (check->state == ALARM_LOW && limits->low_enabled && value <= limits->low + limits->hysteresis) {
+		return ALARM_LOW;
+	}
+
+	if (limits->high_enabled && value > limits->high) {
+		return ALARM_HIGH;
+	}
+	if (limits->low_enabled && value < limits->low) {
+		return ALARM_LOW;
+	}
+	return ALARM_NORMAL;
+}
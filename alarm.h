@@ -0,0 +1,41 @@
+/*
+file: alarm.h
+
+Description:
+	Threshold alarms evaluated in the sample path. Every channel has up
+	to two checks, one on the converted value and one on the raw ADC
+	millivolts. A check changes state only after debounce consecutive
+	samples agree, and leaves an alarm only once the value is back
+	inside the limit by more than the hysteresis. State changes are
+	attached to the record of the sample that caused them, so sinks see
+	an alarm one sample after it happens.
+*/
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include "record.h"
+
+#define ALARM_MAX_CHANNELS 16
+#define ALARM_DEFAULT_DEBOUNCE 3
+
+enum alarm_source {
+	ALARM_SOURCE_VALUE = 0,		// converted value, e.g. mA
+	ALARM_SOURCE_RAW,		// ADC millivolts
+	ALARM_SOURCES
+};
+
+// Limits are in the unit of the source; a disabled limit is never checked
+struct alarm_limits {
+	int low_enabled;
+	int low;
+	int high_enabled;
+	int high;
+	int hysteresis;
+	int debounce;			// samples, at least 1
+};
+
+void	alarm_configure(int channel, enum alarm_source source, const struct alarm_limits *limits);
+void	alarm_evaluate(int channel, int raw, struct record *record);
+
+#endif
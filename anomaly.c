@@ -0,0 +1,93 @@
+/*
+file: anomaly.c
+
+Description:
+	EWMA mean/variance z-score detector, see anomaly.h. Constant memory
+	and a handful of floating point operations per sample, runs on the
+	sampler thread.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "anomaly.h"
+
+struct detector {
+	long long count;
+	double mean;
+	double variance;
+	enum record_alarm_state state;
+};
+
+static struct detector detectors[ANOMALY_MAX_CHANNELS];
+static double alpha = 0;
+static double threshold = 4;
+static int warmup = 0;
+
+// Changing the smoothing restarts learning, a new threshold applies as is
+void anomaly_configure(double new_alpha, double new_threshold, int new_warmup) {
+	if (new_alpha < 0 || new_alpha > 1) {
+		new_alpha = 0;
+	}
+	if (new_alpha != alpha) {
+		memset(detectors, 0, sizeof(detectors));
+	}
+
+	alpha = new_alpha;
+	threshold = (new_threshold > 0) ? new_threshold : 4;
+	warmup = (new_warmup > 1) ? new_warmup : 1;
+}
+
+void anomaly_update(int channel, struct record *record) {
+	struct detector *detector;
+	struct record_alarm *alarm;
+	enum record_alarm_state state;
+	double deviation, step, weight, z, bound;
+
+	if (alpha == 0 || channel < 0 || channel >= ANOMALY_MAX_CHANNELS) {
+		return;
+	}
+
+	detector = &detectors[channel];
+	deviation = (detector->count == 0) ? 0 : record->value - detector->mean;
+	z = 0;
+	if (detector->count >= warmup && detector->variance > 0) {
+		z = deviation / sqrt(detector->variance);
+	}
+
+	// Score against the estimates from before this value
+	state = detector->state;
+	bound = threshold;
+	if (state == ALARM_NORMAL && fabs(z) >= threshold) {
+		state = (z > 0) ? ALARM_HIGH : ALARM_LOW;
+	} else if (state != ALARM_NORMAL && fabs(z) < threshold / 2) {
+		state = ALARM_NORMAL;
+		bound = threshold / 2;
+	}
+
+	if (state != detector->state && record->num_alarms < RECORD_MAX_ALARMS) {
+		alarm = &record->alarms[record->num_alarms++];
+		alarm->source = "Anomaly";
+		alarm->state = state;
+		alarm->value = record->value;
+		// mean -/+ bound * sd on the side entered or left
+		if (state == ALARM_LOW || detector->state == ALARM_LOW) {
+			bound = -bound;
+		}
+		alarm->limit = lround(detector->mean + bound * sqrt(detector->variance));
+		record->flags |= RECORD_HAS_ALARM;
+	}
+	detector->state = state;
+
+	// EWMA update, the first samples use a plain running mean so the
+	// estimates settle within the warmup
+	weight = 1.0 / (detector->count + 1);
+	weight = (weight > alpha) ? weight : alpha;
+	step = weight * deviation;
+	detector->mean = (detector->count == 0) ? record->value : detector->mean + step;
+	detector->variance = (1 - weight) * (detector->variance + deviation * step);
+	detector->count++;
+
+	record->flags |= RECORD_HAS_ANOMALY;
+	record->anomaly_score = llround(z * 1000);
+}
@@ -0,0 +1,27 @@
+/*
+file: anomaly.h
+
+Description:
+	Online anomaly detection per channel. An exponentially weighted mean
+	and variance track what the channel normally reads; every value is
+	scored by its z-score against them before they are updated. Every
+	record carries the score. Entering or leaving an anomaly (|z| above
+	the threshold, back below half of it) is reported like an alarm
+	with source "Anomaly" and the bound that was crossed as the limit.
+
+	The estimates keep adapting during an anomaly, so a lasting level
+	change becomes the new normal after roughly 1 / alpha samples.
+*/
+
+#ifndef ANOMALY_H
+#define ANOMALY_H
+
+#include "record.h"
+
+#define ANOMALY_MAX_CHANNELS 16
+
+// alpha 0 turns detection off; warmup samples are scored 0
+void	anomaly_configure(double alpha, double threshold, int warmup);
+void	anomaly_update(int channel, struct record *record);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+file: bench/anomaly_bench.c
+
+Description:
+	Per sample cost of anomaly_update() on the sampler thread, for
+	channels reading noise around a level. A step in one channel is
+	checked to raise a "High" anomaly and later to return to normal
+	before timing, so the benchmark also fails when detection breaks.
+*/
+
+#include <string.h>
+
+#include "bench.h"
+#include "../anomaly.h"
+
+#define CHANNELS 8
+#define SAMPLES (1 << 20)	// per channel
+#define ALPHA 0.01
+#define THRESHOLD 4.0
+#define WARMUP 100
+
+// FUNCTION SIGNATURES
+static int	check_step();
+
+static int noise[SAMPLES];
+
+int main() {
+	struct record record;
+	double start, elapsed, best = 1e9;
+	uint64_t state = 88172645463325252ULL;
+	long long alarms;
+	int run, channel, i;
+
+	// triangular noise, +-50 around 1000
+	for (i = 0; i < SAMPLES; i++) {
+		noise[i] = 1000 + (int)(bench_random(&state) % 51) - (int)(bench_random(&state) % 51);
+	}
+
+	if (check_step() != 0) {
+		return EXIT_FAILURE;
+	}
+
+	memset(&record, 0, sizeof(record));
+	for (run = 0; run < BENCH_RUNS; run++) {
+		anomaly_configure(0, THRESHOLD, WARMUP);
+		anomaly_configure(ALPHA, THRESHOLD, WARMUP);
+		alarms = 0;
+
+		start = bench_now();
+		for (i = 0; i < SAMPLES; i++) {
+			for (channel = 0; channel < CHANNELS; channel++) {
+				record.value = noise[(i + channel * 4099) % SAMPLES];
+				record.num_alarms = 0;
+				anomaly_update(channel, &record);
+				alarms += record.num_alarms;
+				bench_sink += record.anomaly_score;
+			}
+		}
+		elapsed = bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	printf("anomaly_update, %d channels, alpha %g, threshold %g\n", CHANNELS, ALPHA, THRESHOLD);
+	printf("%.1f ns per sample, %.0f samples/s on one core, %lld false alarms in %d samples\n",
+		best / SAMPLES / CHANNELS * 1e9, SAMPLES * CHANNELS / best, alarms, SAMPLES * CHANNELS);
+	return 0;
+}
+
+// A jump of about 15 standard deviations is reported and eventually learned
+static int check_step() {
+	struct record record;
+	int high = 0, normal = 0;
+	int i;
+
+	anomaly_configure(ALPHA, THRESHOLD, WARMUP);
+	memset(&record, 0, sizeof(record));
+	for (i = 0; i < 20000; i++) {
+		record.value = noise[i] + ((i >= 10000) ? 300 : 0);
+		record.num_alarms = 0;
+		anomaly_update(0, &record);
+		if (record.num_alarms == 1 && strcmp(record.alarms[0].source, "Anomaly") == 0) {
+			if (record.alarms[0].state == ALARM_HIGH && i == 10000) {
+				high = 1;
+			} else if (record.alarms[0].state == ALARM_NORMAL && high) {
+				normal = 1;
+			}
+		}
+	}
+
+	if (!high || !normal) {
+		fprintf(stderr, "step not detected (high %d, back to normal %d)\n", high, normal);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+file: bench/bench.h
+
+Description:
+	Helpers shared by the host benchmarks in this directory. A benchmark
+	times its body BENCH_RUNS times and reports the fastest run, the one
+	least disturbed by the rest of the machine. Results go through
+	bench_sink so the compiler can't drop the work.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_RUNS 5
+
+static volatile long long bench_sink;
+
+static inline double bench_now() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// xorshift64, deterministic inputs across runs and machines
+static inline uint64_t bench_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+#endif
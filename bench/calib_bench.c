@@ -0,0 +1,181 @@
+/*
+file: bench/calib_bench.c
+
+Description:
+	Per sample cost of calib_apply() next to the double conversion it
+	replaced, for the default current calibration and a poly and a
+	piecewise one, plus how many of the 4096 codes each calibration
+	needs a bitmap correction for. Results are compared with the
+	double formula first, a mismatch fails the benchmark.
+
+	Then calib_apply_block() against a calib_apply() loop for linear
+	calibrations, by block size, on the vector path this build has.
+*/
+
+#include <string.h>
+
+#include "bench.h"
+#include "../calib.h"
+
+#define SAMPLES (1 << 20)
+
+// FUNCTION SIGNATURES
+static void	run(const char *name, const struct calib_spec *spec);
+static void	run_blocks(const char *name, const struct calib_spec *spec);
+
+static int32_t codes[SAMPLES];
+static int32_t values[SAMPLES];
+static int32_t expected[SAMPLES];
+
+int main() {
+	struct calib_spec spec;
+	uint64_t state = 88172645463325252ULL;
+	int i;
+
+	for (i = 0; i < SAMPLES; i++) {
+		codes[i] = bench_random(&state) % CALIB_CODES;
+	}
+
+	printf("%-22s %11s %12s %12s\n", "calibration", "corrections", "double ns", "calib ns");
+
+	// current_sensor_N with multiplier 13.3333 and max_avg_voltage 2500
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.coefficients[1] = -13.3333;
+	spec.origin = 2500;
+	spec.unit = "mA";
+	run("current sensor", &spec);
+
+	spec.coefficients[1] = 0.1;
+	spec.origin = 0;
+	run("linear, gain 0.1", &spec);
+
+	spec.kind = CALIB_POLY;
+	spec.order = 3;
+	spec.coefficients[0] = -40.5;
+	spec.coefficients[1] = 0.0625;
+	spec.coefficients[2] = 1.5e-5;
+	spec.coefficients[3] = -2.25e-9;
+	run("poly, order 3", &spec);
+
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_PIECEWISE;
+	spec.points = 8;
+	for (i = 0; i < spec.points; i++) {
+		spec.code[i] = i * 585.0 + 0.5;
+		spec.value[i] = i * i * 37.25 - 100;
+	}
+	spec.unit = "degC";
+	run("piecewise, 8 points", &spec);
+
+	printf("\nblocks, %s\n%-22s %7s %12s %12s\n", calib_simd_name(),
+		"calibration", "block", "loop ns", "block ns");
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.coefficients[1] = -13.3333;
+	spec.origin = 2500;
+	spec.unit = "mA";
+	run_blocks("current sensor", &spec);
+
+	spec.coefficients[0] = -7;
+	spec.coefficients[1] = 0.7;
+	spec.origin = 0;
+	run_blocks("linear, 70 corrections", &spec);
+
+	return 0;
+}
+
+static void run(const char *name, const struct calib_spec *spec) {
+	struct calib calib;
+	double start, elapsed, best_double = 1e9, best_calib = 1e9;
+	long long sum;
+	int run, i;
+
+	if (calib_compile(spec, &calib) < 0) {
+		fprintf(stderr, "%s: refused\n", name);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < CALIB_CODES; i++) {
+		if (calib_apply(&calib, i) != (int)calib_reference(spec, i)) {
+			fprintf(stderr, "%s: code %d converts to %d, expected %d\n",
+				name, i, calib_apply(&calib, i), (int)calib_reference(spec, i));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (run = 0; run < BENCH_RUNS; run++) {
+		start = bench_now();
+		sum = 0;
+		for (i = 0; i < SAMPLES; i++) {
+			sum += (int)calib_reference(spec, codes[i]);
+		}
+		bench_sink += sum;
+		elapsed = bench_now() - start;
+		if (elapsed < best_double) {
+			best_double = elapsed;
+		}
+
+		start = bench_now();
+		sum = 0;
+		for (i = 0; i < SAMPLES; i++) {
+			sum += calib_apply(&calib, codes[i]);
+		}
+		bench_sink += sum;
+		elapsed = bench_now() - start;
+		if (elapsed < best_calib) {
+			best_calib = elapsed;
+		}
+	}
+
+	printf("%-22s %6d/%d %12.2f %12.2f\n", name, calib.corrections, CALIB_CODES,
+		best_double / SAMPLES * 1e9, best_calib / SAMPLES * 1e9);
+}
+
+// The same samples converted in blocks of 8 .. 32K codes
+static void run_blocks(const char *name, const struct calib_spec *spec) {
+	struct calib calib;
+	double start, elapsed, best_loop, best_block;
+	size_t block, offset;
+	int run, i;
+
+	calib_compile(spec, &calib);
+	for (i = 0; i < SAMPLES; i++) {
+		expected[i] = calib_apply(&calib, codes[i]);
+	}
+
+	for (block = 8; block <= 65536; block *= 8) {
+		best_loop = best_block = 1e9;
+		for (run = 0; run < BENCH_RUNS; run++) {
+			start = bench_now();
+			for (offset = 0; offset < SAMPLES; offset += block) {
+				for (i = offset; i < (int)(offset + block); i++) {
+					values[i] = calib_apply(&calib, codes[i]);
+				}
+			}
+			bench_sink += values[SAMPLES - 1];
+			elapsed = bench_now() - start;
+			if (elapsed < best_loop) {
+				best_loop = elapsed;
+			}
+
+			start = bench_now();
+			for (offset = 0; offset < SAMPLES; offset += block) {
+				calib_apply_block(&calib, codes + offset, values + offset, block);
+			}
+			bench_sink += values[SAMPLES - 1];
+			elapsed = bench_now() - start;
+			if (elapsed < best_block) {
+				best_block = elapsed;
+			}
+		}
+
+		if (memcmp(values, expected, sizeof(values)) != 0) {
+			fprintf(stderr, "%s: blocks of %zu differ from calib_apply()\n", name, block);
+			exit(EXIT_FAILURE);
+		}
+		printf("%-22s %7zu %12.2f %12.2f\n", name, block,
+			best_loop / SAMPLES * 1e9, best_block / SAMPLES * 1e9);
+	}
+}
@@ -0,0 +1,243 @@
+/*
+file: bench/cjson_arena_bench.c
+
+Description:
+	Parse cost of sensor documents of 1 .. 4096 records with
+	cJSON_Parse() and cJSON_Delete() against cJSON_ParseWithArena() and
+	cJSON_ResetArena(), and how far the RSS grows each way for the
+	largest one, read after every parse. Every phase that measures
+	memory runs in a child process that first trims the heap it
+	inherited, so the memory freed by one phase doesn't hide the next. Before timing, arena
+	documents are checked to print the same as heap ones, and repeated
+	failed parses are checked to give their memory back to the arena.
+*/
+
+#include <malloc.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../cjson/cJSON.h"
+
+#define MAX_RECORDS 4096
+#define PARSE_BYTES (1 << 24)	// parsed per size and run
+#define FAILED_PARSES 200
+
+// FUNCTION SIGNATURES
+static char	*make_document(int records);
+static int	check(const char *document);
+static long	peak_kb(void (*phase)(const char *), const char *document);
+static void	note_rss();
+static void	parse_heap(const char *document);
+static void	parse_arena(const char *document);
+static void	parse_failing(const char *document);
+
+static long peak_rss_kb;
+
+int main() {
+	double start, elapsed, best_heap, best_arena;
+	cJSON_Arena *arena = cJSON_CreateArena(0);
+	char *document;
+	size_t length;
+	int records, iterations, run, i;
+
+	printf("%-8s %9s %12s %12s\n", "records", "bytes", "heap us", "arena us");
+	for (records = 1; records <= MAX_RECORDS; records *= 8) {
+		document = make_document(records);
+		length = strlen(document);
+		iterations = (PARSE_BYTES / length) ? PARSE_BYTES / length : 1;
+		if (check(document) != 0) {
+			return EXIT_FAILURE;
+		}
+
+		best_heap = best_arena = 1e9;
+		for (run = 0; run < BENCH_RUNS; run++) {
+			start = bench_now();
+			for (i = 0; i < iterations; i++) {
+				cJSON_Delete(cJSON_Parse(document));
+			}
+			elapsed = bench_now() - start;
+			if (elapsed < best_heap) {
+				best_heap = elapsed;
+			}
+
+			start = bench_now();
+			for (i = 0; i < iterations; i++) {
+				bench_sink += cJSON_ParseWithArena(arena, document, NULL, 0) != NULL;
+				cJSON_ResetArena(arena);
+			}
+			elapsed = bench_now() - start;
+			if (elapsed < best_arena) {
+				best_arena = elapsed;
+			}
+		}
+
+		printf("%-8d %9zu %12.2f %12.2f\n", records, length,
+			best_heap / iterations * 1e6, best_arena / iterations * 1e6);
+		free(document);
+	}
+	cJSON_DeleteArena(arena);
+
+	document = make_document(MAX_RECORDS);
+	printf("\nRSS growth, %d records: heap %ld KB, arena %ld KB, %d failed arena parses %ld KB\n",
+		MAX_RECORDS, peak_kb(parse_heap, document), peak_kb(parse_arena, document),
+		FAILED_PARSES, peak_kb(parse_failing, document));
+	free(document);
+	return 0;
+}
+
+// An array of records like the ones the sinks write, one of them with a large Metrics object
+static char *make_document(int records) {
+	cJSON *array = cJSON_CreateArray();
+	cJSON *record, *alarms, *metrics;
+	char name[32];
+	char *document;
+	int i, j;
+
+	for (i = 0; i < records; i++) {
+		record = cJSON_CreateObject();
+		snprintf(name, sizeof(name), "current_sensor_%d", i % 8);
+		cJSON_AddStringToObject(record, "Sensor", name);
+		cJSON_AddStringToObject(record, "Timestamp", "2017-03-12T18:04:05.123456789Z");
+		cJSON_AddNumberToObject(record, "Value", 1000 + i % 977);
+		cJSON_AddStringToObject(record, "Unit", "mA");
+		cJSON_AddNumberToObject(record, "Latency_us", 12.5 + i % 31);
+		alarms = cJSON_CreateArray();
+		cJSON_AddItemToObject(record, "Alarms", alarms);
+		if (i % 16 == 0) {
+			cJSON_AddItemToArray(alarms, cJSON_CreateString("High"));
+		}
+		if (i % 64 == 0) {
+			// above CJSON_INDEX_THRESHOLD, indexed while parsing into an arena
+			metrics = cJSON_CreateObject();
+			cJSON_AddItemToObject(record, "Metrics", metrics);
+			for (j = 0; j < 40; j++) {
+				snprintf(name, sizeof(name), "metric_%d", j);
+				cJSON_AddNumberToObject(metrics, name, j * 0.25);
+			}
+		}
+		cJSON_AddItemToArray(array, record);
+	}
+
+	document = cJSON_PrintUnformatted(array);
+	cJSON_Delete(array);
+	if (document == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	return document;
+}
+
+static int check(const char *document) {
+	cJSON_Arena *arena = cJSON_CreateArena(0);
+	cJSON *heap = cJSON_Parse(document);
+	cJSON *in_arena = cJSON_ParseWithArena(arena, document, NULL, 1);
+	cJSON *metric;
+	char *printed_heap = cJSON_PrintUnformatted(heap);
+	char *printed_arena = cJSON_PrintUnformatted(in_arena);
+	int failed = printed_heap == NULL || printed_arena == NULL || strcmp(printed_heap, printed_arena) != 0;
+
+	metric = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItem(cJSON_GetArrayItem(in_arena, 0), "Metrics"), "metric_39");
+	if (!failed && (metric == NULL || metric->valuedouble != 39 * 0.25)) {
+		failed = 1;
+	}
+	if (failed) {
+		fprintf(stderr, "%zu byte document: arena parse differs from the heap one\n", strlen(document));
+	}
+
+	free(printed_heap);
+	free(printed_arena);
+	cJSON_Delete(heap);
+	cJSON_DeleteArena(arena);
+	if (!failed && peak_kb(parse_failing, document) > 4 * peak_kb(parse_arena, document) + 1024) {
+		fprintf(stderr, "%zu byte document: failed parses keep their memory\n", strlen(document));
+		failed = 1;
+	}
+	return failed ? -1 : 0;
+}
+
+// Growth of the RSS while a phase runs in a child process, at its peak
+static long peak_kb(void (*phase)(const char *), const char *document) {
+	long grown = -1;
+	int fds[2];
+	pid_t child;
+
+	if (pipe(fds) != 0) {
+		exit(EXIT_FAILURE);
+	}
+	fflush(stdout);
+	child = fork();
+	if (child == 0) {
+		malloc_trim(0);
+		peak_rss_kb = 0;
+		note_rss();
+		grown = peak_rss_kb;
+		phase(document);
+		grown = peak_rss_kb - grown;
+		if (write(fds[1], &grown, sizeof(grown)) != sizeof(grown)) {
+			_exit(EXIT_FAILURE);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	if (child < 0 || read(fds[0], &grown, sizeof(grown)) != sizeof(grown)) {
+		exit(EXIT_FAILURE);
+	}
+	close(fds[0]);
+	waitpid(child, NULL, 0);
+	return grown;
+}
+
+static void note_rss() {
+	FILE *statm = fopen("/proc/self/statm", "r");
+	long pages = 0, resident = 0;
+
+	if (statm == NULL || fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+		_exit(EXIT_FAILURE);
+	}
+	fclose(statm);
+	resident *= sysconf(_SC_PAGESIZE) / 1024;
+	if (resident > peak_rss_kb) {
+		peak_rss_kb = resident;
+	}
+}
+
+static void parse_heap(const char *document) {
+	cJSON *item;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		item = cJSON_Parse(document);
+		note_rss();
+		cJSON_Delete(item);
+	}
+}
+
+static void parse_arena(const char *document) {
+	cJSON_Arena *arena = cJSON_CreateArena(0);
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		bench_sink += cJSON_ParseWithArena(arena, document, NULL, 0) != NULL;
+		note_rss();
+		cJSON_ResetArena(arena);
+	}
+	cJSON_DeleteArena(arena);
+}
+
+// The document cut short, each parse fails at its end
+static void parse_failing(const char *document) {
+	cJSON_Arena *arena = cJSON_CreateArena(0);
+	char *cut = strdup(document);
+	int i;
+
+	cut[strlen(cut) - 1] = '\0';
+	for (i = 0; i < FAILED_PARSES; i++) {
+		if (cJSON_ParseWithArena(arena, cut, NULL, 0) != NULL) {
+			_exit(EXIT_FAILURE);
+		}
+		note_rss();
+	}
+	free(cut);
+	cJSON_DeleteArena(arena);
+}
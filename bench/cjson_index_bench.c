@@ -0,0 +1,147 @@
+/*
+file: bench/cjson_index_bench.c
+
+Description:
+	Member lookup cost in cJSON objects of 4 .. 4096 members. The walk
+	column is the member by member search cJSON did before objects were
+	indexed, the others go through cJSON_GetObjectItemCaseSensitive()
+	and cJSON_GetObjectItem(), which index an object once a lookup
+	walks past CJSON_INDEX_THRESHOLD members. Names are picked at
+	random, fewer of them for the walk on large objects. Before timing,
+	exact, upper cased and missing names are checked against the walk.
+	Also reports what building the index costs per member.
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include "bench.h"
+#include "../cjson/cJSON.h"
+
+#define MAX_MEMBERS 4096
+#define LOOKUPS (1 << 18)
+
+// FUNCTION SIGNATURES
+static cJSON	*walk(const cJSON *object, const char *name, int case_sensitive);
+static int	check(const cJSON *object, int members);
+static void	run(int members);
+
+static char names[MAX_MEMBERS][16];
+static char upper[MAX_MEMBERS][16];
+static int order[LOOKUPS];
+
+int main() {
+	int members, i;
+
+	for (i = 0; i < MAX_MEMBERS; i++) {
+		// sensor like names sharing a long prefix, the common case
+		snprintf(names[i], sizeof(names[i]), "sensor_%d_mv", i);
+		snprintf(upper[i], sizeof(upper[i]), "SENSOR_%d_MV", i);
+	}
+
+	printf("%-8s %10s %12s %12s %12s\n", "members", "walk ns", "sensitive ns", "any case ns", "index ns/mbr");
+	for (members = 4; members <= MAX_MEMBERS; members *= 2) {
+		run(members);
+	}
+	return 0;
+}
+
+// What get_object_item() did without an index
+static cJSON *walk(const cJSON *object, const char *name, int case_sensitive) {
+	cJSON *item;
+
+	for (item = object->child; item != NULL; item = item->next) {
+		if (item->string != NULL && (case_sensitive ? strcmp(name, item->string) : strcasecmp(name, item->string)) == 0) {
+			return item;
+		}
+	}
+	return NULL;
+}
+
+static int check(const cJSON *object, int members) {
+	int i;
+
+	for (i = 0; i < members; i++) {
+		if (cJSON_GetObjectItemCaseSensitive(object, names[i]) != walk(object, names[i], 1) ||
+		    cJSON_GetObjectItemCaseSensitive(object, upper[i]) != NULL ||
+		    cJSON_GetObjectItem(object, upper[i]) != walk(object, upper[i], 0) ||
+		    walk(object, names[i], 1) == NULL) {
+			fprintf(stderr, "%d members: lookup of %s differs from the walk\n", members, names[i]);
+			return -1;
+		}
+	}
+	if (cJSON_GetObjectItem(object, "sensor_x_mv") != NULL || cJSON_GetObjectItemCaseSensitive(object, "") != NULL) {
+		fprintf(stderr, "%d members: missing name found\n", members);
+		return -1;
+	}
+	return 0;
+}
+
+static void run(int members) {
+	cJSON *object = cJSON_CreateObject();
+	double start, elapsed, best_walk = 1e9, best_sensitive = 1e9, best_any = 1e9, best_index = 1e9;
+	uint64_t state = 88172645463325252ULL;
+	long long found;
+	int walks = (members > 64) ? LOOKUPS / (members / 64) : LOOKUPS;	// the walk is O(members)
+	int run, i;
+
+	for (i = 0; i < members; i++) {
+		cJSON_AddNumberToObject(object, names[i], i);
+	}
+	for (i = 0; i < LOOKUPS; i++) {
+		order[i] = bench_random(&state) % members;
+	}
+
+	// once unindexed, once after the first long walk indexed the object
+	if (check(object, members) != 0 || check(object, members) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	for (run = 0; run < BENCH_RUNS; run++) {
+		start = bench_now();
+		found = 0;
+		for (i = 0; i < walks; i++) {
+			found += walk(object, names[order[i]], 1)->valueint;
+		}
+		bench_sink += found;
+		elapsed = bench_now() - start;
+		if (elapsed < best_walk) {
+			best_walk = elapsed;
+		}
+
+		start = bench_now();
+		found = 0;
+		for (i = 0; i < LOOKUPS; i++) {
+			found += cJSON_GetObjectItemCaseSensitive(object, names[order[i]])->valueint;
+		}
+		bench_sink += found;
+		elapsed = bench_now() - start;
+		if (elapsed < best_sensitive) {
+			best_sensitive = elapsed;
+		}
+
+		start = bench_now();
+		found = 0;
+		for (i = 0; i < LOOKUPS; i++) {
+			found += cJSON_GetObjectItem(object, upper[order[i]])->valueint;
+		}
+		bench_sink += found;
+		elapsed = bench_now() - start;
+		if (elapsed < best_any) {
+			best_any = elapsed;
+		}
+
+		start = bench_now();
+		for (i = 0; i < 64; i++) {
+			cJSON_IndexObject(object);
+		}
+		elapsed = bench_now() - start;
+		if (elapsed < best_index) {
+			best_index = elapsed;
+		}
+	}
+
+	printf("%-8d %10.1f %12.1f %12.1f %12.1f\n", members, best_walk / walks * 1e9,
+		best_sensitive / LOOKUPS * 1e9, best_any / LOOKUPS * 1e9, best_index / 64 / members * 1e9);
+	cJSON_Delete(object);
+}
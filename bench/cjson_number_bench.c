@@ -0,0 +1,209 @@
+/*
+file: bench/cjson_number_bench.c
+
+Description:
+	Cost of printing numbers with cJSON, before and after Grisu2. Arrays
+	of 4096 numbers of one kind are printed into a preallocated buffer
+	by cJSON, and written with the sprintf() formats print_number() used
+	before ("%.0f", "%e" or "%f" with trailing zeros trimmed) and with
+	"%.17g" for comparison. cJSON's text is parsed back and every number
+	checked against the value it came from, which fails the benchmark;
+	how many of the old texts read back wrong is only counted.
+*/
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../cjson/cJSON.h"
+
+#define COUNT 4096
+#define KINDS 5
+#define BUFFER_SIZE (COUNT * 64)	// up to 60 digits for integers below 1e60
+
+// FUNCTION SIGNATURES
+static void	fill(int kind, uint64_t *state);
+static size_t	print_old(char *buffer);
+static int	old_wrong();
+static size_t	print_17g(char *buffer);
+static size_t	old_number(double d, char *output);
+static int	check(const char *buffer);
+
+static double values[COUNT];
+static const char *const kind_names[KINDS] = {
+	"integers", "readings 0.001", "random doubles", "near 1", "integers 1e18+"
+};
+
+int main() {
+	static char buffer[BUFFER_SIZE];
+	cJSON *array;
+	double start, elapsed, best_cjson, best_old, best_17g;
+	uint64_t state = 88172645463325252ULL;
+	size_t length = 0;
+	int kind, run, i, iterations = 20;
+
+	printf("%-16s %10s %10s %10s %12s\n", "numbers", "cjson ns", "old ns", "%.17g ns", "old wrong");
+	for (kind = 0; kind < KINDS; kind++) {
+		fill(kind, &state);
+		array = cJSON_CreateDoubleArray(values, COUNT);
+		if (array == NULL || !cJSON_PrintPreallocated(array, buffer, sizeof(buffer), 0) || check(buffer) != 0) {
+			fprintf(stderr, "%s: printed numbers don't read back\n", kind_names[kind]);
+			return EXIT_FAILURE;
+		}
+
+		best_cjson = best_old = best_17g = 1e9;
+		for (run = 0; run < BENCH_RUNS; run++) {
+			start = bench_now();
+			for (i = 0; i < iterations; i++) {
+				cJSON_PrintPreallocated(array, buffer, sizeof(buffer), 0);
+			}
+			bench_sink += buffer[1];
+			elapsed = bench_now() - start;
+			if (elapsed < best_cjson) {
+				best_cjson = elapsed;
+			}
+
+			start = bench_now();
+			for (i = 0; i < iterations; i++) {
+				length += print_old(buffer);
+			}
+			elapsed = bench_now() - start;
+			if (elapsed < best_old) {
+				best_old = elapsed;
+			}
+
+			start = bench_now();
+			for (i = 0; i < iterations; i++) {
+				length += print_17g(buffer);
+			}
+			elapsed = bench_now() - start;
+			if (elapsed < best_17g) {
+				best_17g = elapsed;
+			}
+		}
+		bench_sink += length;
+
+		printf("%-16s %10.1f %10.1f %10.1f %7d/%d\n", kind_names[kind],
+			best_cjson / iterations / COUNT * 1e9, best_old / iterations / COUNT * 1e9,
+			best_17g / iterations / COUNT * 1e9, old_wrong(), COUNT);
+		cJSON_Delete(array);
+	}
+	return 0;
+}
+
+static void fill(int kind, uint64_t *state) {
+	uint64_t bits;
+	int i;
+
+	for (i = 0; i < COUNT; i++) {
+		bits = bench_random(state);
+		switch (kind) {
+		case 0:	// mV and mA values
+			values[i] = (int)(bits % 20000) - 10000;
+			break;
+		case 1:	// what a calibration with three decimals gives
+			values[i] = ((int64_t)(bits % 2000000) - 1000000) / 1000.0;
+			break;
+		case 2:	// any exponent
+			do {
+				bits = bench_random(state);
+				memcpy(&values[i], &bits, sizeof(double));
+			} while (!isfinite(values[i]));
+			break;
+		case 3:
+			values[i] = (bits >> 11) * (1.0 / 9007199254740992.0) * 4;
+			break;
+		default:
+			values[i] = floor(pow(10, 18 + (bits >> 11) * (42.0 / 9007199254740992.0)));
+			break;
+		}
+	}
+}
+
+// The same array with the formatting print_number() had before
+static size_t print_old(char *buffer) {
+	size_t length = 0;
+	int i;
+
+	buffer[length++] = '[';
+	for (i = 0; i < COUNT; i++) {
+		if (i > 0) {
+			buffer[length++] = ',';
+		}
+		length += old_number(values[i], buffer + length);
+	}
+	buffer[length++] = ']';
+	buffer[length] = '\0';
+	return length;
+}
+
+// Numbers the old formatting did not print back to the same double
+static int old_wrong() {
+	char text[400];
+	int wrong = 0;
+	int i;
+
+	for (i = 0; i < COUNT; i++) {
+		old_number(values[i], text);
+		wrong += strtod(text, NULL) != values[i];
+	}
+	return wrong;
+}
+
+static size_t print_17g(char *buffer) {
+	size_t length = 0;
+	int i;
+
+	buffer[length++] = '[';
+	for (i = 0; i < COUNT; i++) {
+		if (i > 0) {
+			buffer[length++] = ',';
+		}
+		length += sprintf(buffer + length, "%.17g", values[i]);
+	}
+	buffer[length++] = ']';
+	buffer[length] = '\0';
+	return length;
+}
+
+static size_t old_number(double d, char *output) {
+	int length;
+
+	if ((d * 0) != 0) {
+		return sprintf(output, "null");
+	}
+	if ((fabs(floor(d) - d) <= DBL_EPSILON) && (fabs(d) < 1.0e60)) {
+		return sprintf(output, "%.0f", d);
+	}
+	if ((fabs(d) < 1.0e-6) || (fabs(d) > 1.0e9)) {
+		return sprintf(output, "%e", d);
+	}
+
+	// trim_trailing_zeroes()
+	length = sprintf(output, "%f", d);
+	while (length > 0 && output[length - 1] == '0') {
+		length--;
+	}
+	if (length > 0 && output[length - 1] == '.') {
+		length--;
+	}
+	output[length] = '\0';
+	return length;
+}
+
+static int check(const char *buffer) {
+	cJSON *array = cJSON_Parse(buffer);
+	cJSON *item;
+	int i = 0;
+
+	for (item = array ? array->child : NULL; item != NULL; item = item->next, i++) {
+		if (i >= COUNT || memcmp(&item->valuedouble, &values[i], sizeof(double)) != 0) {
+			fprintf(stderr, "%.17g printed as %.17g\n", values[i < COUNT ? i : 0], item->valuedouble);
+			cJSON_Delete(array);
+			return -1;
+		}
+	}
+	cJSON_Delete(array);
+	return (i == COUNT) ? 0 : -1;
+}
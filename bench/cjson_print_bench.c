@@ -0,0 +1,159 @@
+/*
+file: bench/cjson_print_bench.c
+
+Description:
+	Cost of printing sensor documents of 1 .. 4096 records three ways:
+	the way cJSON_Print()/cJSON_PrintUnformatted() used to, printing
+	into a buffer grown from 256 bytes and copying the text to an exact
+	size one; the same calls now, which trim the buffer in place with
+	realloc(); and cJSON_PrintReusable() into a buffer kept across calls.
+	The last one's allocations are counted through hooks wrapping
+	malloc, in steady state there are none. Before timing, the three
+	texts are checked to be the same.
+*/
+
+#include <string.h>
+
+#include "bench.h"
+#include "../cjson/cJSON.h"
+
+#define MAX_RECORDS 4096
+#define PRINT_BYTES (1 << 22)	// printed per size and run
+
+// FUNCTION SIGNATURES
+static cJSON	*make_document(int records);
+static void	*counting_malloc(size_t size);
+static void	counting_free(void *pointer);
+static char	*print(const cJSON *item, int format);
+static char	*print_copied(const cJSON *item, int format);
+
+static long long allocations;
+
+int main() {
+	cJSON_Hooks counting = { counting_malloc, counting_free };
+	cJSON *document;
+	char *text, *copied, *reusable = NULL;
+	double start, elapsed, best_copy, best_trim, best_reuse;
+	long long reuse_allocations;
+	size_t size = 0, length = 0;
+	int records, format, iterations, run, i;
+
+	printf("%-8s %-6s %9s %11s %11s %11s %12s\n", "records", "format", "bytes", "copy us", "realloc us",
+		"reusable us", "allocations");
+	for (records = 1; records <= MAX_RECORDS; records *= 8) {
+		document = make_document(records);
+		for (format = 0; format <= 1; format++) {
+			text = print(document, format);
+			copied = print_copied(document, format);
+			if (text == NULL || copied == NULL || strcmp(text, copied) != 0 ||
+			    !cJSON_PrintReusable(document, &reusable, &size, &length, format) ||
+			    length != strlen(text) || strcmp(text, reusable) != 0) {
+				fprintf(stderr, "%d records: the print paths differ\n", records);
+				return EXIT_FAILURE;
+			}
+			iterations = (PRINT_BYTES / length) ? PRINT_BYTES / length : 1;
+			free(copied);
+
+			best_copy = best_trim = best_reuse = 1e9;
+			for (run = 0; run < BENCH_RUNS; run++) {
+				start = bench_now();
+				for (i = 0; i < iterations; i++) {
+					copied = print_copied(document, format);
+					bench_sink += copied[0];
+					free(copied);
+				}
+				elapsed = bench_now() - start;
+				if (elapsed < best_copy) {
+					best_copy = elapsed;
+				}
+
+				start = bench_now();
+				for (i = 0; i < iterations; i++) {
+					copied = print(document, format);
+					bench_sink += copied[0];
+					free(copied);
+				}
+				elapsed = bench_now() - start;
+				if (elapsed < best_trim) {
+					best_trim = elapsed;
+				}
+
+				cJSON_InitHooks(&counting);
+				allocations = 0;
+				start = bench_now();
+				for (i = 0; i < iterations; i++) {
+					cJSON_PrintReusable(document, &reusable, &size, &length, format);
+					bench_sink += length;
+				}
+				elapsed = bench_now() - start;
+				reuse_allocations = allocations;
+				cJSON_InitHooks(NULL);
+				if (elapsed < best_reuse) {
+					best_reuse = elapsed;
+				}
+			}
+
+			printf("%-8d %-6s %9zu %11.2f %11.2f %11.2f %12lld\n", records, format ? "yes" : "no",
+				strlen(text), best_copy / iterations * 1e6, best_trim / iterations * 1e6,
+				best_reuse / iterations * 1e6, reuse_allocations);
+			free(text);
+		}
+		cJSON_Delete(document);
+	}
+	free(reusable);
+	return 0;
+}
+
+// Records like the ones the sinks write
+static cJSON *make_document(int records) {
+	cJSON *array = cJSON_CreateArray();
+	cJSON *record, *alarms;
+	char name[32];
+	int i;
+
+	for (i = 0; i < records; i++) {
+		record = cJSON_CreateObject();
+		snprintf(name, sizeof(name), "current_sensor_%d", i % 8);
+		cJSON_AddStringToObject(record, "Sensor", name);
+		cJSON_AddStringToObject(record, "Timestamp", "2017-03-12T18:04:05.123456789Z");
+		cJSON_AddNumberToObject(record, "Value", 1000 + i % 977);
+		cJSON_AddStringToObject(record, "Unit", "mA");
+		cJSON_AddNumberToObject(record, "Latency_us", 12.5 + i % 31);
+		alarms = cJSON_CreateArray();
+		if (i % 16 == 0) {
+			cJSON_AddItemToArray(alarms, cJSON_CreateString("High"));
+		}
+		cJSON_AddItemToObject(record, "Alarms", alarms);
+		cJSON_AddItemToArray(array, record);
+	}
+	return array;
+}
+
+static void *counting_malloc(size_t size) {
+	allocations++;
+	return malloc(size);
+}
+
+static void counting_free(void *pointer) {
+	free(pointer);
+}
+
+static char *print(const cJSON *item, int format) {
+	return format ? cJSON_Print(item) : cJSON_PrintUnformatted(item);
+}
+
+// What print() did before: a fresh buffer grown with realloc(), then an exact size copy
+static char *print_copied(const cJSON *item, int format) {
+	char *buffer = NULL, *copy;
+	size_t size = 0, length = 0;
+
+	if (!cJSON_PrintReusable(item, &buffer, &size, &length, format)) {
+		return NULL;
+	}
+	copy = malloc(length + 1);
+	if (copy != NULL) {
+		memcpy(copy, buffer, length + 1);
+	}
+	free(buffer);
+	return copy;
+}
@@ -0,0 +1,322 @@
+/*
+file: bench/encode_bench.c
+
+Description:
+	Size, encode and decode cost of a record in JSON, CBOR and
+	MessagePack. Records are encoded with record_encode(); JSON is
+	decoded with cJSON and the binary encodings with the small decoders
+	below, all into the same cJSON tree so the decode times compare like
+	for like. Before timing, every binary document is decoded and
+	checked against the JSON one, so the benchmark also fails when an
+	encoder writes something a standard decoder would read differently.
+*/
+
+#include <string.h>
+
+#include "bench.h"
+#include "../cjson/cJSON.h"
+#include "../record.h"
+
+#define ITERATIONS 50000
+
+// FUNCTION SIGNATURES
+static void	fill_record(struct record *record, int shape);
+static cJSON	*decode(const unsigned char *buffer, enum record_encoding encoding);
+static cJSON	*cbor_item(const unsigned char **in);
+static cJSON	*mp_item(const unsigned char **in);
+static uint64_t	get_be(const unsigned char **in, int bytes);
+static cJSON	*container(int is_map, uint64_t count, cJSON *(*item)(const unsigned char **), const unsigned char **in);
+static uint64_t	key_length(const unsigned char **in, int cbor);
+static cJSON	*text_item(const unsigned char **in, uint64_t length);
+static int	same(const cJSON *a, const cJSON *b);
+
+static const char *const shape_names[] = { "plain", "metrics+power", "everything" };
+static const char *const encoding_names[] = { "json", "cbor", "msgpack" };
+
+int main() {
+	static unsigned char buffer[RECORD_BUFFER_SIZE + 1];
+	struct record record;
+	cJSON *expected, *got;
+	double start, elapsed, best_encode, best_decode;
+	size_t length;	// Latency_us can change it between encodes
+	int shape, encoding, run, i;
+
+	printf("%-14s %-8s %6s %10s %10s\n", "record", "encoding", "bytes", "encode ns", "decode ns");
+	for (shape = 0; shape < 3; shape++) {
+		fill_record(&record, shape);
+
+		length = record_encode(&record, buffer, ENCODING_JSON, 0);
+		buffer[length] = '\0';
+		expected = cJSON_Parse((char *)buffer);
+		cJSON_DeleteItemFromObject(expected, "Latency_us");
+
+		for (encoding = ENCODING_JSON; encoding <= ENCODING_MSGPACK; encoding++) {
+			length = record_encode(&record, buffer, encoding, 0);
+			buffer[length] = '\0';
+			got = decode(buffer, encoding);
+			cJSON_DeleteItemFromObject(got, "Latency_us");
+			if (!same(expected, got)) {
+				fprintf(stderr, "%s record in %s decodes differently from JSON\n",
+					shape_names[shape], encoding_names[encoding]);
+				return EXIT_FAILURE;
+			}
+			cJSON_Delete(got);
+
+			best_encode = best_decode = 1e9;
+			for (run = 0; run < BENCH_RUNS; run++) {
+				start = bench_now();
+				for (i = 0; i < ITERATIONS; i++) {
+					length = record_encode(&record, buffer, encoding, 0);
+					bench_sink += length;
+				}
+				elapsed = bench_now() - start;
+				if (elapsed < best_encode) {
+					best_encode = elapsed;
+				}
+				buffer[length] = '\0';
+
+				start = bench_now();
+				for (i = 0; i < ITERATIONS; i++) {
+					got = decode(buffer, encoding);
+					bench_sink += got->type;
+					cJSON_Delete(got);
+				}
+				elapsed = bench_now() - start;
+				if (elapsed < best_decode) {
+					best_decode = elapsed;
+				}
+			}
+			printf("%-14s %-8s %6zu %10.1f %10.1f\n", shape_names[shape], encoding_names[encoding], length,
+				best_encode / ITERATIONS * 1e9, best_decode / ITERATIONS * 1e9);
+		}
+		cJSON_Delete(expected);
+	}
+
+	return 0;
+}
+
+// 0 is a bare sample, 1 adds metrics and pair power, 2 every optional part
+static void fill_record(struct record *record, int shape) {
+	int i;
+
+	memset(record, 0, sizeof(*record));
+	record->sensor_id = 3;
+	record->value = 1234;
+	strcpy(record->unit, "mA");
+	clock_gettime(CLOCK_MONOTONIC, &record->taken);
+	if (shape == 0) {
+		return;
+	}
+
+	record->flags |= RECORD_HAS_METRICS | RECORD_HAS_POWER;
+	record->rms = 1187;
+	record->power_mw = 14244;
+	record->energy_mwh = 8123456;
+	record->instant_power_mw = 14808;
+	record->real_power_mw = 13519;
+	record->apparent_power_mva = 14244;
+	record->power_factor = 949;
+	record->skew_ns = -61250;
+	if (shape == 1) {
+		return;
+	}
+
+	record->flags |= RECORD_HAS_STATS | RECORD_HAS_ALARM | RECORD_HAS_HARMONICS | RECORD_HAS_ANOMALY;
+	record->num_stats = RECORD_MAX_STATS;
+	for (i = 0; i < RECORD_MAX_STATS; i++) {
+		record->stats[i].window_ms = 1000 * (i + 1);
+		record->stats[i].min = 1100 - i;
+		record->stats[i].max = 1300 + i;
+		record->stats[i].mean = 1201250 + i;
+		record->stats[i].stddev = 40125;
+		record->stats[i].tumbling_valid = (i != 2);
+		record->stats[i].tumbling_min = 1090;
+		record->stats[i].tumbling_max = 1310;
+		record->stats[i].tumbling_mean = 1199500;
+		record->stats[i].tumbling_stddev = 41000;
+	}
+	record->num_alarms = 1;
+	record->alarms[0].source = "Value";
+	record->alarms[0].state = ALARM_HIGH;
+	record->alarms[0].limit = 1200;
+	record->alarms[0].value = 1234;
+	record->harmonics.fundamental_mhz = 59998;
+	record->harmonics.thd = 224;
+	record->harmonics.count = RECORD_MAX_HARMONICS;
+	for (i = 0; i < RECORD_MAX_HARMONICS; i++) {
+		record->harmonics.amplitude[i] = 1000 >> i;
+	}
+	record->anomaly_score = -1375;
+}
+
+// buffer must be NUL terminated for JSON
+static cJSON *decode(const unsigned char *buffer, enum record_encoding encoding) {
+	const unsigned char *in = buffer;
+
+	if (encoding == ENCODING_JSON) {
+		return cJSON_Parse((const char *)buffer);
+	}
+	return (encoding == ENCODING_CBOR) ? cbor_item(&in) : mp_item(&in);
+}
+
+// The CBOR subset encode.c writes: integers, text, arrays, maps, doubles
+static cJSON *cbor_item(const unsigned char **in) {
+	unsigned char head = *(*in)++;
+	uint64_t argument = head & 0x1f;
+	double value;
+	uint64_t bits;
+
+	if (head == 0xfb) {
+		bits = get_be(in, 8);
+		memcpy(&value, &bits, sizeof(value));
+		return cJSON_CreateNumber(value);
+	}
+	if (argument >= 24) {
+		argument = get_be(in, 1 << (argument - 24));
+	}
+
+	switch (head >> 5) {
+		case 0:
+			return cJSON_CreateNumber((double)argument);
+		case 1:
+			return cJSON_CreateNumber(-1 - (double)argument);
+		case 3:
+			return text_item(in, argument);
+		case 4:
+			return container(0, argument, cbor_item, in);
+		case 5:
+			return container(1, argument, cbor_item, in);
+		default:
+			return cJSON_CreateNull();
+	}
+}
+
+// The MessagePack subset encode.c writes
+static cJSON *mp_item(const unsigned char **in) {
+	unsigned char head = *(*in)++;
+	double value;
+	uint64_t bits;
+
+	if (head < 0x80) {
+		return cJSON_CreateNumber(head);
+	}
+	if (head >= 0xe0) {
+		return cJSON_CreateNumber((int8_t)head);
+	}
+	if ((head & 0xf0) == 0x80) {
+		return container(1, head & 0x0f, mp_item, in);
+	}
+	if ((head & 0xf0) == 0x90) {
+		return container(0, head & 0x0f, mp_item, in);
+	}
+	if ((head & 0xe0) == 0xa0) {
+		return text_item(in, head & 0x1f);
+	}
+
+	switch (head) {
+		case 0xcb:
+			bits = get_be(in, 8);
+			memcpy(&value, &bits, sizeof(value));
+			return cJSON_CreateNumber(value);
+		case 0xcc:
+		case 0xcd:
+		case 0xce:
+		case 0xcf:
+			return cJSON_CreateNumber((double)get_be(in, 1 << (head - 0xcc)));
+		case 0xd0:
+			return cJSON_CreateNumber((int8_t)get_be(in, 1));
+		case 0xd1:
+			return cJSON_CreateNumber((int16_t)get_be(in, 2));
+		case 0xd2:
+			return cJSON_CreateNumber((int32_t)get_be(in, 4));
+		case 0xd3:
+			return cJSON_CreateNumber((double)(int64_t)get_be(in, 8));
+		case 0xd9:
+			return text_item(in, get_be(in, 1));
+		case 0xda:
+			return text_item(in, get_be(in, 2));
+		case 0xdb:
+			return text_item(in, get_be(in, 4));
+		case 0xdc:
+			return container(0, get_be(in, 2), mp_item, in);
+		case 0xdd:
+			return container(0, get_be(in, 4), mp_item, in);
+		case 0xde:
+			return container(1, get_be(in, 2), mp_item, in);
+		case 0xdf:
+			return container(1, get_be(in, 4), mp_item, in);
+		default:
+			return cJSON_CreateNull();
+	}
+}
+
+static uint64_t get_be(const unsigned char **in, int bytes) {
+	uint64_t value = 0;
+
+	while (bytes-- > 0) {
+		value = (value << 8) | *(*in)++;
+	}
+	return value;
+}
+
+// Map keys are read as text straight into the member name, as cJSON_Parse does
+static cJSON *container(int is_map, uint64_t count, cJSON *(*item)(const unsigned char **), const unsigned char **in) {
+	cJSON *result = is_map ? cJSON_CreateObject() : cJSON_CreateArray();
+	cJSON *value;
+	const char *key;
+	uint64_t length;
+
+	while (count-- > 0) {
+		if (is_map) {
+			length = key_length(in, item == cbor_item);
+			key = (const char *)*in;
+			*in += length;
+			value = item(in);
+			value->string = strndup(key, length);
+			cJSON_AddItemToArray(result, value);
+		} else {
+			cJSON_AddItemToArray(result, item(in));
+		}
+	}
+	return result;
+}
+
+// Head of a text item in either encoding, both only ever write short keys
+static uint64_t key_length(const unsigned char **in, int cbor) {
+	unsigned char head = *(*in)++;
+
+	if (cbor) {
+		return ((head & 0x1f) == 24) ? get_be(in, 1) : (head & 0x1f);
+	}
+	return (head == 0xd9) ? get_be(in, 1) : (head & 0x1f);
+}
+
+static cJSON *text_item(const unsigned char **in, uint64_t length) {
+	cJSON *item = cJSON_CreateString("");
+
+	free(item->valuestring);
+	item->valuestring = strndup((const char *)*in, length);
+	*in += length;
+	return item;
+}
+
+// Same types, strings, numbers and members in the same order
+static int same(const cJSON *a, const cJSON *b) {
+	if (a == NULL || b == NULL || (a->type & 0xff) != (b->type & 0xff)) {
+		return 0;
+	}
+	if (cJSON_IsNumber(a)) {
+		return a->valuedouble == b->valuedouble;
+	}
+	if (cJSON_IsString(a)) {
+		return strcmp(a->valuestring, b->valuestring) == 0;
+	}
+
+	for (a = a->child, b = b->child; a != NULL && b != NULL; a = a->next, b = b->next) {
+		if ((a->string != NULL) != (b->string != NULL) ||
+		    (a->string != NULL && strcmp(a->string, b->string) != 0) || !same(a, b)) {
+			return 0;
+		}
+	}
+	return a == NULL && b == NULL;
+}
@@ -0,0 +1,146 @@
+/*
+file: bench/harmonics_bench.c
+
+Description:
+	Block throughput of the harmonic analysis. harmonics_analyse() is
+	timed per block size on a 60 Hz signal with a 3rd and 5th harmonic,
+	sampled so a block holds four cycles, and its result is checked
+	against the signal first; ns/sample bounds the sample rate one core
+	can analyse. Then the sampler side: every channel's samples go
+	through harmonics_push() with the worker running, as fast as the
+	loop can push them. That is the cost on the acquisition path; the
+	blocks dropped there only show the worker falling behind a rate far
+	above any ADC's.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../harmonics.h"
+
+#define CYCLES_PER_BLOCK 4
+#define FUNDAMENTAL_HZ 60.0
+#define PUSH_CHANNELS 8
+#define PUSH_BLOCK 256
+#define PUSH_SAMPLES (1 << 20)	// per channel
+#define PUSH_RATE_HZ 10000.0
+
+// FUNCTION SIGNATURES
+static double	signal_at(double seconds);
+static int	check(int block, const struct record_harmonics *result);
+static void	run_blocks(int block);
+static void	run_push();
+
+int main() {
+	int block;
+
+	printf("%-8s %10s %12s %10s %6s %8s\n", "block", "us/block", "ns/sample", "fund Hz", "THD", "A1 A3 A5");
+	for (block = HARMONICS_MIN_BLOCK; block <= HARMONICS_MAX_BLOCK; block *= 2) {
+		run_blocks(block);
+	}
+
+	run_push();
+	return 0;
+}
+
+// mA, 1000 fundamental, 100 third, 50 fifth: THD 111.8 thousandths
+static double signal_at(double seconds) {
+	double phase = 2 * M_PI * FUNDAMENTAL_HZ * seconds;
+
+	return 1000 * sin(phase) + 100 * sin(3 * phase + 0.3) + 50 * sin(5 * phase + 1.1);
+}
+
+// Blocks too short to hold the 5th harmonic are only timed
+static int check(int block, const struct record_harmonics *result) {
+	if (block / 2 <= 5 * CYCLES_PER_BLOCK) {
+		return 0;
+	}
+
+	return fabs(result->fundamental_mhz - FUNDAMENTAL_HZ * 1000) > FUNDAMENTAL_HZ * 10 ||
+		abs(result->amplitude[0] - 1000) > 20 || abs(result->amplitude[2] - 100) > 5 ||
+		abs(result->amplitude[4] - 50) > 5 || abs(result->thd - 112) > 5;
+}
+
+static void run_blocks(int block) {
+	struct harmonics_config config = { block, HARMONICS_MAX_ORDER, 0 };
+	static float signal[HARMONICS_MAX_BLOCK], work[HARMONICS_MAX_BLOCK];
+	struct record_harmonics result;
+	double rate = FUNDAMENTAL_HZ * block / CYCLES_PER_BLOCK;
+	double start, elapsed, best = 1e9;
+	int iterations = (1 << 22) / block;
+	int run, i;
+
+	if (harmonics_configure(0, &config) < 0) {
+		fprintf(stderr, "block %d refused\n", block);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < block; i++) {
+		signal[i] = lround(signal_at(i / rate));
+	}
+
+	memcpy(work, signal, block * sizeof(*signal));
+	harmonics_analyse(0, work, rate, &result);
+	if (check(block, &result)) {
+		fprintf(stderr, "block %d: %lld mHz, THD %d, amplitudes %d %d %d\n", block,
+			result.fundamental_mhz, result.thd, result.amplitude[0], result.amplitude[2], result.amplitude[4]);
+		exit(EXIT_FAILURE);
+	}
+
+	for (run = 0; run < BENCH_RUNS; run++) {
+		start = bench_now();
+		for (i = 0; i < iterations; i++) {
+			// the analysis overwrites its input like the worker's buffers
+			memcpy(work, signal, block * sizeof(*signal));
+			harmonics_analyse(0, work, rate, &result);
+			bench_sink += result.thd;
+		}
+		elapsed = bench_now() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	printf("%-8d %10.2f %12.2f %10.3f %6d %4d %3d %3d\n", block, best / iterations * 1e6,
+		best / iterations / block * 1e9, result.fundamental_mhz / 1000.0, result.thd,
+		result.amplitude[0], result.amplitude[2], result.amplitude[4]);
+}
+
+// Sampler thread view, every channel interleaved like a sweep
+static void run_push() {
+	struct harmonics_config config = { PUSH_BLOCK, HARMONICS_MAX_ORDER, 0 };
+	static int values[PUSH_BLOCK * CYCLES_PER_BLOCK];
+	struct sample sample;
+	long long taken_ns;
+	double start, elapsed;
+	int channel, i;
+
+	for (i = 0; i < PUSH_BLOCK * CYCLES_PER_BLOCK; i++) {
+		values[i] = lround(signal_at(i / PUSH_RATE_HZ));
+	}
+
+	for (channel = 0; channel < PUSH_CHANNELS; channel++) {
+		harmonics_configure(channel, &config);
+	}
+	if (harmonics_start() < 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	start = bench_now();
+	for (i = 0; i < PUSH_SAMPLES; i++) {
+		taken_ns = i * (long long)(1e9 / PUSH_RATE_HZ);
+		sample.taken.tv_sec = taken_ns / 1000000000;
+		sample.taken.tv_nsec = taken_ns % 1000000000;
+		for (channel = 0; channel < PUSH_CHANNELS; channel++) {
+			sample.channel = channel;
+			harmonics_push(&sample, values[i % (PUSH_BLOCK * CYCLES_PER_BLOCK)]);
+		}
+	}
+	elapsed = bench_now() - start;
+	harmonics_stop();
+
+	printf("\nharmonics_push, %d channels, blocks of %d, worker running\n", PUSH_CHANNELS, PUSH_BLOCK);
+	printf("%.1f ns per sample, %.0f samples/s pushed, %llu of %d blocks dropped\n",
+		elapsed / PUSH_SAMPLES / PUSH_CHANNELS * 1e9, PUSH_SAMPLES * PUSH_CHANNELS / elapsed,
+		harmonics_dropped(), PUSH_SAMPLES / PUSH_BLOCK * PUSH_CHANNELS);
+}
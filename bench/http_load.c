@@ -0,0 +1,334 @@
+/*
+file: bench/http_load.c
+
+Description:
+	Load generator for the HTTP endpoint, see http.h. A fixed number of
+	connections each keep one request in flight and the tool reports
+	requests per second and latency percentiles for:
+
+		GET /sensors/{id}	keep-alive, ids spread over the sensors
+		GET /sensors		keep-alive
+		GET /sensors/{id}	Connection: close, one connect per request
+
+	Without arguments it starts the server in process on a unix socket
+	and publishes HTTP_LOAD_SENSORS records to it. Given an address
+	("host:port" or "unix:/path") it loads a running daemon instead, so
+	the same numbers can be taken on the board.
+
+		bench/http_load [address] [connections] [seconds]
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../http.h"
+
+#define HTTP_LOAD_SENSORS 16
+#define HTTP_LOAD_CONNECTIONS 16
+#define HTTP_LOAD_SECONDS 2
+#define HTTP_LOAD_RESPONSE_SIZE (128 * 1024)
+#define HTTP_LOAD_SAMPLES (1 << 22)	// latencies kept for the percentiles
+
+struct client {
+	int fd;
+	int keep_alive;
+	size_t have;			// bytes of the current response read
+	size_t want;			// its full length, 0 until the headers are in
+	double sent;			// bench_now() when the request went out
+	unsigned int next_id;
+	char in[HTTP_LOAD_RESPONSE_SIZE];
+};
+
+// FUNCTION SIGNATURES
+static void	serve_in_process(const char *address);
+static void	stop_in_process();
+static void	run(const char *name, const char *path, int keep_alive);
+static int	connect_to(const char *address);
+static int	send_request(struct client *client, const char *path);
+static int	read_response(struct client *client);
+static int	compare_double(const void *a, const void *b);
+
+static struct sink sink = { &http_sink_ops, NULL, ENCODING_JSON };
+static const char *target;
+static int num_connections = HTTP_LOAD_CONNECTIONS;
+static double seconds = HTTP_LOAD_SECONDS;
+static int epoll_fd;
+static struct client *clients;
+static double *latencies;
+static long long num_latencies;
+static long long errors;
+
+int main(int argc, char **argv) {
+	char address[HTTP_LISTEN_SIZE];
+
+	if (argc > 1) {
+		target = argv[1];
+	} else {
+		snprintf(address, sizeof(address), "unix:/tmp/http_load.%d.sock", (int)getpid());
+		serve_in_process(address);
+		target = address;
+	}
+	if (argc > 2) {
+		num_connections = atoi(argv[2]);
+	}
+	if (argc > 3) {
+		seconds = atof(argv[3]);
+	}
+	if (num_connections < 1 || seconds <= 0) {
+		fprintf(stderr, "usage: %s [address] [connections] [seconds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	clients = calloc(num_connections, sizeof(*clients));
+	latencies = malloc(HTTP_LOAD_SAMPLES * sizeof(*latencies));
+	epoll_fd = epoll_create1(0);
+	if (clients == NULL || latencies == NULL || epoll_fd < 0) {
+		perror("Failed to set up the load generator.");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s, %d connections, %.1f s per test\n", target, num_connections, seconds);
+	printf("%-28s %10s %9s %9s %9s %7s\n", "request", "req/s", "p50 us", "p99 us", "max us", "errors");
+	run("GET /sensors/{id}", NULL, 1);
+	run("GET /sensors", "/sensors", 1);
+	run("GET /sensors/{id}, close", NULL, 0);
+
+	if (argc <= 1) {
+		stop_in_process();
+		unlink(address + 5);
+	}
+	return (errors == 0) ? 0 : EXIT_FAILURE;
+}
+
+// Opens the HTTP sink the way the output stage would and gives it
+// something to serve. Its worker thread is never needed after this.
+static void serve_in_process(const char *address) {
+	struct record record;
+	int i;
+
+	if (http_configure(address) != 0 || http_sink_ops.open(&sink) != 0) {
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&record, 0, sizeof(record));
+	strcpy(record.unit, "mA");
+	for (i = 0; i < HTTP_LOAD_SENSORS; i++) {
+		record.sensor_id = i + 1;
+		record.value = 1000 + i;
+		clock_gettime(CLOCK_MONOTONIC, &record.taken);
+		http_sink_ops.write(&sink, &record);
+	}
+	http_sink_ops.flush(&sink);
+}
+
+static void stop_in_process() {
+	http_sink_ops.close(&sink);
+}
+
+// path NULL spreads requests over /sensors/1 .. /sensors/HTTP_LOAD_SENSORS
+static void run(const char *name, const char *path, int keep_alive) {
+	struct epoll_event events[64];
+	struct epoll_event event;
+	struct client *client;
+	double start, end, now;
+	long long completed = 0;
+	long long run_errors = 0;
+	int count, i, result;
+
+	num_latencies = 0;
+	start = bench_now();
+	end = start + seconds;
+
+	for (i = 0; i < num_connections; i++) {
+		client = &clients[i];
+		client->keep_alive = keep_alive;
+		client->next_id = i;
+		client->fd = connect_to(target);
+		if (client->fd < 0) {
+			exit(EXIT_FAILURE);
+		}
+		event.events = EPOLLIN;
+		event.data.ptr = client;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+		send_request(client, path);
+	}
+
+	while ((now = bench_now()) < end) {
+		count = epoll_wait(epoll_fd, events, 64, 100);
+		for (i = 0; i < count; i++) {
+			client = events[i].data.ptr;
+			result = read_response(client);
+			if (result == 0) {
+				continue;	// not complete yet
+			}
+
+			now = bench_now();
+			if (result > 0) {
+				completed++;
+				if (num_latencies < HTTP_LOAD_SAMPLES) {
+					latencies[num_latencies++] = now - client->sent;
+				}
+			} else {
+				run_errors++;
+			}
+
+			if (!keep_alive || result < 0) {
+				close(client->fd);
+				client->fd = connect_to(target);
+				if (client->fd < 0) {
+					exit(EXIT_FAILURE);
+				}
+				event.events = EPOLLIN;
+				event.data.ptr = client;
+				epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event);
+			}
+			if (send_request(client, path) != 0) {
+				run_errors++;
+			}
+		}
+	}
+
+	for (i = 0; i < num_connections; i++) {
+		close(clients[i].fd);	// also drops it from the epoll set
+	}
+
+	qsort(latencies, num_latencies, sizeof(*latencies), compare_double);
+	if (num_latencies == 0) {
+		latencies[0] = 0;
+		num_latencies = 1;
+	}
+	printf("%-28s %10.0f %9.1f %9.1f %9.1f %7lld\n", name, completed / (now - start),
+		latencies[num_latencies / 2] * 1e6, latencies[num_latencies * 99 / 100] * 1e6,
+		latencies[num_latencies - 1] * 1e6, run_errors);
+	errors += run_errors;
+}
+
+// Blocking connect, then non blocking like the server's own sockets
+static int connect_to(const char *address) {
+	struct sockaddr_in inet_address;
+	struct sockaddr_un unix_address;
+	char host[HTTP_LISTEN_SIZE];
+	char *port;
+	int fd, one = 1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		memset(&unix_address, 0, sizeof(unix_address));
+		unix_address.sun_family = AF_UNIX;
+		strncpy(unix_address.sun_path, address + 5, sizeof(unix_address.sun_path) - 1);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) < 0) {
+			perror("Failed to connect to HTTP unix socket.");
+			goto fail;
+		}
+	} else {
+		snprintf(host, sizeof(host), "%s", address);
+		port = strrchr(host, ':');
+		if (port == NULL) {
+			fprintf(stderr, "HTTP address %s has no port.\n", address);
+			return -1;
+		}
+		*port++ = '\0';
+
+		memset(&inet_address, 0, sizeof(inet_address));
+		inet_address.sin_family = AF_INET;
+		inet_address.sin_port = htons(atoi(port));
+		if (inet_pton(AF_INET, host, &inet_address.sin_addr) != 1) {
+			fprintf(stderr, "Bad HTTP address %s\n", address);
+			return -1;
+		}
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&inet_address, sizeof(inet_address)) < 0) {
+			perror("Failed to connect to HTTP server.");
+			goto fail;
+		}
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	return fd;
+
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+static int send_request(struct client *client, const char *path) {
+	char request[128];
+	char id_path[32];
+	int length;
+
+	if (path == NULL) {
+		snprintf(id_path, sizeof(id_path), "/sensors/%u", client->next_id++ % HTTP_LOAD_SENSORS + 1);
+		path = id_path;
+	}
+	length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+		path, client->keep_alive ? "" : "Connection: close\r\n");
+
+	client->have = 0;
+	client->want = 0;
+	client->sent = bench_now();
+	return (send(client->fd, request, length, MSG_NOSIGNAL) == length) ? 0 : -1;
+}
+
+// 1 once a 200 response is complete, 0 while more is expected, -1 on
+// anything else (error status, closed early, oversized)
+static int read_response(struct client *client) {
+	char *end, *length;
+	ssize_t count;
+
+	while (1) {
+		count = read(client->fd, client->in + client->have, sizeof(client->in) - 1 - client->have);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count < 0 && errno == EAGAIN) {
+			return 0;
+		}
+		if (count <= 0) {
+			return -1;
+		}
+		client->have += count;
+
+		if (client->want == 0) {
+			client->in[client->have] = '\0';
+			end = strstr(client->in, "\r\n\r\n");
+			if (end == NULL) {
+				if (client->have == sizeof(client->in) - 1) {
+					return -1;
+				}
+				continue;
+			}
+			length = strstr(client->in, "\r\nContent-Length:");
+			if (strncmp(client->in, "HTTP/1.1 200", 12) != 0 || length == NULL || length > end) {
+				return -1;
+			}
+			client->want = end + 4 - client->in + strtoul(length + 17, NULL, 10);
+			if (client->want >= sizeof(client->in)) {
+				return -1;
+			}
+		}
+		if (client->have >= client->want) {
+			return 1;
+		}
+	}
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
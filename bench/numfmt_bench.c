@@ -0,0 +1,131 @@
+/*
+file: bench/numfmt_bench.c
+
+Description:
+	numfmt against the snprintf() calls it replaced, per call, on the
+	value mixes the output path sees. Every output is compared with
+	snprintf() first, a mismatch fails the benchmark.
+*/
+
+#include <string.h>
+
+#include "bench.h"
+#include "../numfmt.h"
+
+#define VALUES (1 << 21)
+
+// FUNCTION SIGNATURES
+static int	check(const char *name, const char *expected, const char *got, size_t length);
+static void	run(const char *name, int kind);
+
+static int64_t values[VALUES];
+
+int main() {
+	uint64_t state = 88172645463325252ULL;
+	int i;
+
+	printf("%-24s %12s %12s\n", "values", "snprintf ns", "numfmt ns");
+
+	for (i = 0; i < VALUES; i++) {
+		values[i] = (int32_t)bench_random(&state);
+	}
+	run("int32, random", 0);
+
+	// widths spread evenly from 1 to 19 digits
+	for (i = 0; i < VALUES; i++) {
+		values[i] = (int64_t)(bench_random(&state) >> (bench_random(&state) % 63));
+		if (i & 1) {
+			values[i] = -values[i];
+		}
+	}
+	run("int64, mixed widths", 1);
+
+	for (i = 0; i < VALUES; i++) {
+		values[i] = bench_random(&state) % 5000;
+	}
+	run("sample values 0..4999", 0);
+
+	for (i = 0; i < VALUES; i++) {
+		values[i] = (int64_t)(bench_random(&state) % 20000000) - 10000000;
+	}
+	run("fixed, 3 decimals", 2);
+
+	return 0;
+}
+
+static int check(const char *name, const char *expected, const char *got, size_t length) {
+	if (strlen(expected) != length || memcmp(expected, got, length) != 0) {
+		fprintf(stderr, "%s: expected %s, got %.*s\n", name, expected, (int)length, got);
+		return -1;
+	}
+	return 0;
+}
+
+// kind 0 is fmt_i32, 1 fmt_i64 and 2 fmt_fixed(value, 3)
+static void run(const char *name, int kind) {
+	char expected[64], got[NUMFMT_MAX_LENGTH];
+	double start, best_printf = 1e9, best_numfmt = 1e9, elapsed;
+	long long total;
+	size_t length;
+	int64_t value;
+	int run, i;
+
+	for (i = 0; i < VALUES; i++) {
+		value = values[i];
+		if (kind == 0) {
+			snprintf(expected, sizeof(expected), "%d", (int32_t)value);
+			length = fmt_i32(got, (int32_t)value);
+		} else if (kind == 1) {
+			snprintf(expected, sizeof(expected), "%lld", (long long)value);
+			length = fmt_i64(got, value);
+		} else {
+			snprintf(expected, sizeof(expected), "%s%lld.%03d", value < 0 ? "-" : "",
+				llabs(value) / 1000, (int)(llabs(value) % 1000));
+			length = fmt_fixed(got, value, 3);
+		}
+		if (check(name, expected, got, length) < 0) {
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (run = 0; run < BENCH_RUNS; run++) {
+		total = 0;
+		start = bench_now();
+		for (i = 0; i < VALUES; i++) {
+			value = values[i];
+			if (kind == 0) {
+				total += snprintf(expected, sizeof(expected), "%d", (int32_t)value);
+			} else if (kind == 1) {
+				total += snprintf(expected, sizeof(expected), "%lld", (long long)value);
+			} else {
+				total += snprintf(expected, sizeof(expected), "%s%lld.%03d", value < 0 ? "-" : "",
+					llabs(value) / 1000, (int)(llabs(value) % 1000));
+			}
+		}
+		elapsed = bench_now() - start;
+		bench_sink += total;
+		if (elapsed < best_printf) {
+			best_printf = elapsed;
+		}
+
+		total = 0;
+		start = bench_now();
+		for (i = 0; i < VALUES; i++) {
+			value = values[i];
+			if (kind == 0) {
+				total += fmt_i32(got, (int32_t)value);
+			} else if (kind == 1) {
+				total += fmt_i64(got, value);
+			} else {
+				total += fmt_fixed(got, value, 3);
+			}
+		}
+		elapsed = bench_now() - start;
+		bench_sink += total;
+		if (elapsed < best_numfmt) {
+			best_numfmt = elapsed;
+		}
+	}
+
+	printf("%-24s %12.1f %12.1f\n", name, best_printf / VALUES * 1e9, best_numfmt / VALUES * 1e9);
+}
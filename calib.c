@@ -0,0 +1,460 @@
+/*
+file: calib.c
+
+Description:
+	Compiles calibration specs into fixed point and applies them, see
+	calib.h. calib_reference() is the plain double implementation the
+	fixed point results are checked against.
+
+	The fixed point value is within a few LSB of the double one: every
+	coefficient is rounded to half an LSB and so is every Horner step, a
+	piecewise slope loses up to half an LSB per code away from its
+	segment start. Truncating it can therefore only differ from the
+	double result by one, and only for codes that convert to within a
+	few LSB of an integer; those are the ones the correction bitmaps
+	record.
+
+	The vector paths only handle linear calibrations: the gain is split
+	into two 32 bit halves so the 64 bit product can be built from the
+	unsigned 32x32 multiplies both SSE2 and NEON have. Its sign is the
+	same for every lane and is applied afterwards, which also turns the
+	arithmetic shift of the rounding step into a logical one. Groups
+	containing a code outside the ADC range fall back to calib_apply(),
+	the others get the bitmap corrections added afterwards when the
+	calibration has any.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "calib.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CALIB_SIMD_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CALIB_SIMD_SSE2
+#endif
+
+#define CALIB_ONE (1LL << CALIB_FRAC_BITS)
+#define CALIB_MAX_VALUE ((double)(1 << 26))
+
+// FUNCTION SIGNATURES
+static int64_t	convert_fixed(const struct calib *calib, int code);
+static int	correction(const struct calib *calib, int code);
+static int	truncate_fixed(int64_t value);
+static size_t	linear_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count);
+
+int calib_parse_kind(const char *name, enum calib_kind *kind) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, "raw") == 0) {
+		*kind = CALIB_RAW;
+	} else if (strcasecmp(name, "linear") == 0) {
+		*kind = CALIB_LINEAR;
+	} else if (strcasecmp(name, "poly") == 0) {
+		*kind = CALIB_POLY;
+	} else if (strcasecmp(name, "piecewise") == 0) {
+		*kind = CALIB_PIECEWISE;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Units are written into JSON records as they are, so anything that would
+// need escaping there is refused
+int calib_valid_unit(const char *unit) {
+	int i;
+
+	if (unit == NULL || strlen(unit) >= CALIB_UNIT_SIZE) {
+		return 0;
+	}
+	for (i = 0; unit[i] != '\0'; i++) {
+		if (unit[i] == '"' || unit[i] == '\\' || (unsigned char)unit[i] < 0x20) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+// Returns -1 and leaves calib untouched when the spec is unusable
+int calib_compile(const struct calib_spec *spec, struct calib *calib) {
+	struct calib compiled;
+	double expanded[CALIB_MAX_ORDER + 1];
+	double scale, term, magnitude;
+	double slope, base;
+	int first, last;
+	int cell, segment, code;
+	int expected, difference;
+	int i, k;
+
+	if (!calib_valid_unit(spec->unit)) {
+		return -1;
+	}
+	memset(&compiled, 0, sizeof(compiled));
+	compiled.kind = spec->kind;
+	strcpy(compiled.unit, spec->unit);
+
+	switch (spec->kind) {
+		case CALIB_RAW:
+			break;
+
+		case CALIB_LINEAR:
+		case CALIB_POLY:
+			if (spec->order < 0 || spec->order > CALIB_MAX_ORDER) {
+				return -1;
+			}
+			compiled.order = spec->order;
+
+			// Expand the polynomial in (code - origin) into one in code
+			for (i = 0; i <= spec->order; i++) {
+				expanded[i] = 0;
+				term = 1;	// binomial(k, i) * (-origin)^(k - i)
+				for (k = i; k <= spec->order; k++) {
+					expanded[i] += spec->coefficients[k] * term;
+					term *= -spec->origin * (k + 1) / (k + 1 - i);
+				}
+			}
+
+			// Bounds |value| and every Horner step over the code range
+			magnitude = 0;
+			scale = 1.0;
+			for (i = 0; i <= spec->order; i++) {
+				magnitude += fabs(expanded[i] * scale);
+				scale *= CALIB_CODES;
+			}
+			if (!(magnitude < CALIB_MAX_VALUE)) {
+				return -1;
+			}
+
+			scale = 1.0;
+			for (i = 0; i <= spec->order; i++) {
+				compiled.coefficients[i] = llround(expanded[i] * scale * CALIB_ONE);
+				scale *= CALIB_CODES;
+			}
+			break;
+
+		case CALIB_PIECEWISE:
+			if (spec->points < 2 || spec->points > CALIB_MAX_POINTS) {
+				return -1;
+			}
+			compiled.segments = spec->points - 1;
+			for (i = 0; i < compiled.segments; i++) {
+				if (!(spec->code[i + 1] > spec->code[i]) ||
+				    !(fabs(spec->code[i]) < CALIB_MAX_VALUE && fabs(spec->code[i + 1]) < CALIB_MAX_VALUE)) {
+					return -1;
+				}
+
+				// Segments start at the first whole code they cover so
+				// integer codes pick the same segment as the doubles
+				slope = (spec->value[i + 1] - spec->value[i]) / (spec->code[i + 1] - spec->code[i]);
+				compiled.start[i] = ceil(spec->code[i]);
+				base = spec->value[i] + slope * (compiled.start[i] - spec->code[i]);
+				if (!(fabs(base) < CALIB_MAX_VALUE && fabs(slope) < CALIB_MAX_VALUE)) {
+					return -1;
+				}
+
+				// Codes converted on this segment, the end segments are
+				// extrapolated
+				first = (i == 0) ? 0 : compiled.start[i];
+				last = (i + 1 == compiled.segments) ? CALIB_CODES - 1 : ceil(spec->code[i + 1]) - 1;
+				if (first < 0) {
+					first = 0;
+				}
+				if (last > CALIB_CODES - 1) {
+					last = CALIB_CODES - 1;
+				}
+				if (first <= last &&
+				    !(fabs(base + slope * (first - compiled.start[i])) < CALIB_MAX_VALUE &&
+				      fabs(base + slope * (last - compiled.start[i])) < CALIB_MAX_VALUE)) {
+					return -1;
+				}
+
+				compiled.base[i] = llround(base * CALIB_ONE);
+				compiled.slope[i] = llround(slope * CALIB_ONE);
+			}
+
+			// Segment holding the start of every index cell, the lookup
+			// only walks forward from there
+			segment = 0;
+			for (cell = 0; cell < (1 << CALIB_INDEX_BITS); cell++) {
+				while (segment + 1 < compiled.segments &&
+				       compiled.start[segment + 1] <= cell << (CALIB_INPUT_BITS - CALIB_INDEX_BITS)) {
+					segment++;
+				}
+				compiled.first_segment[cell] = segment;
+			}
+			break;
+
+		default:
+			return -1;
+	}
+
+	// Every code the ADC can produce has to convert like the doubles, the
+	// ones that truncate to the neighbouring integer are corrected
+	if (compiled.kind != CALIB_RAW) {
+		for (code = 0; code < CALIB_CODES; code++) {
+			expected = (int)calib_reference(spec, code);
+			difference = expected - truncate_fixed(convert_fixed(&compiled, code));
+			if (difference == 1) {
+				compiled.round_up[code / 64] |= 1ULL << (code % 64);
+			} else if (difference == -1) {
+				compiled.round_down[code / 64] |= 1ULL << (code % 64);
+			} else if (difference != 0) {
+#ifdef DEBUG
+				fprintf(stderr, "Calibration converts code %d to %d instead of %d.\n",
+					code, expected - difference, expected);
+#endif
+				return -1;
+			}
+			compiled.corrections += (difference != 0);
+		}
+	}
+
+	*calib = compiled;
+	return 0;
+}
+
+int calib_apply(const struct calib *calib, int code) {
+	if (calib->kind == CALIB_RAW) {
+		return code;
+	}
+	return truncate_fixed(convert_fixed(calib, code)) + correction(calib, code);
+}
+
+// Converts count codes, bit exact with calling calib_apply() on each
+void calib_apply_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count) {
+	size_t done = 0;
+
+	if (calib->kind == CALIB_LINEAR) {
+		done = linear_block(calib, codes, values, count);
+	}
+	calib_apply_block_scalar(calib, codes + done, values + done, count - done);
+}
+
+void calib_apply_block_scalar(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count) {
+	size_t i;
+
+	if (calib->kind == CALIB_RAW) {
+		memmove(values, codes, count * sizeof(*codes));
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		values[i] = calib_apply(calib, codes[i]);
+	}
+}
+
+void calib_convert_sweep(const struct calib *calibration, int channels,
+		const int32_t *codes, int32_t *values, size_t count) {
+	int channel;
+
+	for (channel = 0; channel < channels; channel++) {
+		calib_apply_block(&calibration[channel], codes + channel * count, values + channel * count, count);
+	}
+}
+
+const char *calib_simd_name() {
+#if defined(CALIB_SIMD_NEON)
+	return "neon";
+#elif defined(CALIB_SIMD_SSE2)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+double calib_reference(const struct calib_spec *spec, int code) {
+	double value = 0;
+	int segment;
+	int i;
+
+	switch (spec->kind) {
+		case CALIB_LINEAR:
+		case CALIB_POLY:
+			for (i = spec->order; i >= 0; i--) {
+				value = value * (code - spec->origin) + spec->coefficients[i];
+			}
+			return value;
+
+		case CALIB_PIECEWISE:
+			for (segment = 0; segment + 2 < spec->points && code >= spec->code[segment + 1]; segment++);
+			return spec->value[segment] + (spec->value[segment + 1] - spec->value[segment]) /
+				(spec->code[segment + 1] - spec->code[segment]) * (code - spec->code[segment]);
+
+		default:
+			return code;
+	}
+}
+
+// Q(CALIB_FRAC_BITS) value of code before truncation
+static int64_t convert_fixed(const struct calib *calib, int code) {
+	int64_t value;
+	int cell, segment;
+	int i;
+
+	if (calib->kind == CALIB_PIECEWISE) {
+		cell = code >> (CALIB_INPUT_BITS - CALIB_INDEX_BITS);
+		if (cell < 0) {
+			cell = 0;
+		} else if (cell >= (1 << CALIB_INDEX_BITS)) {
+			cell = (1 << CALIB_INDEX_BITS) - 1;
+		}
+		segment = calib->first_segment[cell];
+		while (segment + 1 < calib->segments && code >= calib->start[segment + 1]) {
+			segment++;
+		}
+		return calib->base[segment] + calib->slope[segment] * (code - calib->start[segment]);
+	}
+
+	// Horner on code / full_scale, the scale is folded into d_k
+	value = calib->coefficients[calib->order];
+	for (i = calib->order - 1; i >= 0; i--) {
+		value = ((value * code + (1 << (CALIB_INPUT_BITS - 1))) >> CALIB_INPUT_BITS) +
+			calib->coefficients[i];
+	}
+	return value;
+}
+
+// +1, -1 or 0 from the bitmaps, codes outside the ADC range have none
+static int correction(const struct calib *calib, int code) {
+	unsigned int word, bit;
+
+	if ((unsigned int)code >= CALIB_CODES) {
+		return 0;
+	}
+	word = (unsigned int)code / 64;
+	bit = (unsigned int)code % 64;
+	return (int)((calib->round_up[word] >> bit) & 1) - (int)((calib->round_down[word] >> bit) & 1);
+}
+
+// Q(CALIB_FRAC_BITS) to int, rounding toward zero like a double to int cast.
+// Branch free, a current channel swings around zero from sample to sample.
+static int truncate_fixed(int64_t value) {
+	int64_t sign = value >> 63;
+
+	return (int)(((((value ^ sign) - sign) >> CALIB_FRAC_BITS) ^ sign) - sign);
+}
+
+// Vector part of a linear block, returns how many values were written.
+// value = trunc((((gain * code + 2^(CALIB_INPUT_BITS - 1)) >> CALIB_INPUT_BITS) + offset) >> CALIB_FRAC_BITS)
+#if defined(CALIB_SIMD_SSE2)
+static size_t linear_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count) {
+	int64_t gain = calib->coefficients[1];
+	uint64_t magnitude = (gain < 0) ? -(uint64_t)gain : (uint64_t)gain;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i out_of_range = _mm_set1_epi32(~(CALIB_CODES - 1));
+	const __m128i gain_high = _mm_set1_epi32((uint32_t)(magnitude >> 32));
+	const __m128i gain_low = _mm_set1_epi32((uint32_t)magnitude);
+	const __m128i negate = _mm_set1_epi32((gain < 0) ? -1 : 0);
+	// floor((x + half) / scale) of a negative x is -((|x| + half - 1) >> bits)
+	const __m128i round = _mm_set1_epi64x((gain < 0) ? (1 << (CALIB_INPUT_BITS - 1)) - 1 : 1 << (CALIB_INPUT_BITS - 1));
+	const __m128i offset = _mm_set1_epi64x(calib->coefficients[0]);
+	__m128i code, lanes[2], product, value, sign;
+	size_t i, j;
+	int half;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		code = _mm_loadu_si128((const __m128i *)(codes + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(code, out_of_range), zero)) != 0xffff) {
+			calib_apply_block_scalar(calib, codes + i, values + i, 4);
+			continue;
+		}
+
+		// two codes per register, zero extended to 64 bits
+		lanes[0] = _mm_unpacklo_epi32(code, zero);
+		lanes[1] = _mm_unpackhi_epi32(code, zero);
+		for (half = 0; half < 2; half++) {
+			product = _mm_add_epi64(_mm_slli_epi64(_mm_mul_epu32(lanes[half], gain_high), 32),
+				_mm_mul_epu32(lanes[half], gain_low));
+			value = _mm_srli_epi64(_mm_add_epi64(product, round), CALIB_INPUT_BITS);
+			value = _mm_sub_epi64(_mm_xor_si128(value, negate), negate);
+			value = _mm_add_epi64(value, offset);
+
+			// truncate toward zero: shift the magnitude, restore the sign
+			sign = _mm_shuffle_epi32(_mm_srai_epi32(value, 31), _MM_SHUFFLE(3, 3, 1, 1));
+			value = _mm_sub_epi64(_mm_xor_si128(value, sign), sign);
+			value = _mm_srli_epi64(value, CALIB_FRAC_BITS);
+			value = _mm_sub_epi64(_mm_xor_si128(value, sign), sign);
+			lanes[half] = _mm_shuffle_epi32(value, _MM_SHUFFLE(3, 1, 2, 0));
+		}
+		_mm_storeu_si128((__m128i *)(values + i), _mm_unpacklo_epi64(lanes[0], lanes[1]));
+
+		if (calib->corrections != 0) {
+			for (j = i; j < i + 4; j++) {
+				values[j] += correction(calib, codes[j]);
+			}
+		}
+	}
+
+	return i;
+}
+#elif defined(CALIB_SIMD_NEON)
+static size_t linear_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count) {
+	int64_t gain = calib->coefficients[1];
+	uint64_t magnitude = (gain < 0) ? -(uint64_t)gain : (uint64_t)gain;
+	const uint32x4_t last_code = vdupq_n_u32(CALIB_CODES - 1);
+	const uint32x2_t gain_high = vdup_n_u32((uint32_t)(magnitude >> 32));
+	const uint32x2_t gain_low = vdup_n_u32((uint32_t)magnitude);
+	const int64x2_t negate = vdupq_n_s64((gain < 0) ? -1 : 0);
+	// floor((x + half) / scale) of a negative x is -((|x| + half - 1) >> bits)
+	const uint64x2_t round = vdupq_n_u64((gain < 0) ? (1 << (CALIB_INPUT_BITS - 1)) - 1 : 1 << (CALIB_INPUT_BITS - 1));
+	const int64x2_t offset = vdupq_n_s64(calib->coefficients[0]);
+	uint32x4_t code, beyond;
+	uint32x2_t lanes[2];
+	int32x2_t narrowed[2];
+	uint64x2_t product;
+	int64x2_t value, sign;
+	size_t i, j;
+	int half;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		code = vreinterpretq_u32_s32(vld1q_s32(codes + i));
+		// negative codes compare as huge unsigned ones
+		beyond = vcgtq_u32(code, last_code);
+		if (vget_lane_u64(vreinterpret_u64_u32(vorr_u32(vget_low_u32(beyond), vget_high_u32(beyond))), 0) != 0) {
+			calib_apply_block_scalar(calib, codes + i, values + i, 4);
+			continue;
+		}
+		lanes[0] = vget_low_u32(code);
+		lanes[1] = vget_high_u32(code);
+
+		for (half = 0; half < 2; half++) {
+			product = vaddq_u64(vshlq_n_u64(vmull_u32(lanes[half], gain_high), 32),
+				vmull_u32(lanes[half], gain_low));
+			value = vreinterpretq_s64_u64(vshrq_n_u64(vaddq_u64(product, round), CALIB_INPUT_BITS));
+			value = vsubq_s64(veorq_s64(value, negate), negate);
+			value = vaddq_s64(value, offset);
+
+			// truncate toward zero: shift the magnitude, restore the sign
+			sign = vshrq_n_s64(value, 63);
+			value = vsubq_s64(veorq_s64(value, sign), sign);
+			value = vreinterpretq_s64_u64(vshrq_n_u64(vreinterpretq_u64_s64(value), CALIB_FRAC_BITS));
+			value = vsubq_s64(veorq_s64(value, sign), sign);
+			narrowed[half] = vmovn_s64(value);
+		}
+		vst1q_s32(values + i, vcombine_s32(narrowed[0], narrowed[1]));
+
+		if (calib->corrections != 0) {
+			for (j = i; j < i + 4; j++) {
+				values[j] += correction(calib, codes[j]);
+			}
+		}
+	}
+
+	return i;
+}
+#else
+static size_t linear_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count) {
+	return 0;
+}
+#endif
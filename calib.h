@@ -0,0 +1,95 @@
+/*
+file: calib.h
+
+Description:
+	Per channel calibration of raw ADC codes. A calibration is described
+	in floating point (from config.json) and compiled once into fixed
+	point so converting a sample is a handful of integer operations:
+
+		raw		value = code
+		linear		value = gain * code + offset
+		poly		value = c0 + c1 * code + ... + cN * code^N
+		piecewise	straight lines between (code, value) points,
+				the end segments are extrapolated
+
+	Converted values are truncated toward zero like the old double
+	conversion did. The fixed point value can land on the other side of
+	an integer than the double one, so calib_compile() converts every
+	code both ways and keeps a bitmap of the codes whose result has to
+	be moved up or down by one. calib_apply() therefore returns exactly
+	(int)calib_reference() for every code the ADC can produce, using
+	integer operations only; codes outside that range are not corrected.
+
+	Blocks of samples can be converted in one call. Linear calibrations
+	run on NEON (ARM) or SSE2 (x86) when the compiler targets them and
+	give exactly the same results as calib_apply(), corrections
+	included; the other kinds use the scalar loop.
+*/
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CALIB_MAX_CHANNELS 16
+#define CALIB_MAX_ORDER 5
+#define CALIB_MAX_POINTS 16
+#define CALIB_UNIT_SIZE 8	// copied into record.unit as is
+
+// Coefficients are Q(CALIB_FRAC_BITS). Codes are normalized by the ADC
+// full scale so every Horner step stays inside 64 bits for |value| < 2^26,
+// calib_compile() rejects calibrations that can leave that range.
+#define CALIB_FRAC_BITS 24
+#define CALIB_INPUT_BITS 12
+#define CALIB_CODES (1 << CALIB_INPUT_BITS)
+#define CALIB_INDEX_BITS 6	// piecewise segment index granularity
+
+enum calib_kind {
+	CALIB_RAW = 0,
+	CALIB_LINEAR,
+	CALIB_POLY,
+	CALIB_PIECEWISE
+};
+
+// Floating point description, as read from the config
+struct calib_spec {
+	enum calib_kind kind;
+	int order;				// linear/poly: highest power
+	double coefficients[CALIB_MAX_ORDER + 1];	// c0 first, linear is {offset, gain}
+	double origin;				// linear/poly: polynomial in (code - origin)
+	int points;				// piecewise: number of points
+	double code[CALIB_MAX_POINTS];		// strictly increasing
+	double value[CALIB_MAX_POINTS];
+	const char *unit;
+};
+
+// Compiled form used per sample
+struct calib {
+	enum calib_kind kind;
+	char unit[CALIB_UNIT_SIZE];
+	int order;
+	int64_t coefficients[CALIB_MAX_ORDER + 1];	// d_k = c_k * full_scale^k
+	int segments;
+	int32_t start[CALIB_MAX_POINTS];	// first code of every segment
+	int64_t base[CALIB_MAX_POINTS];		// value at start
+	int64_t slope[CALIB_MAX_POINTS];	// value per code
+	uint8_t first_segment[1 << CALIB_INDEX_BITS];
+	int corrections;			// codes set in round_up or round_down
+	uint64_t round_up[CALIB_CODES / 64];	// truncated fixed point is one low
+	uint64_t round_down[CALIB_CODES / 64];	// truncated fixed point is one high
+};
+
+int	calib_parse_kind(const char *name, enum calib_kind *kind);
+int	calib_compile(const struct calib_spec *spec, struct calib *calib);
+int	calib_valid_unit(const char *unit);
+int	calib_apply(const struct calib *calib, int code);
+double	calib_reference(const struct calib_spec *spec, int code);
+void	calib_apply_block(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count);
+void	calib_apply_block_scalar(const struct calib *calib, const int32_t *codes, int32_t *values, size_t count);
+// codes and values are channel major: sample i of channel c at [c * count + i]
+void	calib_convert_sweep(const struct calib *calibration, int channels,
+		const int32_t *codes, int32_t *values, size_t count);
+const char *calib_simd_name();
+
+#endif
@@ -31,6 +31,7 @@
 #include <float.h>
 #include <limits.h>
 #include <ctype.h>
+#include <locale.h>
 #pragma GCC visibility pop
 
 #include "cJSON.h"
@@ -86,9 +87,166 @@ typedef struct internal_hooks
     void *(*allocate)(size_t size);
     void (*deallocate)(void *pointer);
     void *(*reallocate)(void *pointer, size_t size);
+    /* when set, the parser takes its items and strings from here instead */
+    cJSON_Arena *arena;
 } internal_hooks;
 
-static internal_hooks global_hooks = { malloc, free, realloc };
+static internal_hooks global_hooks = { malloc, free, realloc, NULL };
+
+/* A chunk of an arena, the memory handed out follows the (aligned) header. */
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    size_t serial; /* chunks_made when it was allocated */
+} arena_chunk;
+
+struct cJSON_Arena
+{
+    arena_chunk *chunks; /* the chunk being filled first */
+    size_t chunk_size;
+    size_t chunks_made;
+};
+
+/* keep every allocation aligned for the double in cJSON */
+#define arena_align(size) (((size) + (sizeof(double) - 1)) & ~(sizeof(double) - 1))
+#define ARENA_HEADER arena_align(sizeof(arena_chunk))
+
+static void *arena_allocate(cJSON_Arena * const arena, size_t size)
+{
+    arena_chunk *chunk = arena->chunks;
+
+    size = arena_align(size);
+    if ((chunk != NULL) && ((chunk->size - chunk->used) >= size))
+    {
+        chunk->used += size;
+        return (unsigned char*)chunk + ARENA_HEADER + chunk->used - size;
+    }
+
+    chunk = (arena_chunk*)global_hooks.allocate(ARENA_HEADER + ((size > arena->chunk_size) ? size : arena->chunk_size));
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    chunk->size = (size > arena->chunk_size) ? size : arena->chunk_size;
+    chunk->used = size;
+    chunk->serial = ++arena->chunks_made;
+
+    if ((arena->chunks != NULL) && (size > arena->chunk_size))
+    {
+        /* an oversized block gets a chunk of its own, keep filling the current one */
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    }
+    else
+    {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    return (unsigned char*)chunk + ARENA_HEADER;
+}
+
+/* Allocate/free parser memory, from the arena if there is one. */
+static void *parser_allocate(const internal_hooks * const hooks, size_t size)
+{
+    if (hooks->arena != NULL)
+    {
+        return arena_allocate(hooks->arena, size);
+    }
+
+    return hooks->allocate(size);
+}
+
+static void parser_deallocate(const internal_hooks * const hooks, void *pointer)
+{
+    /* arena memory goes with the arena */
+    if (hooks->arena == NULL)
+    {
+        hooks->deallocate(pointer);
+    }
+}
+
+CJSON_PUBLIC(cJSON_Arena *) cJSON_CreateArena(size_t chunk_size)
+{
+    cJSON_Arena *arena = (cJSON_Arena*)global_hooks.allocate(sizeof(cJSON_Arena));
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    arena->chunks = NULL;
+    arena->chunk_size = arena_align((chunk_size != 0) ? chunk_size : CJSON_ARENA_CHUNK);
+    arena->chunks_made = 0;
+
+    return arena;
+}
+
+/* Give back everything allocated since chunks_made and used were read from the arena. Older chunks keep their order, so
+ * the one that was being filled is the first again. */
+static void arena_rewind(cJSON_Arena * const arena, const size_t chunks_made, const size_t used)
+{
+    arena_chunk **link = &arena->chunks;
+    arena_chunk *chunk = NULL;
+
+    while (*link != NULL)
+    {
+        chunk = *link;
+        if (chunk->serial > chunks_made)
+        {
+            *link = chunk->next;
+            global_hooks.deallocate(chunk);
+            continue;
+        }
+        link = &chunk->next;
+    }
+    if (arena->chunks != NULL)
+    {
+        arena->chunks->used = used;
+    }
+}
+
+CJSON_PUBLIC(void) cJSON_ResetArena(cJSON_Arena *arena)
+{
+    arena_chunk *chunk = NULL;
+    arena_chunk *next = NULL;
+    arena_chunk *kept = NULL;
+
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        if ((kept == NULL) && (chunk->size == arena->chunk_size))
+        {
+            kept = chunk;
+            kept->next = NULL;
+            kept->used = 0;
+            continue;
+        }
+        global_hooks.deallocate(chunk);
+    }
+    arena->chunks = kept;
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteArena(cJSON_Arena *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    cJSON_ResetArena(arena);
+    if (arena->chunks != NULL)
+    {
+        global_hooks.deallocate(arena->chunks);
+    }
+    global_hooks.deallocate(arena);
+}
 
 static unsigned char* cJSON_strdup(const unsigned char* str, const internal_hooks * const hooks)
 {
@@ -144,7 +302,7 @@ CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
 /* Internal constructor. */
 static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
 {
-    cJSON* node = (cJSON*)hooks->allocate(sizeof(cJSON));
+    cJSON* node = (cJSON*)parser_allocate(hooks, sizeof(cJSON));
     if (node)
     {
         memset(node, '\0', sizeof(cJSON));
@@ -164,7 +322,7 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *c)
         {
             cJSON_Delete(c->child);
         }
-        if (!(c->type & cJSON_IsReference) && c->valuestring)
+        if (!(c->type & (cJSON_IsReference | cJSON_InArena)) && c->valuestring)
         {
             global_hooks.deallocate(c->valuestring);
         }
@@ -172,28 +330,187 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *c)
         {
             global_hooks.deallocate(c->string);
         }
-        global_hooks.deallocate(c);
+        cJSON_DropObjectIndex(c);
+        if (!(c->type & cJSON_InArena))
+        {
+            global_hooks.deallocate(c);
+        }
         c = next;
     }
 }
 
-/* Parse the input text to generate a number, and populate the result into item. */
-static const unsigned char *parse_number(cJSON * const item, const unsigned char * const input)
+/* Exactly representable powers of ten for the fast path of parse_number. */
+static const double exact_powers_of_ten[] =
 {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_SIGNIFICANT_DIGITS 19 /* always fit in an unsigned 64 bit integer */
+#define MAX_EXACT_INTEGER 9007199254740992ULL /* 2^53, compared as an integer: (double)(2^53 + 1) rounds down to it */
+
+/* Correctly rounded slow path: strtod on a copy of the number with the decimal point of the current locale.
+ * Returns false if a long number can't be copied. */
+static cJSON_bool parse_number_slow(const unsigned char * const input, const size_t length, double * const number, const internal_hooks * const hooks)
+{
+    unsigned char stack_buffer[64];
+    unsigned char *number_c_string = stack_buffer;
+    unsigned char decimal_point = (unsigned char)localeconv()->decimal_point[0];
+    size_t i = 0;
+
+    if (length >= sizeof(stack_buffer))
+    {
+        number_c_string = (unsigned char*)hooks->allocate(length + 1);
+        if (number_c_string == NULL)
+        {
+            return false;
+        }
+    }
+
+    for (i = 0; i < length; i++)
+    {
+        number_c_string[i] = (input[i] == '.') ? decimal_point : input[i];
+    }
+    number_c_string[length] = '\0';
+
+    *number = strtod((const char*)number_c_string, NULL);
+
+    if (number_c_string != stack_buffer)
+    {
+        hooks->deallocate(number_c_string);
+    }
+
+    return true;
+}
+
+/* Parse the input text to generate a number, and populate the result into item.
+ * The number is read without strtod: up to 19 significant digits are collected in an integer, which is exact for
+ * integers and for mantissas up to 2^53 scaled by an exactly representable power of ten (at most 1e22).
+ * Only longer or more extreme numbers go to strtod, so the result never depends on the locale. */
+static const unsigned char *parse_number(cJSON * const item, const unsigned char * const input, const internal_hooks * const hooks)
+{
+    const unsigned char *pointer = input;
+    unsigned long long mantissa = 0;
+    int significant_digits = 0;
+    int decimal_exponent = 0;
+    int exponent = 0;
+    cJSON_bool negative = false;
+    cJSON_bool negative_exponent = false;
+    cJSON_bool truncated = false;
     double number = 0;
-    unsigned char *after_end = NULL;
 
     if (input == NULL)
     {
         return NULL;
     }
 
-    number = strtod((const char*)input, (char**)&after_end);
-    if (input == after_end)
+    if (*pointer == '-')
+    {
+        negative = true;
+        pointer++;
+    }
+    if ((*pointer < '0') || (*pointer > '9'))
     {
         return NULL; /* parse_error */
     }
 
+    /* integer part */
+    for (; (*pointer >= '0') && (*pointer <= '9'); pointer++)
+    {
+        if ((mantissa == 0) && (*pointer == '0'))
+        {
+            continue; /* leading zero */
+        }
+        if (significant_digits < MAX_SIGNIFICANT_DIGITS)
+        {
+            mantissa = (mantissa * 10) + (unsigned long long)(*pointer - '0');
+            significant_digits++;
+        }
+        else
+        {
+            decimal_exponent++;
+            truncated |= (*pointer != '0');
+        }
+    }
+
+    /* fraction */
+    if (*pointer == '.')
+    {
+        for (pointer++; (*pointer >= '0') && (*pointer <= '9'); pointer++)
+        {
+            if ((mantissa == 0) && (*pointer == '0'))
+            {
+                decimal_exponent--;
+            }
+            else if (significant_digits < MAX_SIGNIFICANT_DIGITS)
+            {
+                mantissa = (mantissa * 10) + (unsigned long long)(*pointer - '0');
+                significant_digits++;
+                decimal_exponent--;
+            }
+            else
+            {
+                truncated |= (*pointer != '0');
+            }
+        }
+    }
+
+    /* exponent, only if there are digits after the 'e' */
+    if ((*pointer == 'e') || (*pointer == 'E'))
+    {
+        const unsigned char *exponent_pointer = pointer + 1;
+        if ((*exponent_pointer == '+') || (*exponent_pointer == '-'))
+        {
+            negative_exponent = (*exponent_pointer == '-');
+            exponent_pointer++;
+        }
+        if ((*exponent_pointer >= '0') && (*exponent_pointer <= '9'))
+        {
+            for (pointer = exponent_pointer; (*pointer >= '0') && (*pointer <= '9'); pointer++)
+            {
+                /* anything this large over- or underflows anyway */
+                if (exponent < 100000)
+                {
+                    exponent = (exponent * 10) + (*pointer - '0');
+                }
+            }
+            decimal_exponent += negative_exponent ? -exponent : exponent;
+        }
+    }
+
+    if ((mantissa == 0) && !truncated)
+    {
+        number = 0;
+    }
+    else if (!truncated && (decimal_exponent == 0))
+    {
+        /* integer, the conversion rounds correctly */
+        number = (double)mantissa;
+    }
+#if !defined(FLT_EVAL_METHOD) || (FLT_EVAL_METHOD == 0)
+    else if (!truncated && (mantissa <= MAX_EXACT_INTEGER) && (decimal_exponent >= -22) && (decimal_exponent <= 22))
+    {
+        /* both operands are exact, so is the rounding of one multiplication or division */
+        if (decimal_exponent < 0)
+        {
+            number = (double)mantissa / exact_powers_of_ten[-decimal_exponent];
+        }
+        else
+        {
+            number = (double)mantissa * exact_powers_of_ten[decimal_exponent];
+        }
+    }
+#endif /* excess precision (x87) would round twice */
+    else if (!parse_number_slow(negative ? input + 1 : input, (size_t)(pointer - input) - (negative ? 1 : 0), &number, hooks))
+    {
+        return NULL; /* allocation failure */
+    }
+
+    if (negative)
+    {
+        number = -number;
+    }
+
     item->valuedouble = number;
 
     /* use saturation in case of overflow */
@@ -212,7 +529,7 @@ static const unsigned char *parse_number(cJSON * const item, const unsigned char
 
     item->type = cJSON_Number;
 
-    return after_end;
+    return pointer;
 }
 
 /* don't ask me, but the original cJSON_SetNumberValue returns an integer or double */
@@ -288,6 +605,14 @@ static unsigned char* ensure(printbuffer * const p, size_t needed, const interna
     {
         /* reallocate with realloc if available */
         newbuffer = (unsigned char*)hooks->reallocate(p->buffer, newsize);
+        if (newbuffer == NULL)
+        {
+            hooks->deallocate(p->buffer);
+            p->length = 0;
+            p->buffer = NULL;
+
+            return NULL;
+        }
     }
     else
     {
@@ -326,90 +651,369 @@ static void update_offset(printbuffer * const buffer)
     buffer->offset += strlen((const char*)buffer_pointer);
 }
 
-/* Removes trailing zeroes from the end of a printed number */
-static cJSON_bool trim_trailing_zeroes(printbuffer * const buffer)
+/* Shortest round-trip formatting of doubles with Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly
+ * and Accurately with Integers", PLDI 2010), along the lines of Milo Yip's implementation. The digits always read
+ * back as the same double and are the shortest such digits in all but a tiny fraction of cases. */
+typedef struct diy_fp
 {
-    size_t offset = 0;
-    unsigned char *content = NULL;
+    unsigned long long f;
+    int e;
+} diy_fp;
 
-    if ((buffer == NULL) || (buffer->buffer == NULL) || (buffer->offset < 1))
+#define DOUBLE_HIDDEN_BIT 0x0010000000000000ULL
+#define DOUBLE_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+
+/* normalized 10^-348, 10^-340, ..., 10^340 */
+static const unsigned long long cached_powers_f[] =
+{
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const short cached_powers_e[] =
+{
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661,
+    -635, -608, -582, -555, -529, -502, -475, -449, -422, -396, -369,
+    -343, -316, -289, -263, -236, -210, -183, -157, -130, -103, -77,
+    -50, -24, 3, 30, 56, 83, 109, 136, 162, 189, 216,
+    242, 269, 295, 322, 348, 375, 402, 428, 455, 481, 508,
+    534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800,
+    827, 853, 880, 907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const unsigned long long powers_of_ten_64[] =
+{
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+    10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static diy_fp diy_fp_multiply(const diy_fp x, const diy_fp y)
+{
+    const unsigned long long mask_32 = 0xFFFFFFFFULL;
+    unsigned long long a = x.f >> 32;
+    unsigned long long b = x.f & mask_32;
+    unsigned long long c = y.f >> 32;
+    unsigned long long d = y.f & mask_32;
+    unsigned long long middle = ((b * d) >> 32) + ((a * d) & mask_32) + ((b * c) & mask_32) + (1ULL << 31); /* round */
+    diy_fp product;
+
+    product.f = (a * c) + ((a * d) >> 32) + ((b * c) >> 32) + (middle >> 32);
+    product.e = x.e + y.e + 64;
+
+    return product;
+}
+
+static diy_fp diy_fp_normalize(diy_fp x)
+{
+    while (!(x.f & (1ULL << 63)))
     {
-        return false;
+        x.f <<= 1;
+        x.e--;
+    }
+
+    return x;
+}
+
+/* Remove the last digit while that moves the digits closer to the exact value and stays inside the boundaries. */
+static void grisu_round(unsigned char * const digits, const int length, const unsigned long long delta, unsigned long long rest, const unsigned long long ten_kappa, const unsigned long long distance)
+{
+    while ((rest < distance) && ((delta - rest) >= ten_kappa) &&
+           (((rest + ten_kappa) < distance) || ((distance - rest) > (rest + ten_kappa - distance))))
+    {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/* Generate the digits of the scaled value w inside the boundaries [plus - delta, plus]. */
+static int grisu_digits(const diy_fp w, const diy_fp plus, unsigned long long delta, unsigned char * const digits, int * const decimal_exponent)
+{
+    const int shift = -plus.e;
+    const unsigned long long one = 1ULL << shift;
+    const unsigned long long distance = plus.f - w.f;
+    unsigned int integral = (unsigned int)(plus.f >> shift);
+    unsigned long long fraction = plus.f & (one - 1);
+    int kappa = 0;
+    int length = 0;
+    unsigned int digit = 0;
+
+    /* the integral part has at most 9 digits */
+    for (kappa = 1; (kappa < 9) && (integral >= powers_of_ten_64[kappa]); kappa++)
+    {
+    }
+
+    while (kappa > 0)
+    {
+        digit = integral / (unsigned int)powers_of_ten_64[kappa - 1];
+        integral %= (unsigned int)powers_of_ten_64[kappa - 1];
+        if ((digit != 0) || (length != 0))
+        {
+            digits[length++] = (unsigned char)('0' + digit);
+        }
+        kappa--;
+        if ((((unsigned long long)integral << shift) + fraction) <= delta)
+        {
+            *decimal_exponent += kappa;
+            grisu_round(digits, length, delta, ((unsigned long long)integral << shift) + fraction, powers_of_ten_64[kappa] << shift, distance);
+            return length;
+        }
     }
 
-    offset = buffer->offset - 1;
-    content = buffer->buffer;
+    for (;;)
+    {
+        fraction *= 10;
+        delta *= 10;
+        digit = (unsigned int)(fraction >> shift);
+        if ((digit != 0) || (length != 0))
+        {
+            digits[length++] = (unsigned char)('0' + digit);
+        }
+        fraction &= one - 1;
+        kappa--;
+        if (fraction < delta)
+        {
+            *decimal_exponent += kappa;
+            grisu_round(digits, length, delta, fraction, one, distance * ((-kappa < 20) ? powers_of_ten_64[-kappa] : 0));
+            return length;
+        }
+    }
+}
+
+/* Shortest digits of a finite positive double, value = digits * 10^decimal_exponent. Returns the number of digits (at most 17). */
+static int grisu2(const double value, unsigned char * const digits, int * const decimal_exponent)
+{
+    unsigned long long bits = 0;
+    int biased_exponent = 0;
+    diy_fp v;
+    diy_fp plus;
+    diy_fp minus;
+    diy_fp cached_power;
+    double k = 0;
+    int index = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    biased_exponent = (int)((bits >> 52) & 0x7FF);
+    v.f = bits & DOUBLE_SIGNIFICAND_MASK;
+    if (biased_exponent != 0)
+    {
+        v.f += DOUBLE_HIDDEN_BIT;
+        v.e = biased_exponent - 1075;
+    }
+    else
+    {
+        v.e = -1074;
+    }
 
-    while ((offset > 0) && (content[offset] == '0'))
+    /* boundaries halfway to the neighbouring doubles, the lower one is closer at a power of two */
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    while (!(plus.f & (DOUBLE_HIDDEN_BIT << 1)))
     {
-        offset--;
+        plus.f <<= 1;
+        plus.e--;
     }
-    if ((offset > 0) && (content[offset] == '.'))
+    plus.f <<= 10;
+    plus.e -= 10;
+    if (v.f == DOUBLE_HIDDEN_BIT)
+    {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    }
+    else
     {
-        offset--;
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
     }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
 
-    offset++;
-    content[offset] = '\0';
+    /* cached power that brings the binary exponent of plus into [-60, -32] */
+    k = ((-61 - plus.e) * 0.30102999566398114) + 347;
+    index = (int)k;
+    if ((k - index) > 0.0)
+    {
+        index++;
+    }
+    index = (index >> 3) + 1;
+    *decimal_exponent = -(-348 + (index << 3));
+    cached_power.f = cached_powers_f[index];
+    cached_power.e = cached_powers_e[index];
 
-    buffer->offset = offset;
+    v = diy_fp_multiply(diy_fp_normalize(v), cached_power);
+    plus = diy_fp_multiply(plus, cached_power);
+    minus = diy_fp_multiply(minus, cached_power);
+    minus.f++;
+    plus.f--;
 
-    return true;
+    return grisu_digits(v, plus, plus.f - minus.f, digits, decimal_exponent);
+}
+
+/* Write the digits of an unsigned integer, returns the number of characters. */
+static int print_unsigned(unsigned long long number, unsigned char * const output)
+{
+    unsigned char reversed[20];
+    int length = 0;
+    int i = 0;
+
+    do
+    {
+        reversed[length++] = (unsigned char)('0' + (number % 10));
+        number /= 10;
+    }
+    while (number != 0);
+
+    for (i = 0; i < length; i++)
+    {
+        output[i] = reversed[length - 1 - i];
+    }
+
+    return length;
 }
 
-/* Render the number nicely from the given item into a string. */
+/* Render the number nicely from the given item into a string.
+ * Integers are printed in full as before, other numbers with the shortest digits that read back as the same double,
+ * in fixed notation from 1e-6 to 1e9 and in exponential notation otherwise. */
 static cJSON_bool print_number(const cJSON * const item, printbuffer * const output_buffer, const internal_hooks * const hooks)
 {
     unsigned char *output_pointer = NULL;
     double d = item->valuedouble;
+    unsigned char digits[18];
+    int digit_count = 0;
+    int decimal_exponent = 0;
+    int point = 0; /* position of the decimal point relative to the digits */
     int length = 0;
-    cJSON_bool trim_zeroes = true; /* should at the end be removed? */
+    int i = 0;
 
     if (output_buffer == NULL)
     {
         return false;
     }
 
-    /* This is a nice tradeoff. */
-    output_pointer = ensure(output_buffer, 64, hooks);
-    if (output_pointer == NULL)
+    /* This checks for NaN and Infinity */
+    if ((d * 0) != 0)
     {
-        return false;
+        output_pointer = ensure(output_buffer, 5, hooks);
+        if (output_pointer == NULL)
+        {
+            return false;
+        }
+        strcpy((char*)output_pointer, "null");
+        output_buffer->offset += 4;
+        return true;
     }
 
-    /* This checks for NaN and Infinity */
-    if ((d * 0) != 0)
+    if ((d == floor(d)) && (fabs(d) < 1.0e18))
     {
-        length = sprintf((char*)output_pointer, "null");
+        /* integer that fits a long long */
+        output_pointer = ensure(output_buffer, 21, hooks);
+        if (output_pointer == NULL)
+        {
+            return false;
+        }
+        if ((d < 0) || ((d == 0) && signbit(d)))
+        {
+            output_pointer[length++] = '-';
+        }
+        length += print_unsigned((unsigned long long)fabs(d), output_pointer + length);
+        output_pointer[length] = '\0';
+        output_buffer->offset += (size_t)length;
+        return true;
     }
-    else if ((fabs(floor(d) - d) <= DBL_EPSILON) && (fabs(d) < 1.0e60))
+
+    if ((d == floor(d)) && (fabs(d) < 1.0e60))
     {
-        /* integer */
+        /* big integer, all digits */
+        output_pointer = ensure(output_buffer, 64, hooks);
+        if (output_pointer == NULL)
+        {
+            return false;
+        }
         length = sprintf((char*)output_pointer, "%.0f", d);
-        trim_zeroes = false; /* don't remove zeroes for "big integers" */
+        if (length < 0)
+        {
+            return false;
+        }
+        output_buffer->offset += (size_t)length;
+        return true;
     }
-    else if ((fabs(d) < 1.0e-6) || (fabs(d) > 1.0e9))
+
+    /* sign, 17 digits, "0.00000" and "e-308" */
+    output_pointer = ensure(output_buffer, 32, hooks);
+    if (output_pointer == NULL)
     {
-        length = sprintf((char*)output_pointer, "%e", d);
-        trim_zeroes = false; /* don't remove zeroes in engineering notation */
+        return false;
     }
-    else
+    if (d < 0)
     {
-        length = sprintf((char*)output_pointer, "%f", d);
+        output_pointer[length++] = '-';
     }
+    digit_count = grisu2(fabs(d), digits, &decimal_exponent);
+    point = digit_count + decimal_exponent;
 
-    /* sprintf failed */
-    if (length < 0)
+    if ((point > 0) && (point <= 9))
     {
-        return false;
+        /* 123.45, never an integer here */
+        memcpy(output_pointer + length, digits, (size_t)point);
+        length += point;
+        output_pointer[length++] = '.';
+        memcpy(output_pointer + length, digits + point, (size_t)(digit_count - point));
+        length += digit_count - point;
     }
-
-    output_buffer->offset += (size_t)length;
-
-    if (trim_zeroes)
+    else if ((point <= 0) && (point > -6))
     {
-        return trim_trailing_zeroes(output_buffer);
+        /* 0.00012345 */
+        output_pointer[length++] = '0';
+        output_pointer[length++] = '.';
+        for (i = point; i < 0; i++)
+        {
+            output_pointer[length++] = '0';
+        }
+        memcpy(output_pointer + length, digits, (size_t)digit_count);
+        length += digit_count;
+    }
+    else
+    {
+        /* 1.2345e+60, 1e-07 */
+        output_pointer[length++] = digits[0];
+        if (digit_count > 1)
+        {
+            output_pointer[length++] = '.';
+            memcpy(output_pointer + length, digits + 1, (size_t)(digit_count - 1));
+            length += digit_count - 1;
+        }
+        output_pointer[length++] = 'e';
+        output_pointer[length++] = (point - 1 < 0) ? '-' : '+';
+        point = abs(point - 1);
+        if (point < 10)
+        {
+            output_pointer[length++] = '0';
+        }
+        length += print_unsigned((unsigned long long)point, output_pointer + length);
     }
+    output_pointer[length] = '\0';
+    output_buffer->offset += (size_t)length;
 
     return true;
 }
@@ -619,7 +1223,7 @@ static const unsigned char *parse_string(cJSON * const item, const unsigned char
 
         /* This is at most how much we need for the output */
         allocation_length = (size_t) (input_end - input) - skipped_bytes;
-        output = (unsigned char*)hooks->allocate(allocation_length + sizeof('\0'));
+        output = (unsigned char*)parser_allocate(hooks, allocation_length + sizeof('\0'));
         if (output == NULL)
         {
             goto fail; /* allocation failure */
@@ -690,7 +1294,7 @@ static const unsigned char *parse_string(cJSON * const item, const unsigned char
 fail:
     if (output != NULL)
     {
-        hooks->deallocate(output);
+        parser_deallocate(hooks, output);
     }
 
     return NULL;
@@ -821,6 +1425,7 @@ static const unsigned char *parse_array(cJSON * const item, const unsigned char
 static cJSON_bool print_array(const cJSON * const item, const size_t depth, const cJSON_bool format, printbuffer * const output_buffer, const internal_hooks * const hooks);
 static const unsigned char *parse_object(cJSON * const item, const unsigned char *input, const unsigned char ** const ep, const internal_hooks * const hooks);
 static cJSON_bool print_object(const cJSON * const item, const size_t depth, const cJSON_bool format, printbuffer * const output_buffer, const internal_hooks * const hooks);
+static cJSON_bool build_index(cJSON * const object, const internal_hooks * const hooks);
 
 /* Utility to jump whitespace and cr/lf */
 static const unsigned char *skip_whitespace(const unsigned char *in)
@@ -834,24 +1439,23 @@ static const unsigned char *skip_whitespace(const unsigned char *in)
 }
 
 /* Parse an object - create a new root, and populate. */
-CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+static cJSON *parse(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated, const internal_hooks * const hooks)
 {
     const unsigned char *end = NULL;
     /* use global error pointer if no specific one was given */
     const unsigned char **ep = return_parse_end ? (const unsigned char**)return_parse_end : &global_ep;
-    cJSON *c = cJSON_New_Item(&global_hooks);
+    cJSON *c = cJSON_New_Item(hooks);
     *ep = NULL;
     if (!c) /* memory fail */
     {
         return NULL;
     }
 
-    end = parse_value(c, skip_whitespace((const unsigned char*)value), ep, &global_hooks);
+    end = parse_value(c, skip_whitespace((const unsigned char*)value), ep, hooks);
     if (!end)
     {
         /* parse failure. ep is set. */
-        cJSON_Delete(c);
-        return NULL;
+        goto fail;
     }
 
     /* if we require null-terminated JSON without appended garbage, skip and then check for a null terminator */
@@ -860,17 +1464,58 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
         end = skip_whitespace(end);
         if (*end)
         {
-            cJSON_Delete(c);
             *ep = end;
-            return NULL;
+            goto fail;
         }
     }
     if (return_parse_end)
     {
         *return_parse_end = (const char*)end;
     }
+    if (hooks->arena != NULL)
+    {
+        c->type |= cJSON_InArena;
+    }
 
     return c;
+
+fail:
+    if (hooks->arena == NULL)
+    {
+        cJSON_Delete(c);
+    }
+
+    return NULL;
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    return parse(value, return_parse_end, require_null_terminated, &global_hooks);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithArena(cJSON_Arena *arena, const char *value, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    internal_hooks hooks = global_hooks;
+    size_t chunks_made = 0;
+    size_t used = 0;
+    cJSON *item = NULL;
+
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    hooks.arena = arena;
+    chunks_made = arena->chunks_made;
+    used = (arena->chunks != NULL) ? arena->chunks->used : 0;
+
+    item = parse(value, return_parse_end, require_null_terminated, &hooks);
+    if (item == NULL)
+    {
+        /* nothing points at the partial items, drop them */
+        arena_rewind(arena, chunks_made, used);
+    }
+
+    return item;
 }
 
 /* Default options for cJSON_Parse */
@@ -879,8 +1524,7 @@ CJSON_PUBLIC(cJSON *) cJSON_Parse(const char *value)
     return cJSON_ParseWithOpts(value, 0, 0);
 }
 
-#define min(a, b) ((a < b) ? a : b)
-
+/* Print into one buffer that grows as needed and is then trimmed to size, with no second copy when realloc is available. */
 static unsigned char *print(const cJSON * const item, cJSON_bool format, const internal_hooks * const hooks)
 {
     printbuffer buffer[1];
@@ -890,6 +1534,7 @@ static unsigned char *print(const cJSON * const item, cJSON_bool format, const i
 
     /* create buffer */
     buffer->buffer = (unsigned char*) hooks->allocate(256);
+    buffer->length = 256;
     if (buffer->buffer == NULL)
     {
         goto fail;
@@ -902,17 +1547,29 @@ static unsigned char *print(const cJSON * const item, cJSON_bool format, const i
     }
     update_offset(buffer);
 
-    /* copy the buffer over to a new one */
-    printed = (unsigned char*) hooks->allocate(buffer->offset + 1);
-    if (printed == NULL)
+    if (hooks->reallocate != NULL)
     {
-        goto fail;
+        /* trim in place */
+        printed = (unsigned char*) hooks->reallocate(buffer->buffer, buffer->offset + 1);
+        if (printed == NULL)
+        {
+            goto fail;
+        }
+        buffer->buffer = NULL;
     }
-    strncpy((char*)printed, (char*)buffer->buffer, min(buffer->length, buffer->offset + 1));
-    printed[buffer->offset] = '\0'; /* just to be sure */
+    else
+    {
+        /* copy the buffer over to a new one */
+        printed = (unsigned char*) hooks->allocate(buffer->offset + 1);
+        if (printed == NULL)
+        {
+            goto fail;
+        }
+        memcpy(printed, buffer->buffer, buffer->offset + 1);
 
-    /* free the buffer */
-    hooks->deallocate(buffer->buffer);
+        /* free the buffer */
+        hooks->deallocate(buffer->buffer);
+    }
 
     return printed;
 
@@ -922,11 +1579,6 @@ fail:
         hooks->deallocate(buffer->buffer);
     }
 
-    if (printed != NULL)
-    {
-        hooks->deallocate(printed);
-    }
-
     return NULL;
 }
 
@@ -962,12 +1614,55 @@ CJSON_PUBLIC(char *) cJSON_PrintBuffered(const cJSON *item, int prebuffer, cJSON
 
     if (!print_value(item, 0, fmt, &p, &global_hooks))
     {
+        if (p.buffer != NULL)
+        {
+            global_hooks.deallocate(p.buffer);
+        }
         return NULL;
     }
 
     return (char*)p.buffer;
 }
 
+CJSON_PUBLIC(cJSON_bool) cJSON_PrintReusable(const cJSON *item, char **buffer, size_t *size, size_t *length, cJSON_bool fmt)
+{
+    printbuffer p;
+    cJSON_bool printed = false;
+
+    if ((buffer == NULL) || (size == NULL) || (length == NULL))
+    {
+        return false;
+    }
+
+    if (*buffer == NULL)
+    {
+        *buffer = (char*)global_hooks.allocate(256);
+        *size = (*buffer != NULL) ? 256 : 0;
+    }
+    if (*buffer == NULL)
+    {
+        return false;
+    }
+
+    p.buffer = (unsigned char*)*buffer;
+    p.length = *size;
+    p.offset = 0;
+    p.noalloc = false;
+
+    printed = print_value(item, 0, fmt, &p, &global_hooks);
+    if (printed)
+    {
+        update_offset(&p);
+        *length = p.offset;
+    }
+
+    /* ensure() may have moved or, on failure, freed the buffer */
+    *buffer = (char*)p.buffer;
+    *size = p.length;
+
+    return printed;
+}
+
 CJSON_PUBLIC(cJSON_bool) cJSON_PrintPreallocated(cJSON *item, char *buf, const int len, const cJSON_bool fmt)
 {
     printbuffer p;
@@ -1020,7 +1715,7 @@ static const unsigned  char *parse_value(cJSON * const item, const unsigned char
     /* number */
     if ((*input == '-') || ((*input >= '0') && (*input <= '9')))
     {
-        return parse_number(item, input);
+        return parse_number(item, input, hooks);
     }
     /* array */
     if (*input == '[')
@@ -1085,10 +1780,7 @@ static cJSON_bool print_value(const cJSON * const item, const size_t depth, cons
             size_t raw_length = 0;
             if (item->valuestring == NULL)
             {
-                if (!output_buffer->noalloc)
-                {
-                    hooks->deallocate(output_buffer->buffer);
-                }
+                /* the caller owns the buffer and frees it */
                 return false;
             }
 
@@ -1170,6 +1862,10 @@ static const unsigned char *parse_array(cJSON * const item, const unsigned char
         {
             goto fail; /* failed to parse value */
         }
+        if (hooks->arena != NULL)
+        {
+            current_item->type |= cJSON_InArena;
+        }
     }
     while (*input == ',');
 
@@ -1186,7 +1882,8 @@ success:
     return input + 1;
 
 fail:
-    if (head != NULL)
+    /* an arena keeps the partial items until it is reset */
+    if ((head != NULL) && (hooks->arena == NULL))
     {
         cJSON_Delete(head);
     }
@@ -1259,6 +1956,7 @@ static const unsigned char *parse_object(cJSON * const item, const unsigned char
 {
     cJSON *head = NULL; /* linked list head */
     cJSON *current_item = NULL;
+    size_t count = 0;
 
     if (*input != '{')
     {
@@ -1325,6 +2023,12 @@ static const unsigned char *parse_object(cJSON * const item, const unsigned char
         {
             goto fail; /* failed to parse value */
         }
+        if (hooks->arena != NULL)
+        {
+            /* the name lives in the arena as long as the item, treat it as constant */
+            current_item->type |= cJSON_InArena | cJSON_StringIsConst;
+        }
+        count++;
     }
     while (*input == ',');
 
@@ -1338,10 +2042,17 @@ success:
     item->type = cJSON_Object;
     item->child = head;
 
+    /* index large objects now, inside the arena, so that the document never needs cJSON_Delete() */
+    if ((hooks->arena != NULL) && (count >= CJSON_INDEX_THRESHOLD))
+    {
+        build_index(item, hooks);
+    }
+
     return input + 1;
 
 fail:
-    if (head != NULL)
+    /* an arena keeps the partial items until it is reset */
+    if ((head != NULL) && (hooks->arena == NULL))
     {
         cJSON_Delete(head);
     }
@@ -1489,34 +2200,178 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int item)
     return c;
 }
 
-CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON *object, const char *string)
+/* Hash index over the members of an object. The entries are in member order and every bucket chain is
+ * kept in ascending entry order, so a lookup returns the same (first) match as walking the members. */
+typedef struct index_entry
 {
-    cJSON *c = object ? object->child : NULL;
-    while (c && cJSON_strcasecmp((unsigned char*)c->string, (const unsigned char*)string))
+    const cJSON *item;
+    size_t hash;
+    size_t next; /* next entry + 1 in the same bucket, 0 ends the chain */
+} index_entry;
+
+struct cJSON_Index
+{
+    const cJSON *first; /* object->child when the index was built */
+    cJSON_bool in_arena; /* freed with the arena, not by cJSON_DropObjectIndex() */
+    size_t mask;
+    size_t *buckets; /* first entry + 1 of each bucket, 0 if empty */
+    index_entry entries[1];
+};
+
+/* FNV-1a over the lower cased name, so the case sensitive and insensitive lookups share one index. */
+static size_t hash_name(const unsigned char *name)
+{
+    size_t hash = (size_t)2166136261U;
+
+    for (; *name != '\0'; name++)
     {
-        c = c->next;
+        hash ^= (size_t)tolower(*name);
+        hash *= (size_t)16777619U;
     }
-    return c;
+
+    return hash;
 }
 
-CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const object, const char * const string)
+static cJSON_bool build_index(cJSON * const object, const internal_hooks * const hooks)
 {
+    struct cJSON_Index *index = NULL;
+    cJSON *child = NULL;
+    size_t count = 0;
+    size_t size = 0;
+    size_t i = 0;
+    size_t bucket = 0;
+
+    for (child = object->child; child != NULL; child = child->next)
+    {
+        count++;
+    }
+
+    /* at most half full */
+    size = 1;
+    while (size < (2 * count))
+    {
+        size <<= 1;
+    }
+
+    index = (struct cJSON_Index*)parser_allocate(hooks, sizeof(struct cJSON_Index) + (count * sizeof(index_entry)) + (size * sizeof(size_t)));
+    if (index == NULL)
+    {
+        return false;
+    }
+    index->first = object->child;
+    index->in_arena = (hooks->arena != NULL);
+    index->mask = size - 1;
+    index->buckets = (size_t*)(void*)(index->entries + count + 1);
+    memset(index->buckets, '\0', size * sizeof(size_t));
+
+    for (child = object->child, i = 0; child != NULL; child = child->next, i++)
+    {
+        index->entries[i].item = child;
+        index->entries[i].hash = (child->string != NULL) ? hash_name((const unsigned char*)child->string) : 0;
+    }
+
+    /* push to the bucket heads back to front, leaving each chain in member order */
+    for (i = count; i > 0; i--)
+    {
+        if (index->entries[i - 1].item->string == NULL)
+        {
+            continue;
+        }
+        bucket = index->entries[i - 1].hash & index->mask;
+        index->entries[i - 1].next = index->buckets[bucket];
+        index->buckets[bucket] = i;
+    }
+
+    cJSON_DropObjectIndex(object);
+    object->member_index = index;
+
+    return true;
+}
+
+CJSON_PUBLIC(cJSON_bool) cJSON_IndexObject(cJSON *object)
+{
+    /* an index on the heap would outlive an arena reset */
+    if ((object == NULL) || ((object->type & 0xFF) != cJSON_Object) || (object->type & (cJSON_IsReference | cJSON_InArena)))
+    {
+        return false;
+    }
+
+    return build_index(object, &global_hooks);
+}
+
+CJSON_PUBLIC(void) cJSON_DropObjectIndex(cJSON *object)
+{
+    if ((object != NULL) && (object->member_index != NULL))
+    {
+        if (!object->member_index->in_arena)
+        {
+            global_hooks.deallocate(object->member_index);
+        }
+        object->member_index = NULL;
+    }
+}
+
+static cJSON *get_object_item(const cJSON * const object, const char * const name, const cJSON_bool case_sensitive)
+{
+    const struct cJSON_Index *index = NULL;
     cJSON *current_element = NULL;
+    size_t walked = 0;
+    size_t hash = 0;
+    size_t entry = 0;
 
-    if ((object == NULL) || (string == NULL))
+    if ((object == NULL) || (name == NULL))
     {
         return NULL;
     }
 
+    index = object->member_index;
+    if ((index != NULL) && (index->first == object->child))
+    {
+        hash = hash_name((const unsigned char*)name);
+        for (entry = index->buckets[hash & index->mask]; entry != 0; entry = index->entries[entry - 1].next)
+        {
+            if (index->entries[entry - 1].hash != hash)
+            {
+                continue;
+            }
+            current_element = (cJSON*)index->entries[entry - 1].item;
+            if ((case_sensitive ? strcmp(name, current_element->string) : cJSON_strcasecmp((const unsigned char*)current_element->string, (const unsigned char*)name)) == 0)
+            {
+                return current_element;
+            }
+        }
+
+        return NULL;
+    }
+
     current_element = object->child;
-    while ((current_element != NULL) && (strcmp(string, current_element->string) != 0))
+    while ((current_element != NULL) && ((current_element->string == NULL) ||
+           ((case_sensitive ? strcmp(name, current_element->string) : cJSON_strcasecmp((const unsigned char*)current_element->string, (const unsigned char*)name)) != 0)))
     {
         current_element = current_element->next;
+        walked++;
+    }
+
+    /* a long walk means a large object, index it for the next lookup (the index is a cache, not part of the value);
+     * arena objects were indexed by the parser and are not indexed again on the heap */
+    if ((walked >= CJSON_INDEX_THRESHOLD) && ((object->type & 0xFF) == cJSON_Object) && !(object->type & (cJSON_IsReference | cJSON_InArena)))
+    {
+        build_index((cJSON*)object, &global_hooks);
     }
 
     return current_element;
 }
 
+CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON *object, const char *string)
+{
+    return get_object_item(object, string, false);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON * const object, const char * const string)
+{
+    return get_object_item(object, string, true);
+}
+
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string)
 {
     return cJSON_GetObjectItem(object, string) ? 1 : 0;
@@ -1540,7 +2395,9 @@ static cJSON *create_reference(const cJSON *item, const internal_hooks * const h
     memcpy(ref, item, sizeof(cJSON));
     ref->string = NULL;
     ref->type |= cJSON_IsReference;
+    ref->type &= ~cJSON_InArena;
     ref->next = ref->prev = NULL;
+    ref->member_index = NULL;
     return ref;
 }
 
@@ -1554,6 +2411,7 @@ CJSON_PUBLIC(void) cJSON_AddItemToArray(cJSON *array, cJSON *item)
         return;
     }
 
+    cJSON_DropObjectIndex(array);
     child = array->child;
 
     if (child == NULL)
@@ -1616,6 +2474,7 @@ CJSON_PUBLIC(void) cJSON_AddItemReferenceToObject(cJSON *object, const char *str
 static cJSON *DetachItemFromArray(cJSON *array, size_t which)
 {
     cJSON *c = array->child;
+    cJSON_DropObjectIndex(array);
     while (c && (which > 0))
     {
         c = c->next;
@@ -1685,6 +2544,7 @@ CJSON_PUBLIC(void) cJSON_DeleteItemFromObject(cJSON *object, const char *string)
 CJSON_PUBLIC(void) cJSON_InsertItemInArray(cJSON *array, int which, cJSON *newitem)
 {
     cJSON *c = array->child;
+    cJSON_DropObjectIndex(array);
     while (c && (which > 0))
     {
         c = c->next;
@@ -1711,6 +2571,7 @@ CJSON_PUBLIC(void) cJSON_InsertItemInArray(cJSON *array, int which, cJSON *newit
 static void ReplaceItemInArray(cJSON *array, size_t which, cJSON *newitem)
 {
     cJSON *c = array->child;
+    cJSON_DropObjectIndex(array);
     while (c && (which > 0))
     {
         c = c->next;
@@ -1765,6 +2626,7 @@ CJSON_PUBLIC(void) cJSON_ReplaceItemInObject(cJSON *object, const char *string,
         }
 
         newitem->string = (char*)cJSON_strdup((const unsigned char*)string, &global_hooks);
+        newitem->type &= ~cJSON_StringIsConst;
         ReplaceItemInArray(object, i, newitem);
     }
 }
@@ -2060,7 +2922,7 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
         goto fail;
     }
     /* Copy over all vars */
-    newitem->type = item->type & (~cJSON_IsReference);
+    newitem->type = item->type & (~(cJSON_IsReference | cJSON_InArena));
     newitem->valueint = item->valueint;
     newitem->valuedouble = item->valuedouble;
     if (item->valuestring)
@@ -2073,7 +2935,12 @@ CJSON_PUBLIC(cJSON *) cJSON_Duplicate(const cJSON *item, cJSON_bool recurse)
     }
     if (item->string)
     {
-        newitem->string = (item->type&cJSON_StringIsConst) ? item->string : (char*)cJSON_strdup((unsigned char*)item->string, &global_hooks);
+        /* an arena name would not outlive the arena, copy it */
+        if ((item->type & cJSON_StringIsConst) && (item->type & cJSON_InArena))
+        {
+            newitem->type &= ~cJSON_StringIsConst;
+        }
+        newitem->string = (newitem->type&cJSON_StringIsConst) ? item->string : (char*)cJSON_strdup((unsigned char*)item->string, &global_hooks);
         if (!newitem->string)
         {
             goto fail;
@@ -48,6 +48,7 @@ extern "C"
 
 #define cJSON_IsReference 256
 #define cJSON_StringIsConst 512
+#define cJSON_InArena 1024 /* the item and its valuestring live in a cJSON_Arena */
 
 /* The cJSON structure: */
 typedef struct cJSON
@@ -70,6 +71,9 @@ typedef struct cJSON
 
     /* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
     char *string;
+
+    /* Optional hash index over an object's members, see cJSON_IndexObject(). Owned by cJSON, do not touch. */
+    struct cJSON_Index *member_index;
 } cJSON;
 
 typedef struct cJSON_Hooks
@@ -80,6 +84,9 @@ typedef struct cJSON_Hooks
 
 typedef int cJSON_bool;
 
+/* Chunked allocator for parsed documents, see cJSON_ParseWithArena() */
+typedef struct cJSON_Arena cJSON_Arena;
+
 #if !defined(__WINDOWS__) && (defined(WIN32) || defined(WIN64) || defined(_MSC_VER) || defined(_WIN32))
 #define __WINDOWS__
 #endif
@@ -134,6 +141,11 @@ CJSON_PUBLIC(char *) cJSON_PrintUnformatted(const cJSON *item);
 CJSON_PUBLIC(char *) cJSON_PrintBuffered(const cJSON *item, int prebuffer, cJSON_bool fmt);
 /* Render a cJSON entity to text using a buffer already allocated in memory with length buf_len. Returns 1 on success and 0 on failure. */
 CJSON_PUBLIC(cJSON_bool) cJSON_PrintPreallocated(cJSON *item, char *buf, const int len, const cJSON_bool fmt);
+/* Render a cJSON entity into a buffer that is reused across calls. *buffer (NULL at first) and *size are grown with the
+ * hooks as needed and kept, so printing documents of a steady size allocates nothing. Stores the length of the text in
+ * *length. Returns 1 on success and 0 on failure, where the buffer may have been freed (*buffer is then NULL).
+ * Free *buffer with the free hook when done. */
+CJSON_PUBLIC(cJSON_bool) cJSON_PrintReusable(const cJSON *item, char **buffer, size_t *size, size_t *length, cJSON_bool fmt);
 /* Delete a cJSON entity and all subentities. */
 CJSON_PUBLIC(void) cJSON_Delete(cJSON *c);
 
@@ -145,6 +157,18 @@ CJSON_PUBLIC(cJSON *) cJSON_GetArrayItem(const cJSON *array, int item);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItem(const cJSON *object, const char *string);
 CJSON_PUBLIC(cJSON *) cJSON_GetObjectItemCaseSensitive(const cJSON *object, const char *string);
 CJSON_PUBLIC(cJSON_bool) cJSON_HasObjectItem(const cJSON *object, const char *string);
+
+/* Objects with at least this many members get a hash index on their first lookup, which makes later lookups O(1). */
+#ifndef CJSON_INDEX_THRESHOLD
+#define CJSON_INDEX_THRESHOLD 16
+#endif
+/* Build the member index of an object now, whatever its size. The lazy build on lookup writes to the object,
+ * so index an object up front if several threads are going to read it at once. Returns 0 on allocation failure,
+ * and for objects parsed into an arena, which the parser already indexed. */
+CJSON_PUBLIC(cJSON_bool) cJSON_IndexObject(cJSON *object);
+/* Free the member index of an object. The cJSON functions that add, remove or replace members do this for you,
+ * call it yourself after editing the member chain or a member's name by hand. */
+CJSON_PUBLIC(void) cJSON_DropObjectIndex(cJSON *object);
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 CJSON_PUBLIC(const char *) cJSON_GetErrorPtr(void);
 
@@ -210,6 +234,22 @@ The item->next and ->prev pointers are always zero on return from Duplicate. */
 /* If you supply a ptr in return_parse_end and parsing fails, then return_parse_end will contain a pointer to the error. If not, then cJSON_GetErrorPtr() does the job. */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
 
+/* Arena parsing: the items, names and strings of the document are carved from large chunks of the arena, which are
+ * allocated with the current hooks. The document lives until the arena is reset or deleted, which releases it in one go,
+ * so there is no need to cJSON_Delete() it. The tree can be modified like any other; items added to it are ordinary
+ * heap items though, so cJSON_Delete() a modified document before releasing its arena (this frees only the heap parts).
+ * Large objects are indexed in the arena while parsing; an arena object whose index was dropped by an edit is not
+ * indexed again, lookups walk it. A failed parse gives back what it took from the arena. An arena is not thread safe.
+ * chunk_size 0 picks the default (CJSON_ARENA_CHUNK). */
+#ifndef CJSON_ARENA_CHUNK
+#define CJSON_ARENA_CHUNK 65536
+#endif
+CJSON_PUBLIC(cJSON_Arena *) cJSON_CreateArena(size_t chunk_size);
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithArena(cJSON_Arena *arena, const char *value, const char **return_parse_end, cJSON_bool require_null_terminated);
+/* Release every document of the arena, keeping one chunk for reuse. */
+CJSON_PUBLIC(void) cJSON_ResetArena(cJSON_Arena *arena);
+CJSON_PUBLIC(void) cJSON_DeleteArena(cJSON_Arena *arena);
+
 CJSON_PUBLIC(void) cJSON_Minify(char *json);
 
 /* Macros for creating things quickly. */
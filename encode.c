@@ -0,0 +1,197 @@
+/*
+file: encode.c
+
+Description:
+	CBOR and MessagePack primitives used to build binary output records.
+	Integers always use the smallest encoding the formats allow so a
+	record is typically well under a quarter of its pretty JSON size.
+*/
+
+#include <string.h>
+
+#include "encode.h"
+
+// FUNCTION SIGNATURES
+static unsigned char	*cbor_put_head(unsigned char *out, unsigned char major, uint64_t value);
+static unsigned char	*put_be16(unsigned char *out, uint16_t value);
+static unsigned char	*put_be32(unsigned char *out, uint32_t value);
+static unsigned char	*put_be64(unsigned char *out, uint64_t value);
+
+#define CBOR_UNSIGNED	0x00
+#define CBOR_NEGATIVE	0x20
+#define CBOR_TEXT	0x60
+#define CBOR_ARRAY	0x80
+#define CBOR_MAP	0xa0
+#define CBOR_DOUBLE	0xfb
+
+unsigned char *cbor_put_map(unsigned char *out, uint32_t pairs) {
+	return cbor_put_head(out, CBOR_MAP, pairs);
+}
+
+unsigned char *cbor_put_array(unsigned char *out, uint32_t items) {
+	return cbor_put_head(out, CBOR_ARRAY, items);
+}
+
+unsigned char *cbor_put_int(unsigned char *out, int64_t value) {
+	if (value < 0) {
+		// major type 1 encodes -1 - n
+		return cbor_put_head(out, CBOR_NEGATIVE, (uint64_t)(-1 - value));
+	}
+
+	return cbor_put_head(out, CBOR_UNSIGNED, (uint64_t)value);
+}
+
+unsigned char *cbor_put_double(unsigned char *out, double value) {
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	*out++ = CBOR_DOUBLE;
+	return put_be64(out, bits);
+}
+
+unsigned char *cbor_put_text(unsigned char *out, const char *text, size_t length) {
+	out = cbor_put_head(out, CBOR_TEXT, length);
+	memcpy(out, text, length);
+	return out + length;
+}
+
+unsigned char *mp_put_map(unsigned char *out, uint32_t pairs) {
+	if (pairs < 16) {
+		*out++ = 0x80 | pairs;
+		return out;
+	}
+	if (pairs <= UINT16_MAX) {
+		*out++ = 0xde;
+		return put_be16(out, pairs);
+	}
+
+	*out++ = 0xdf;
+	return put_be32(out, pairs);
+}
+
+unsigned char *mp_put_array(unsigned char *out, uint32_t items) {
+	if (items < 16) {
+		*out++ = 0x90 | items;
+		return out;
+	}
+	if (items <= UINT16_MAX) {
+		*out++ = 0xdc;
+		return put_be16(out, items);
+	}
+
+	*out++ = 0xdd;
+	return put_be32(out, items);
+}
+
+unsigned char *mp_put_int(unsigned char *out, int64_t value) {
+	if (value >= 0) {
+		if (value < 128) {
+			*out++ = (unsigned char)value;		// positive fixint
+			return out;
+		}
+		if (value <= UINT8_MAX) {
+			*out++ = 0xcc;
+			*out++ = (unsigned char)value;
+			return out;
+		}
+		if (value <= UINT16_MAX) {
+			*out++ = 0xcd;
+			return put_be16(out, value);
+		}
+		if (value <= UINT32_MAX) {
+			*out++ = 0xce;
+			return put_be32(out, value);
+		}
+		*out++ = 0xcf;
+		return put_be64(out, value);
+	}
+
+	if (value >= -32) {
+		*out++ = (unsigned char)(int8_t)value;		// negative fixint
+		return out;
+	}
+	if (value >= INT8_MIN) {
+		*out++ = 0xd0;
+		*out++ = (unsigned char)(int8_t)value;
+		return out;
+	}
+	if (value >= INT16_MIN) {
+		*out++ = 0xd1;
+		return put_be16(out, (uint16_t)(int16_t)value);
+	}
+	if (value >= INT32_MIN) {
+		*out++ = 0xd2;
+		return put_be32(out, (uint32_t)(int32_t)value);
+	}
+	*out++ = 0xd3;
+	return put_be64(out, (uint64_t)value);
+}
+
+unsigned char *mp_put_double(unsigned char *out, double value) {
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	*out++ = 0xcb;
+	return put_be64(out, bits);
+}
+
+unsigned char *mp_put_text(unsigned char *out, const char *text, size_t length) {
+	if (length < 32) {
+		*out++ = 0xa0 | length;
+	} else if (length <= UINT8_MAX) {
+		*out++ = 0xd9;
+		*out++ = (unsigned char)length;
+	} else if (length <= UINT16_MAX) {
+		*out++ = 0xda;
+		out = put_be16(out, length);
+	} else {
+		*out++ = 0xdb;
+		out = put_be32(out, length);
+	}
+
+	memcpy(out, text, length);
+	return out + length;
+}
+
+// Major type in the top three bits, argument in the smallest form
+static unsigned char *cbor_put_head(unsigned char *out, unsigned char major, uint64_t value) {
+	if (value < 24) {
+		*out++ = major | (unsigned char)value;
+		return out;
+	}
+	if (value <= UINT8_MAX) {
+		*out++ = major | 24;
+		*out++ = (unsigned char)value;
+		return out;
+	}
+	if (value <= UINT16_MAX) {
+		*out++ = major | 25;
+		return put_be16(out, value);
+	}
+	if (value <= UINT32_MAX) {
+		*out++ = major | 26;
+		return put_be32(out, value);
+	}
+
+	*out++ = major | 27;
+	return put_be64(out, value);
+}
+
+static unsigned char *put_be16(unsigned char *out, uint16_t value) {
+	out[0] = value >> 8;
+	out[1] = value;
+	return out + 2;
+}
+
+static unsigned char *put_be32(unsigned char *out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+	return out + 4;
+}
+
+static unsigned char *put_be64(unsigned char *out, uint64_t value) {
+	out = put_be32(out, (uint32_t)(value >> 32));
+	return put_be32(out, (uint32_t)value);
+}
@@ -0,0 +1,28 @@
+/*
+file: encode.h
+
+Description:
+	Minimal CBOR (RFC 7049) and MessagePack encoders. Every function
+	writes at out, which the caller guarantees is large enough, and
+	returns the position just past what it wrote. Nothing allocates.
+*/
+
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+unsigned char	*cbor_put_map(unsigned char *out, uint32_t pairs);
+unsigned char	*cbor_put_array(unsigned char *out, uint32_t items);
+unsigned char	*cbor_put_int(unsigned char *out, int64_t value);
+unsigned char	*cbor_put_double(unsigned char *out, double value);
+unsigned char	*cbor_put_text(unsigned char *out, const char *text, size_t length);
+
+unsigned char	*mp_put_map(unsigned char *out, uint32_t pairs);
+unsigned char	*mp_put_array(unsigned char *out, uint32_t items);
+unsigned char	*mp_put_int(unsigned char *out, int64_t value);
+unsigned char	*mp_put_double(unsigned char *out, double value);
+unsigned char	*mp_put_text(unsigned char *out, const char *text, size_t length);
+
+#endif
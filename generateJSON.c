@@ -19,23 +19,43 @@ Description:
 	is atomic and thread safe.
 */
 
-#include <json/json.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include <fcntl.h>
+#include <errno.h>
 #include <error.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 
+#include <pthread.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <string.h>
 
 #include "cjson/cJSON.h"
 #include "cjson/cJSON.c"
 
+#include "alarm.h"
+#include "anomaly.h"
+#include "calib.h"
+#include "harmonics.h"
+#include "http.h"
+#include "metrics.h"
+#include "notify.h"
+#include "output.h"
+#include "power.h"
+#include "sample.h"
+#include "sinks.h"
+#include "stats.h"
+#include "timestamp.h"
+
 // These header files have been copied to /usr/local/include on the board so
 // gcc will automatically find them.
 #include "socal/socal.h"
@@ -46,25 +66,65 @@ Description:
 // This file is also copied into /usr/local/include on the board.
 #include "hps_0.h"
 
+// Records carry a copy of the calibration's unit
+#if CALIB_UNIT_SIZE > RECORD_UNIT_SIZE
+#error "record.unit can't hold a calibration unit"
+#endif
+
 // SIGNAL FLAGS
-static volatile sig_atomic_t REREAD_CONFIG = 1;
+static volatile sig_atomic_t REREAD_CONFIG = 0;
 static volatile sig_atomic_t GRACEFUL_EXIT = 0;
 
+struct channel;
+struct config;
+
+enum channel_kind {
+	CHANNEL_CURRENT = 0,		// mA, current_sensor_N calibrates it
+	CHANNEL_VOLTAGE			// mV
+};
+
 // FUNCTION SIGNATURES
 void        fork_child_kill_parent();
 void        free_memory();
-void        generateJSON(int channel, int value);
-int         get_adc_value(uint32_t *adc_base, int channel);
-int         get_current(int channel, int millivolts);
-int         get_date(char *date_buffer, size_t buffer_size);
+void        generateJSON(const struct sample *sample, int value, const char *unit);
+int         get_adc_value(uint32_t *adc_base, int channel, struct timespec *taken);
 void        init_signals();
 void        inititalize();
-void        load_config();
-char*       readFile();
-int         read_adc(int channel);
+struct config *load_config(const char *path);
+static void load_outputs(cJSON *root, struct config *config);
+static int  load_channels(cJSON *root, struct config *config);
+static int  parse_channel_kind(const char *name, enum channel_kind *kind);
+static int  load_sensors(cJSON *root, struct config *config);
+static int  required_number(cJSON *object, const char *object_name, const char *key, double *value);
+static int  load_calibration(cJSON *root, struct config *config);
+static void load_metrics(cJSON *root, struct config *config);
+static void load_pairs(cJSON *root, struct config *config);
+static void load_stats(cJSON *root, struct config *config);
+static void load_harmonics(cJSON *root, struct config *config);
+static void load_anomaly(cJSON *root, struct config *config);
+static void apply_config(const struct config *config, const struct config *previous);
+static void switch_config(struct config *config);
+static void free_configs(struct config *list);
+static void wake_reload_thread();
+int         reload_start();
+void        reload_stop();
+static void *reload_thread(void *arg);
+static int  config_changed();
+static void reload_config();
+static void write_reload_stats();
+char*       read_config(const char *path, size_t *length);
+static const struct channel *next_channel(const struct config *config, int *slot, long long now_ns, long long *next_due_ns);
+void        adc_open();
+void        adc_close();
+void        read_adc(const struct channel *channel, struct sample *sample);
+void        read_adc_pair(const struct channel *current, struct sample *current_sample,
+		const struct channel *voltage, struct sample *voltage_sample);
 static void sig_handler(int signo, siginfo_t *si, void *unused);
 
-#define NUM_CHANNELS 8
+#define MAX_CHANNELS 16		// channel table entries, as many as the modules keep
+#define ADC_INPUTS 8		// LTC2308 inputs
+#define LEGACY_CURRENT_CHANNELS 4	// inputs 0-3 without a channel table
+#define CHANNEL_NAME_SIZE 24
 #define NUM_READS 1
 #define HW_REGS_BASE ( ALT_STM_OFST )
 #define HW_REGS_SPAN ( 0x04000000 )
@@ -75,45 +135,270 @@ static void sig_handler(int signo, siginfo_t *si, void *unused);
 #define MIN_AMPS "min_amperage"
 #define MAX_AMPS "max_amperage"
 #define MULTIPLIER "multiplier"
-#define FILE_CHAR_SIZE 2000
-
-// CONFIG GLOBALS
-double current_max_voltage[4];
-double current_min_voltage[4];
-double current_max_current[4];
-double current_min_current[4];
-double current_multiplier[4];
-
-int main() {
-	int channel = 0;
-	int millivolts = 0;
+#define ALARM_HYSTERESIS "alarm_hysteresis"
+#define ALARM_DEBOUNCE "alarm_debounce"
+#define CHANNELS "channels"
+#define CHANNEL_ADC "adc"
+#define CHANNEL_NAME "name"
+#define CHANNEL_KIND "kind"
+#define CHANNEL_UNIT "unit"
+#define CHANNEL_CALIBRATION "calibration"
+#define CHANNEL_RATE "rate_hz"
+#define CHANNEL_ENABLED "enabled"
+#define CALIBRATION "calibration"
+#define CALIBRATION_TYPE "type"
+#define CALIBRATION_GAIN "gain"
+#define CALIBRATION_OFFSET "offset"
+#define CALIBRATION_COEFFICIENTS "coefficients"
+#define CALIBRATION_POINTS "points"
+#define CALIBRATION_UNIT "unit"
+#define METRICS "metrics"
+#define METRICS_WINDOW "window_ms"
+#define METRICS_VOLTAGE "voltage"
+#define ENERGY_CHECKPOINT_SEC "energy_checkpoint_s"
+#define PAIRS "pairs"
+#define PAIR_CURRENT "current"
+#define PAIR_VOLTAGE "voltage"
+#define PAIR_WINDOW "window_ms"
+#define STATS_WINDOWS "stats_windows_ms"
+#define HARMONICS "harmonics"
+#define HARMONICS_CHANNEL "channel"
+#define HARMONICS_BLOCK "block"
+#define HARMONICS_ORDER "harmonics"
+#define HARMONICS_FUNDAMENTAL "fundamental_hz"
+#define ANOMALY "anomaly"
+#define ANOMALY_ALPHA "alpha"
+#define ANOMALY_THRESHOLD "threshold"
+#define ANOMALY_WARMUP "warmup"
+#define TIMESTAMP_FORMAT "timestamp_format"
+#define TIMESTAMP_PRECISION "timestamp_precision"
+#define OUTPUTS "outputs"
+#define OUTPUT_SINK "sink"
+#define OUTPUT_ENCODING "encoding"
+#define OUTPUT_LISTEN "listen"
+#define OUTPUT_SSE_INTERVAL "sse_min_interval_ms"
+#define CONFIG_PATH "/var/tmp/sensor-config/config.json"
+#define CONFIG_ENV "SENSOR_CONFIG"
+#define CONFIG_DEBOUNCE_MS 200	// quiet time after a config file change
+#define RELOAD_STATS "./reload.json"
+
+// CONFIG
+// A parsed and validated config.json. Nothing writes to it once it is
+// published: a reload builds a new one on the reload thread and the
+// sampler switches to it between two samples.
+struct output_config {
+	int sink;
+	enum record_encoding encoding;
+	char listen[HTTP_LISTEN_SIZE];	// http only, "" for the default
+	int sse_min_interval_ms;	// http only
+};
+
+struct config_pair {
+	int current;
+	int voltage;
+	int window_ms;
+};
+
+struct config_harmonics {
+	int channel;
+	struct harmonics_config config;
+};
+
+// A channel as the sampler sees it. Everything the loop needs per sample
+// sits together, the names and per module settings are kept apart.
+struct channel {
+	int index;			// position in the table, sensor_id - 1
+	int adc;			// LTC2308 input
+	int partner;			// slot of the paired voltage channel or -1
+	int with_partner;		// voltage channel read with its current
+	long long interval_ns;		// 1 / rate_hz, 0 to sample every pass
+	enum channel_kind kind;
+	const struct calib *calibration;	// in the same config's calibrations
+};
+
+struct config {
+	struct config *next;		// retired list
+	struct timespec requested;	// CLOCK_MONOTONIC, start of the reload
+	enum ts_format ts_format;
+	enum ts_precision ts_precision;
+	struct channel channels[MAX_CHANNELS];	// enabled ones, sampling order
+	int num_channels;
+	int num_entries;			// table size, disabled ones included
+	int slot[MAX_CHANNELS];			// index -> channels[], -1 if disabled
+	char names[MAX_CHANNELS][CHANNEL_NAME_SIZE];
+	struct calib calibrations[MAX_CHANNELS];	// by slot, kept out of channels[]
+	int has_sensor[MAX_CHANNELS];		// current_sensor_N is given
+	double multiplier[MAX_CHANNELS];
+	double zero_current_voltage[MAX_CHANNELS];	// max_avg_voltage
+	struct alarm_limits value_limits[MAX_CHANNELS];
+	struct alarm_limits raw_limits[MAX_CHANNELS];
+	int metrics_window_ms[MAX_CHANNELS];
+	double metrics_voltage[MAX_CHANNELS];
+	int energy_checkpoint_s;
+	struct config_pair pairs[POWER_MAX_PAIRS];
+	int num_pairs;
+	int stats_windows_ms[RECORD_MAX_STATS];
+	int num_stats_windows;
+	double anomaly_alpha;
+	double anomaly_threshold;
+	int anomaly_warmup;
+
+	// only used at startup
+	struct output_config outputs[OUTPUT_MAX_SINKS];
+	int num_outputs;
+	struct config_harmonics harmonics[MAX_CHANNELS];
+	int num_harmonics;
+};
+
+const char *config_path = CONFIG_PATH;
+
+// ADC registers, mapped once by adc_open()
+static int adc_fd = -1;
+static void *adc_map = MAP_FAILED;
+static uint32_t *adc_base;
+
+// Only the sampler reads running_config. The reload thread hands a new
+// config over in pending_config and frees the ones the sampler retired.
+static struct config *running_config;
+static struct config *pending_config;
+static struct config *retired_configs;
+static pthread_t reloader;
+static int reload_event_fd = -1;	// SIGHUP and retired configs
+static int reload_watch_fd = -1;	// inotify on the config directory
+static const char *config_name;		// config file name inside it
+static volatile int reload_running = 0;
+
+// Reload counters, the reload thread exports them to RELOAD_STATS
+static struct reload_stats {
+	unsigned long long signals;	// SIGHUP reloads
+	unsigned long long file_events;	// debounced config file changes
+	unsigned long long failed;	// reloads that kept the running config
+	unsigned long long applied;	// configs the sampler switched to
+	long long last_latency_ns;	// reload start to the sampler using it
+	long long max_latency_ns;
+} reload_stats;
+
+int main(int argc, char **argv) {
+	const struct channel *channel, *partner;
+	int slot = 0;
+	int value, partner_value;
+	int i;
+	struct sample sample, partner_sample;
+	struct output_config *output;
+	struct config *config;
+	struct timespec now;
+	static long long next_due_ns[MAX_CHANNELS];
+	static char resolved_path[PATH_MAX];
+
+	// The config file is the first argument, then $SENSOR_CONFIG, then the
+	// default. Relative paths are resolved before leaving the start directory.
+	if (argc > 1) {
+		config_path = argv[1];
+	} else if (getenv(CONFIG_ENV) != NULL) {
+		config_path = getenv(CONFIG_ENV);
+	}
+	if (realpath(config_path, resolved_path) != NULL) {
+		config_path = resolved_path;
+	}
 
 	// daemonize the program
 	// inititalize();
 	chdir("/var/tmp/sensor-json");
 
-	while(1) {
-		if (REREAD_CONFIG) {
-			load_config();
-			REREAD_CONFIG = 0;
+	// Handlers go in before any thread starts: SIGHUP reloads the config,
+	// SIGINT and SIGTERM stop the loop below
+	init_signals();
+
+	running_config = load_config(config_path);
+	if (running_config == NULL) {
+		exit(EXIT_FAILURE);
+	}
+	apply_config(running_config, NULL);
+	adc_open();
+
+	// The sink list and the harmonics are only read at startup, later
+	// reloads keep them
+	for (i = 0; i < running_config->num_outputs; i++) {
+		output = &running_config->outputs[i];
+		if (output->sink == SINK_HTTP) {
+			if (output->listen[0] != '\0' && http_configure(output->listen) < 0) {
+				fprintf(stderr, "Bad %s \"%s\", using %s.\n", OUTPUT_LISTEN, output->listen, HTTP_DEFAULT_LISTEN);
+			}
+			http_configure_sse(output->sse_min_interval_ms);
 		}
-		
-		if (GRACEFUL_EXIT) {
-			break;
+		if (sinks_register(output->sink, output->encoding) < 0) {
+			fprintf(stderr, "Failed to register output sink %d.\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < running_config->num_harmonics; i++) {
+		if (harmonics_configure(running_config->harmonics[i].channel, &running_config->harmonics[i].config) < 0) {
+			fprintf(stderr, "Bad %s entry ignored.\n", HARMONICS);
 		}
+	}
 
-		// Read Sensor Value from ADC
-		millivolts = read_adc(channel);
+	// Energy counters continue where the last run checkpointed them
+	metrics_restore(ENERGY_CHECKPOINT);
+	if (output_add_sink(&energy_sink_ops, NULL, ENCODING_JSON) < 0) {
+		fprintf(stderr, "Failed to register energy checkpoints.\n");
+		exit(EXIT_FAILURE);
+	}
+	// Readers block on the shared page instead of polling the files
+	if (notify_open() < 0) {
+		fprintf(stderr, "Update notifications disabled.\n");
+	}
+	if (output_start() < 0) {
+		fprintf(stderr, "Failed to start output sinks.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (harmonics_start() < 0) {
+		fprintf(stderr, "Failed to start harmonic analysis.\n");
+		exit(EXIT_FAILURE);
+	}
+	// SIGHUP and edits of the config file reload it in the background,
+	// the loop only picks up the result
+	if (reload_start() < 0) {
+		fprintf(stderr, "Config reloads disabled.\n");
+	}
 
+	while(1) {
+		// A reloaded config takes effect between two samples
+		config = __atomic_exchange_n(&pending_config, NULL, __ATOMIC_ACQUIRE);
+		if (config != NULL) {
+			switch_config(config);
+		}
+		
 		if (GRACEFUL_EXIT) {
 			break;
 		}
 
-		// Output Read Value into JSON File
-		if (channel < 4) {
-			generateJSON(channel + 1, get_current(channel, millivolts));
-		} else {
-			generateJSON(channel + 1, millivolts);
+		// Read Sensor Value from ADC, the voltage of a current/voltage
+		// pair is read right after its current
+		config = running_config;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		channel = next_channel(config, &slot, (long long)now.tv_sec * 1000000000LL + now.tv_nsec, next_due_ns);
+		if (channel != NULL) {
+			partner = (channel->partner >= 0) ? &config->channels[channel->partner] : NULL;
+			if (partner != NULL) {
+				read_adc_pair(channel, &sample, partner, &partner_sample);
+			} else {
+				read_adc(channel, &sample);
+			}
+
+			if (GRACEFUL_EXIT) {
+				break;
+			}
+
+			// Hand the calibrated value to the output sinks
+			value = calib_apply(channel->calibration, sample.raw);
+			if (partner != NULL) {
+				partner_value = calib_apply(partner->calibration, partner_sample.raw);
+				power_update(&sample, value, &partner_sample, partner_value);
+				generateJSON(&sample, value, channel->calibration->unit);
+				generateJSON(&partner_sample, partner_value, partner->calibration->unit);
+			} else {
+				generateJSON(&sample, value, channel->calibration->unit);
+			}
 		}
 
 		if (GRACEFUL_EXIT) {
@@ -124,9 +409,6 @@ int main() {
 #else
 		usleep(1000);
 #endif
-
-		channel += 1;
-		channel %= NUM_CHANNELS;
 	}
 
 	free_memory();
@@ -134,6 +416,26 @@ int main() {
 }
 
 
+// Picks the first enabled channel from *slot on that is due, voltage
+// channels read with their current are skipped. NULL when nothing is due.
+static const struct channel *next_channel(const struct config *config, int *slot, long long now_ns, long long *next_due_ns) {
+	const struct channel *channel;
+	int i;
+
+	for (i = 0; i < config->num_channels; i++) {
+		channel = &config->channels[(*slot + i) % config->num_channels];
+		if (channel->with_partner || now_ns < next_due_ns[channel->index]) {
+			continue;
+		}
+
+		next_due_ns[channel->index] = now_ns + channel->interval_ns;
+		*slot = (*slot + i + 1) % config->num_channels;
+		return channel;
+	}
+
+	return NULL;
+}
+
 void inititalize() {
 
 	// Reference http://stackoverflow.com/a/17955149/6248563
@@ -174,60 +476,26 @@ void inititalize() {
 }
 
 
-//Generates the JSON file and outputs it to current directory
-void generateJSON(int channel, int value) {
-
-	//Buffer to hold the date
-	char date_buffer[30];
-	//Buffer to hold temporary path name
-	char path_buffer_temp[30];
-	//Buffer to hold actual path name
-	char path_buffer[30];
-
-	char* unit_buffer;
+//Publishes the converted value to every output sink
+void generateJSON(const struct sample *sample, int value, const char *unit) {
+	struct record record;
 
-	//Get the date
-	if (get_date(date_buffer, 30) < 0) {
-#ifdef DEBUG
-		fprintf(stdout, "Failed get_date() while generatingJSON for channel %d\n", channel);
-#endif
-		exit(EXIT_FAILURE);
-	}
+	record.sensor_id = sample->channel + 1;
+	record.value = value;
+	strcpy(record.unit, unit);
+	record.taken = sample->taken;
+	record.flags = 0;
+	record.num_alarms = 0;
 
-	if(1 <= channel && channel <= 4) {
-		unit_buffer = "mA";
-	} else {
-		unit_buffer = "mV";
-	}
-	
-	json_object *j_sensor_obj   = json_object_new_object();
-	json_object *j_sensor_ID    = json_object_new_int(channel);
-	json_object *j_sensor_value = json_object_new_int(value);
-	json_object *j_sensor_unit  = json_object_new_string(unit_buffer);
-	json_object *j_date_string  = json_object_new_string(date_buffer);
-	json_object_object_add(j_sensor_obj, "Sensor_ID" , j_sensor_ID);
-	json_object_object_add(j_sensor_obj, "Current" , j_sensor_value);
-	json_object_object_add(j_sensor_obj, "Date" , j_date_string);
-	json_object_object_add(j_sensor_obj, "Unit" , j_sensor_unit);
-
-	//Generate path buffers (temp has a ~)
-	snprintf(path_buffer_temp, 30, "./sensor_%d~.json", channel);
-	snprintf(path_buffer, 30, "./sensor_%d.json", channel);
-
-	//All the file IO stuff...
-	FILE *fp_sensor;
-	fp_sensor = fopen(path_buffer_temp, "w");
-	if (fp_sensor == NULL) {
-		fprintf(stderr, "Can't Open File Sensor_%d\n", channel);
-		exit(EXIT_FAILURE);
-	}
+	metrics_update(sample->channel, &record);
+	power_annotate(sample->channel, &record);
+	stats_update(sample->channel, &record);
+	alarm_evaluate(sample->channel, sample->raw, &record);
+	anomaly_update(sample->channel, &record);
+	harmonics_push(sample, value);
+	harmonics_annotate(sample->channel, &record);
 
-	fprintf(fp_sensor, "%s\n",
-		json_object_to_json_string_ext(j_sensor_obj, JSON_C_TO_STRING_PRETTY));
-	fclose(fp_sensor);
-
-	//Rename (This is atomic)
-	rename(path_buffer_temp, path_buffer);
+	output_publish(&record);
 }
 
 void fork_child_kill_parent() {
@@ -255,67 +523,871 @@ void fork_child_kill_parent() {
 }
 
 void free_memory() {
+	reload_stop();
+	free_configs(running_config);
+	free_configs(pending_config);
+	free_configs(retired_configs);
+	running_config = pending_config = retired_configs = NULL;
+	harmonics_stop();
+	output_stop();
+	notify_close();
+	adc_close();
+#ifdef DEBUG
+	output_log_stats();
+	fprintf(stdout, "harmonics: %llu blocks dropped\n", harmonics_dropped());
+#endif
+}
+
+// Reads, parses and validates the config file into a new struct config.
+// Returns NULL when the file can't be read or is invalid, nothing is
+// changed either way. After startup it runs on the reload thread.
+struct config *load_config(const char *path) {
+	struct config *config;
+	const char *parse_end = NULL;
+	size_t length;
+	char *str;
+	cJSON *root;
+	cJSON *ts_item;
+
+	str = read_config(path, &length);
+	if (str == NULL) {
+		return NULL;
+	}
+	root = cJSON_ParseWithOpts(str, &parse_end, 1);
+	if (root == NULL) {
+		fprintf(stderr, "Can't parse %s at byte %ld.\n", path,
+			parse_end != NULL ? (long)(parse_end - str) : (long)length);
+		free(str);
+		return NULL;
+	}
+
+	config = calloc(1, sizeof(*config));
+	if (config == NULL) {
+		perror("Can't allocate config");
+		cJSON_Delete(root);
+		free(str);
+		return NULL;
+	}
+
+	// Optional timestamp settings, default to local time with milliseconds
+	config->ts_format = TS_FORMAT_LOCAL;
+	config->ts_precision = TS_PRECISION_MILLIS;
+	ts_item = cJSON_GetObjectItem(root, TIMESTAMP_FORMAT);
+	if (ts_item != NULL && (!cJSON_IsString(ts_item) || ts_parse_format(ts_item->valuestring, &config->ts_format) < 0)) {
+		fprintf(stderr, "Unknown %s, using local.\n", TIMESTAMP_FORMAT);
+		config->ts_format = TS_FORMAT_LOCAL;
+	}
+	ts_item = cJSON_GetObjectItem(root, TIMESTAMP_PRECISION);
+	if (ts_item != NULL && (!cJSON_IsString(ts_item) || ts_parse_precision(ts_item->valuestring, &config->ts_precision) < 0)) {
+		fprintf(stderr, "Unknown %s, using ms.\n", TIMESTAMP_PRECISION);
+		config->ts_precision = TS_PRECISION_MILLIS;
+	}
 
+	if (load_channels(root, config) < 0 || load_sensors(root, config) < 0 ||
+	    load_calibration(root, config) < 0) {
+		fprintf(stderr, "Invalid config %s.\n", path);
+		free(config);
+		config = NULL;
+	} else {
+		load_outputs(root, config);
+		load_metrics(root, config);
+		load_pairs(root, config);
+		load_stats(root, config);
+		load_harmonics(root, config);
+		load_anomaly(root, config);
+#ifdef DEBUG
+		fprintf(stdout, "%d of %d channels enabled.\n", config->num_channels, config->num_entries);
+#endif
+	}
+
+	cJSON_Delete(root);
+	free(str);
+	return config;
 }
 
-int get_current(int channel, int millivolts) {
-	return current_multiplier[channel] * (current_max_voltage[channel] - ((double)millivolts));
+// Optional list of output sinks, defaults to the per channel files.
+// Entries are a sink name or {"sink": name, "encoding": json|cbor|msgpack}
+// and the http sink also takes "listen": "host:port" or "unix:/path" and
+// "sse_min_interval_ms", the fastest a /events client may be fed a sensor
+static void load_outputs(cJSON *root, struct config *config) {
+	cJSON *outputs = cJSON_GetObjectItem(root, OUTPUTS);
+	cJSON *output, *name, *encoding, *listen, *interval;
+	struct output_config *entry;
+	int sink;
+
+	if (!cJSON_IsArray(outputs)) {
+		config->outputs[0].sink = SINK_FILES;
+		config->outputs[0].encoding = ENCODING_JSON;
+		config->num_outputs = 1;
+		return;
+	}
+
+	cJSON_ArrayForEach(output, outputs) {
+		name = cJSON_IsObject(output) ? cJSON_GetObjectItem(output, OUTPUT_SINK) : output;
+		encoding = cJSON_GetObjectItem(output, OUTPUT_ENCODING);
+
+		sink = sinks_parse_name(cJSON_IsString(name) ? name->valuestring : NULL);
+		if (sink < 0 || config->num_outputs == OUTPUT_MAX_SINKS) {
+			fprintf(stderr, "Unknown output ignored.\n");
+			continue;
+		}
+
+		entry = &config->outputs[config->num_outputs++];
+		entry->sink = sink;
+		entry->encoding = ENCODING_JSON;
+		if (encoding != NULL &&
+		    (!cJSON_IsString(encoding) || record_parse_encoding(encoding->valuestring, &entry->encoding) < 0)) {
+			fprintf(stderr, "Unknown %s, using json.\n", OUTPUT_ENCODING);
+			entry->encoding = ENCODING_JSON;
+		}
+
+		listen = cJSON_GetObjectItem(output, OUTPUT_LISTEN);
+		if (cJSON_IsString(listen) && strlen(listen->valuestring) < sizeof(entry->listen)) {
+			strcpy(entry->listen, listen->valuestring);
+		} else if (listen != NULL) {
+			fprintf(stderr, "Bad %s, using %s.\n", OUTPUT_LISTEN, HTTP_DEFAULT_LISTEN);
+		}
+		interval = cJSON_GetObjectItem(output, OUTPUT_SSE_INTERVAL);
+		entry->sse_min_interval_ms = cJSON_IsNumber(interval) ? interval->valueint : 0;
+	}
+}
+
+// Optional "channels" table, one entry per sensor in sampling order:
+//	{"adc": 0, "name": "feed A", "kind": "current", "unit": "mA",
+//	 "calibration": {...}, "rate_hz": 100, "enabled": true}
+// Only "adc" is required, "kind" defaults to voltage and a channel without
+// a rate is sampled on every pass. The position in the table is the zero
+// based channel number the rest of the config and the sensor ids use.
+// Without a table the eight ADC inputs are sampled, the first four as
+// currents like before.
+static int load_channels(cJSON *root, struct config *config) {
+	cJSON *table = cJSON_GetObjectItem(root, CHANNELS);
+	cJSON *entry, *item;
+	struct channel *channel;
+	char *name;
+	int index;
+
+	if (table == NULL) {
+		for (index = 0; index < ADC_INPUTS; index++) {
+			channel = &config->channels[index];
+			channel->index = channel->adc = index;
+			channel->partner = -1;
+			channel->kind = (index < LEGACY_CURRENT_CHANNELS) ? CHANNEL_CURRENT : CHANNEL_VOLTAGE;
+			config->slot[index] = index;
+			sprintf(config->names[index], "channel %d", index);
+		}
+		config->num_channels = config->num_entries = ADC_INPUTS;
+		return 0;
+	}
+
+	config->num_entries = cJSON_GetArraySize(table);
+	if (!cJSON_IsArray(table) || config->num_entries == 0 || config->num_entries > MAX_CHANNELS) {
+		fprintf(stderr, "%s must list 1 to %d channels.\n", CHANNELS, MAX_CHANNELS);
+		return -1;
+	}
+
+	index = 0;
+	cJSON_ArrayForEach(entry, table) {
+		name = config->names[index];
+		item = cJSON_GetObjectItem(entry, CHANNEL_NAME);
+		if (cJSON_IsString(item)) {
+			snprintf(name, CHANNEL_NAME_SIZE, "%s", item->valuestring);
+		} else {
+			sprintf(name, "channel %d", index);
+		}
+
+		config->slot[index] = -1;
+		if (cJSON_IsFalse(cJSON_GetObjectItem(entry, CHANNEL_ENABLED))) {
+			index++;
+			continue;
+		}
+
+		channel = &config->channels[config->num_channels];
+		channel->index = index;
+		channel->partner = -1;
+
+		item = cJSON_GetObjectItem(entry, CHANNEL_ADC);
+		if (!cJSON_IsNumber(item) || item->valueint < 0 || item->valueint >= ADC_INPUTS) {
+			fprintf(stderr, "%s: %s must be 0 to %d.\n", name, CHANNEL_ADC, ADC_INPUTS - 1);
+			return -1;
+		}
+		channel->adc = item->valueint;
+
+		channel->kind = CHANNEL_VOLTAGE;
+		item = cJSON_GetObjectItem(entry, CHANNEL_KIND);
+		if (item != NULL && (!cJSON_IsString(item) || parse_channel_kind(item->valuestring, &channel->kind) < 0)) {
+			fprintf(stderr, "%s: unknown %s.\n", name, CHANNEL_KIND);
+			return -1;
+		}
+
+		item = cJSON_GetObjectItem(entry, CHANNEL_RATE);
+		if (item != NULL && (!cJSON_IsNumber(item) || item->valuedouble <= 0)) {
+			fprintf(stderr, "%s: %s must be positive.\n", name, CHANNEL_RATE);
+			return -1;
+		}
+		channel->interval_ns = (item != NULL) ? (long long)(1e9 / item->valuedouble) : 0;
+
+		config->slot[index++] = config->num_channels++;
+	}
+
+	if (config->num_channels == 0) {
+		fprintf(stderr, "No channel is enabled.\n");
+		return -1;
+	}
+
+	return 0;
 }
 
-void load_config() {
+static int parse_channel_kind(const char *name, enum channel_kind *kind) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, "current") == 0) {
+		*kind = CHANNEL_CURRENT;
+	} else if (strcasecmp(name, "voltage") == 0) {
+		*kind = CHANNEL_VOLTAGE;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Optional current_sensor_N for channel N:
+//	{"min_avg_voltage": mV, "max_avg_voltage": mV, "min_amperage": mA,
+//	 "max_amperage": mA, "multiplier": mA per mV}
+// plus the optional "alarm_hysteresis" and "alarm_debounce". When given it
+// must be complete. It sets the channel's alarms and calibrates current
+// channels that have no calibration of their own.
+static int load_sensors(cJSON *root, struct config *config) {
+	char sensor_name[32];
+	cJSON *sensor, *hysteresis, *debounce;
+	double min_voltage, max_voltage, min_current, max_current;
+	struct alarm_limits *limits;
 	int i;
-	char sensor_name[20];
-	char *str = readFile();
-	cJSON *root = cJSON_Parse(str);
-	
-	for(i = 0; i < 4; i++) {
-        	sprintf(sensor_name, "current_sensor_%i", i);
 
-		
-    		cJSON *sensor = cJSON_GetObjectItem(root, sensor_name);
+	for (i = 0; i < config->num_entries; i++) {
+		sprintf(sensor_name, "current_sensor_%i", i);
+		sensor = cJSON_GetObjectItem(root, sensor_name);
+		if (sensor == NULL) {
+			continue;
+		}
 
-		cJSON *max_voltage = cJSON_GetObjectItem(sensor, MAX_VOLTS);
-		cJSON *min_voltage = cJSON_GetObjectItem(sensor, MIN_VOLTS);
-		cJSON *max_current = cJSON_GetObjectItem(sensor, MAX_AMPS);
-		cJSON *min_current = cJSON_GetObjectItem(sensor, MIN_AMPS);
-		cJSON *multiplier  = cJSON_GetObjectItem(sensor, MULTIPLIER);
-		
-		current_max_voltage[i] = max_voltage->valuedouble;
-		current_min_voltage[i] = min_voltage->valuedouble;
-		current_max_current[i] = max_current->valuedouble;
-		current_min_current[i] = min_current->valuedouble;
-		current_multiplier[i]  = multiplier->valuedouble;
+		if (required_number(sensor, sensor_name, MIN_VOLTS, &min_voltage) < 0 ||
+		    required_number(sensor, sensor_name, MAX_VOLTS, &max_voltage) < 0 ||
+		    required_number(sensor, sensor_name, MIN_AMPS, &min_current) < 0 ||
+		    required_number(sensor, sensor_name, MAX_AMPS, &max_current) < 0 ||
+		    required_number(sensor, sensor_name, MULTIPLIER, &config->multiplier[i]) < 0) {
+			return -1;
+		}
+		config->has_sensor[i] = 1;
+		config->zero_current_voltage[i] = max_voltage;
+
+		// Alarms: the current against min/max_amperage and the raw
+		// millivolts against min_avg_voltage (max_avg_voltage is the
+		// zero current reference, not a limit)
+		hysteresis = cJSON_GetObjectItem(sensor, ALARM_HYSTERESIS);
+		debounce = cJSON_GetObjectItem(sensor, ALARM_DEBOUNCE);
+
+		limits = &config->value_limits[i];
+		limits->hysteresis = cJSON_IsNumber(hysteresis) ? hysteresis->valueint : 0;
+		limits->debounce = cJSON_IsNumber(debounce) ? debounce->valueint : ALARM_DEFAULT_DEBOUNCE;
+		limits->low_enabled = limits->high_enabled = 1;
+		limits->low = min_current;
+		limits->high = max_current;
+
+		config->raw_limits[i] = *limits;
+		config->raw_limits[i].high_enabled = 0;
+		config->raw_limits[i].low = min_voltage;
 	}
-	cJSON_Delete(root);
-	free(str);
+
+	return 0;
+}
+
+// Stores the number object.key in value, complains when it is missing
+static int required_number(cJSON *object, const char *object_name, const char *key, double *value) {
+	cJSON *item = cJSON_GetObjectItem(object, key);
+
+	if (!cJSON_IsNumber(item)) {
+		fprintf(stderr, "%s: %s missing or not a number.\n", object_name, key);
+		return -1;
+	}
+
+	*value = item->valuedouble;
+	return 0;
+}
+
+// Compiles the calibration of every enabled channel. It is the channel's
+// "calibration" object or else the entry of the optional "calibration"
+// array at the channel's position:
+//	{"type": "linear", "gain": g, "offset": o, "unit": "mA"}
+//	{"type": "poly", "coefficients": [c0, c1, ...], "unit": "mA"}
+//	{"type": "piecewise", "points": [[code, value], ...], "unit": "mA"}
+// Without one a current channel is calibrated from its current_sensor_N
+// and a voltage channel reports raw millivolts. The unit is "mA" for
+// current and "mV" for voltage channels unless the calibration gives one,
+// the channel's "unit" overrides both. Units are at most 7 characters and
+// may not contain quotes, backslashes or control characters.
+static int load_calibration(cJSON *root, struct config *config) {
+	cJSON *entries = cJSON_GetObjectItem(root, CALIBRATION);
+	cJSON *table = cJSON_GetObjectItem(root, CHANNELS);
+	cJSON *entry, *item, *point;
+	struct channel *channel;
+	struct calib_spec spec;
+	int has_default;
+	int slot;
+	int i;
+
+	for (slot = 0; slot < config->num_channels; slot++) {
+		channel = &config->channels[slot];
+		memset(&spec, 0, sizeof(spec));
+		has_default = 1;
+		spec.unit = (channel->kind == CHANNEL_VOLTAGE) ? "mV" : "mA";
+		if (channel->kind == CHANNEL_VOLTAGE) {
+			spec.kind = CALIB_RAW;
+		} else if (config->has_sensor[channel->index]) {
+			// multiplier * (max_avg_voltage - mV), as -multiplier * (mV - origin)
+			// so the double reference rounds exactly like the old get_current()
+			spec.kind = CALIB_LINEAR;
+			spec.order = 1;
+			spec.coefficients[0] = 0;
+			spec.coefficients[1] = -config->multiplier[channel->index];
+			spec.origin = config->zero_current_voltage[channel->index];
+		} else {
+			has_default = 0;
+		}
+
+		entry = cJSON_GetObjectItem(cJSON_GetArrayItem(table, channel->index), CHANNEL_CALIBRATION);
+		if (entry == NULL) {
+			entry = cJSON_GetArrayItem(entries, channel->index);
+		}
+		if (cJSON_IsObject(entry)) {
+			item = cJSON_GetObjectItem(entry, CALIBRATION_TYPE);
+			if (!cJSON_IsString(item) || calib_parse_kind(item->valuestring, &spec.kind) < 0) {
+				fprintf(stderr, "%s: unknown %s.\n", config->names[channel->index], CALIBRATION_TYPE);
+				return -1;
+			}
+			spec.origin = 0;
+
+			item = cJSON_GetObjectItem(entry, CALIBRATION_UNIT);
+			if (cJSON_IsString(item)) {
+				spec.unit = item->valuestring;
+			}
+
+			if (spec.kind == CALIB_LINEAR) {
+				spec.order = 1;
+				item = cJSON_GetObjectItem(entry, CALIBRATION_OFFSET);
+				spec.coefficients[0] = cJSON_IsNumber(item) ? item->valuedouble : 0;
+				item = cJSON_GetObjectItem(entry, CALIBRATION_GAIN);
+				spec.coefficients[1] = cJSON_IsNumber(item) ? item->valuedouble : 1;
+			} else if (spec.kind == CALIB_POLY) {
+				item = cJSON_GetObjectItem(entry, CALIBRATION_COEFFICIENTS);
+				spec.order = cJSON_GetArraySize(item) - 1;
+				for (i = 0; i <= spec.order && i <= CALIB_MAX_ORDER; i++) {
+					point = cJSON_GetArrayItem(item, i);
+					spec.coefficients[i] = cJSON_IsNumber(point) ? point->valuedouble : 0;
+				}
+			} else if (spec.kind == CALIB_PIECEWISE) {
+				item = cJSON_GetObjectItem(entry, CALIBRATION_POINTS);
+				spec.points = cJSON_GetArraySize(item);
+				for (i = 0; i < spec.points && i < CALIB_MAX_POINTS; i++) {
+					point = cJSON_GetArrayItem(item, i);
+					spec.code[i] = cJSON_IsNumber(cJSON_GetArrayItem(point, 0)) ? cJSON_GetArrayItem(point, 0)->valuedouble : 0;
+					spec.value[i] = cJSON_IsNumber(cJSON_GetArrayItem(point, 1)) ? cJSON_GetArrayItem(point, 1)->valuedouble : 0;
+				}
+			}
+		} else if (!has_default) {
+			fprintf(stderr, "%s: current channel needs a calibration or current_sensor_%d.\n",
+				config->names[channel->index], channel->index);
+			return -1;
+		}
+
+		item = cJSON_GetObjectItem(cJSON_GetArrayItem(table, channel->index), CHANNEL_UNIT);
+		if (cJSON_IsString(item)) {
+			spec.unit = item->valuestring;
+		}
+
+		if (!calib_valid_unit(spec.unit)) {
+			fprintf(stderr, "%s: %s must be at most %d characters without quotes, backslashes or control characters.\n",
+				config->names[channel->index], CHANNEL_UNIT, CALIB_UNIT_SIZE - 1);
+			return -1;
+		}
+		if (calib_compile(&spec, &config->calibrations[slot]) < 0) {
+			fprintf(stderr, "%s: bad calibration.\n", config->names[channel->index]);
+			return -1;
+		}
+		channel->calibration = &config->calibrations[slot];
+	}
+
+	return 0;
 }
 
-// Function from a save file.
-// Modified for our program
-// credit: http://stackoverflow.com/questions/4823177/reading-a-file-character-by-character-in-c
-char *readFile() {
-    FILE *file = fopen("/var/tmp/sensor-config/config.json", "r");
-    char *code;
-    size_t n = 0;
-    int c;
+// Optional "metrics" array indexed by channel, {"window_ms": 1000,
+// "voltage": 12.0} enables RMS, power and energy for that channel
+static void load_metrics(cJSON *root, struct config *config) {
+	cJSON *entries = cJSON_GetObjectItem(root, METRICS);
+	cJSON *entry, *window, *voltage;
+	int channel;
+
+	for (channel = 0; channel < MAX_CHANNELS; channel++) {
+		entry = cJSON_GetArrayItem(entries, channel);
+		window = cJSON_GetObjectItem(entry, METRICS_WINDOW);
+		voltage = cJSON_GetObjectItem(entry, METRICS_VOLTAGE);
+		config->metrics_window_ms[channel] = cJSON_IsNumber(window) ? window->valueint : 0;
+		config->metrics_voltage[channel] = cJSON_IsNumber(voltage) ? voltage->valuedouble : 0;
+	}
+
+	window = cJSON_GetObjectItem(root, ENERGY_CHECKPOINT_SEC);
+	config->energy_checkpoint_s = cJSON_IsNumber(window) ? window->valueint : 0;
+}
+
+// Optional "pairs" array of {"current": 0, "voltage": 4, "window_ms": 1000},
+// channel numbers are positions in the channel table (the ADC inputs when
+// there is none). Both channels must be enabled and in no other pair.
+static void load_pairs(cJSON *root, struct config *config) {
+	cJSON *entries = cJSON_GetObjectItem(root, PAIRS);
+	cJSON *entry, *current, *voltage, *window;
+	struct config_pair *pair;
+	struct channel *current_channel, *voltage_channel;
+
+	cJSON_ArrayForEach(entry, entries) {
+		current = cJSON_GetObjectItem(entry, PAIR_CURRENT);
+		voltage = cJSON_GetObjectItem(entry, PAIR_VOLTAGE);
+		window = cJSON_GetObjectItem(entry, PAIR_WINDOW);
+		if (!cJSON_IsNumber(current) || !cJSON_IsNumber(voltage) ||
+		    current->valueint < 0 || current->valueint >= config->num_entries ||
+		    voltage->valueint < 0 || voltage->valueint >= config->num_entries ||
+		    current->valueint == voltage->valueint ||
+		    config->slot[current->valueint] < 0 || config->slot[voltage->valueint] < 0 ||
+		    (cJSON_IsNumber(window) && window->valueint <= 0) ||
+		    config->num_pairs == POWER_MAX_PAIRS) {
+			fprintf(stderr, "Bad channel pair ignored.\n");
+			continue;
+		}
+
+		current_channel = &config->channels[config->slot[current->valueint]];
+		voltage_channel = &config->channels[config->slot[voltage->valueint]];
+		if (current_channel->partner >= 0 || current_channel->with_partner ||
+		    voltage_channel->partner >= 0 || voltage_channel->with_partner) {
+			fprintf(stderr, "Bad channel pair ignored.\n");
+			continue;
+		}
+		current_channel->partner = config->slot[voltage->valueint];
+		voltage_channel->with_partner = 1;
+
+		pair = &config->pairs[config->num_pairs++];
+		pair->current = current->valueint;
+		pair->voltage = voltage->valueint;
+		pair->window_ms = cJSON_IsNumber(window) ? window->valueint : 1000;
+	}
+}
+
+// Optional "stats_windows_ms": [1000, 10000, 60000], applies to every channel
+static void load_stats(cJSON *root, struct config *config) {
+	cJSON *windows = cJSON_GetObjectItem(root, STATS_WINDOWS);
+	cJSON *window;
+
+	cJSON_ArrayForEach(window, windows) {
+		if (!cJSON_IsNumber(window) || window->valueint <= 0 || config->num_stats_windows == RECORD_MAX_STATS) {
+			fprintf(stderr, "Bad %s entry ignored.\n", STATS_WINDOWS);
+			continue;
+		}
+		config->stats_windows_ms[config->num_stats_windows++] = window->valueint;
+	}
+}
+
+// Optional "harmonics" array of {"channel": 0, "block": 256, "harmonics": 5,
+// "fundamental_hz": 60}, only used at startup like the output sinks
+static void load_harmonics(cJSON *root, struct config *config) {
+	cJSON *entries = cJSON_GetObjectItem(root, HARMONICS);
+	cJSON *entry, *channel, *block, *order, *fundamental;
+	struct config_harmonics *harmonics;
+
+	cJSON_ArrayForEach(entry, entries) {
+		channel = cJSON_GetObjectItem(entry, HARMONICS_CHANNEL);
+		block = cJSON_GetObjectItem(entry, HARMONICS_BLOCK);
+		order = cJSON_GetObjectItem(entry, HARMONICS_ORDER);
+		fundamental = cJSON_GetObjectItem(entry, HARMONICS_FUNDAMENTAL);
+
+		if (!cJSON_IsNumber(channel) || channel->valueint < 0 || channel->valueint >= config->num_entries ||
+		    config->slot[channel->valueint] < 0 || config->num_harmonics == MAX_CHANNELS) {
+			fprintf(stderr, "Bad %s entry ignored.\n", HARMONICS);
+			continue;
+		}
+
+		harmonics = &config->harmonics[config->num_harmonics++];
+		harmonics->channel = channel->valueint;
+		harmonics->config.block = cJSON_IsNumber(block) ? block->valueint : 256;
+		harmonics->config.harmonics = cJSON_IsNumber(order) ? order->valueint : 5;
+		harmonics->config.fundamental_hz = cJSON_IsNumber(fundamental) ? fundamental->valuedouble : 0;
+	}
+}
+
+// Optional "anomaly": {"alpha": 0.01, "threshold": 4, "warmup": 200},
+// applies to every channel
+static void load_anomaly(cJSON *root, struct config *config) {
+	cJSON *anomaly = cJSON_GetObjectItem(root, ANOMALY);
+	cJSON *alpha = cJSON_GetObjectItem(anomaly, ANOMALY_ALPHA);
+	cJSON *threshold = cJSON_GetObjectItem(anomaly, ANOMALY_THRESHOLD);
+	cJSON *warmup = cJSON_GetObjectItem(anomaly, ANOMALY_WARMUP);
+
+	config->anomaly_alpha = cJSON_IsNumber(alpha) ? alpha->valuedouble : 0;
+	config->anomaly_threshold = cJSON_IsNumber(threshold) ? threshold->valuedouble : 0;
+	config->anomaly_warmup = cJSON_IsNumber(warmup) ? warmup->valueint : 0;
+}
+
+// Hands the runtime settings of a config to the modules. Runs on the
+// sampler thread between two samples, so they never see a half applied
+// config. Against the previous config (NULL at startup) the stats windows
+// and power pairs are only rebuilt when their settings changed, metrics
+// and anomaly already keep their state for unchanged settings.
+static void apply_config(const struct config *config, const struct config *previous) {
+	const struct config_pair *pair;
+	int i;
+
+	ts_configure(config->ts_format, config->ts_precision);
+
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		alarm_configure(i, ALARM_SOURCE_VALUE, &config->value_limits[i]);
+		alarm_configure(i, ALARM_SOURCE_RAW, &config->raw_limits[i]);
+	}
+
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		metrics_configure(i, config->metrics_window_ms[i], config->metrics_voltage[i]);
+	}
+	metrics_set_checkpoint(config->energy_checkpoint_s);
+
+	if (previous == NULL || previous->num_pairs != config->num_pairs ||
+	    memcmp(previous->pairs, config->pairs, config->num_pairs * sizeof(*config->pairs)) != 0) {
+		power_clear();
+		for (i = 0; i < config->num_pairs; i++) {
+			pair = &config->pairs[i];
+			if (power_add_pair(pair->current, pair->voltage, pair->window_ms) < 0) {
+				fprintf(stderr, "Bad channel pair ignored.\n");
+			}
+		}
+	}
+
+	if (previous == NULL || previous->num_stats_windows != config->num_stats_windows ||
+	    memcmp(previous->stats_windows_ms, config->stats_windows_ms,
+		    config->num_stats_windows * sizeof(*config->stats_windows_ms)) != 0) {
+		stats_configure(config->stats_windows_ms, config->num_stats_windows);
+	}
+	anomaly_configure(config->anomaly_alpha, config->anomaly_threshold, config->anomaly_warmup);
+}
+
+// Sampler side: switches to a reloaded config between two samples and
+// queues the old one for the reload thread to free. Only the sampler
+// pushes to the retired list, so a plain compare and swap will do.
+static void switch_config(struct config *config) {
+	long long latency_ns;
+
+	apply_config(config, running_config);
+	latency_ns = ts_elapsed_ns(&config->requested);
+	__atomic_store_n(&reload_stats.last_latency_ns, latency_ns, __ATOMIC_RELAXED);
+	if (latency_ns > reload_stats.max_latency_ns) {
+		__atomic_store_n(&reload_stats.max_latency_ns, latency_ns, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&reload_stats.applied, 1, __ATOMIC_RELAXED);
 
-    if (file == NULL)
-        exit(1);
+	running_config->next = __atomic_load_n(&retired_configs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&retired_configs, &running_config->next, running_config, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+	running_config = config;
+
+	wake_reload_thread();
+}
+
+static void free_configs(struct config *list) {
+	struct config *next;
+
+	while (list != NULL) {
+		next = list->next;
+		free(list);
+		list = next;
+	}
+}
+
+// Async signal safe, a write to an eventfd never blocks
+static void wake_reload_thread() {
+	uint64_t one = 1;
+
+	if (reload_running && write(reload_event_fd, &one, sizeof(one)) < 0) {
+		// the counter only saturates when nobody has read it for ages
+	}
+}
+
+// Starts the reload thread. It watches the directory of the config file
+// so saving the file reloads it without a SIGHUP. When the watch can't be
+// set up SIGHUP, handled since main() called init_signals(), is the only
+// way to reload.
+int reload_start() {
+	char directory[PATH_MAX];
+	const char *slash;
+
+	if (reload_running) {
+		return 0;
+	}
+
+	reload_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reload_event_fd < 0) {
+		perror("eventfd() failed for config reloads.");
+		return -1;
+	}
+
+	// editors replace the file, so the directory is watched rather than it
+	slash = strrchr(config_path, '/');
+	if (slash == NULL) {
+		strcpy(directory, ".");
+	} else if (slash == config_path) {
+		strcpy(directory, "/");
+	} else {
+		snprintf(directory, sizeof(directory), "%.*s", (int)(slash - config_path), config_path);
+	}
+	config_name = slash != NULL ? slash + 1 : config_path;
+
+	reload_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (reload_watch_fd < 0 ||
+	    inotify_add_watch(reload_watch_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) < 0) {
+		fprintf(stderr, "Can't watch %s: %s, send SIGHUP (kill -HUP %d) to reload %s.\n",
+			directory, strerror(errno), (int)getpid(), config_path);
+		if (reload_watch_fd >= 0) {
+			close(reload_watch_fd);
+			reload_watch_fd = -1;
+		}
+	}
+
+	reload_running = 1;
+	if (pthread_create(&reloader, NULL, reload_thread, NULL) != 0) {
+		fprintf(stderr, "Failed to start the reload thread.\n");
+		reload_running = 0;
+		close(reload_event_fd);
+		if (reload_watch_fd >= 0) {
+			close(reload_watch_fd);
+		}
+		reload_event_fd = reload_watch_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
 
-    code = malloc(FILE_CHAR_SIZE);
+void reload_stop() {
+	uint64_t one = 1;
 
-    while ((c = fgetc(file)) != EOF) {
-        code[n++] = (char) c;
-    }
+	if (!reload_running) {
+		return;
+	}
 
-    code[n] = '\0';        
-    return code;
+	reload_running = 0;
+	if (write(reload_event_fd, &one, sizeof(one)) == sizeof(one)) {
+		pthread_join(reloader, NULL);
+	}
+	close(reload_event_fd);
+	if (reload_watch_fd >= 0) {
+		close(reload_watch_fd);
+	}
+	reload_event_fd = reload_watch_fd = -1;
 }
+
+// Event loop of the reload thread. SIGHUP reloads straight away, changes
+// to the config file once they have been quiet for CONFIG_DEBOUNCE_MS so
+// an editor's truncate, write and rename only reload the final file.
+static void *reload_thread(void *arg) {
+	struct pollfd fds[2];
+	struct timespec changed;
+	long long quiet_ns;
+	int debouncing = 0;
+	int timeout;
+	uint64_t count;
+
+	fds[0].fd = reload_event_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = reload_watch_fd;	// poll() skips it when negative
+	fds[1].events = POLLIN;
+
+	while (1) {
+		timeout = -1;
+		if (debouncing) {
+			quiet_ns = ts_elapsed_ns(&changed);
+			timeout = quiet_ns >= CONFIG_DEBOUNCE_MS * 1000000LL ? 0 :
+				CONFIG_DEBOUNCE_MS - quiet_ns / 1000000;
+		}
+
+		if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+			perror("poll() failed for config reloads.");
+			break;
+		}
+		if (!reload_running) {
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			if (read(reload_event_fd, &count, sizeof(count)) < 0) {
+				// another wakeup raced us to it
+			}
+
+			// the sampler has switched away from these, nothing reads them
+			free_configs(__atomic_exchange_n(&retired_configs, NULL, __ATOMIC_ACQUIRE));
+
+			if (REREAD_CONFIG) {
+				REREAD_CONFIG = 0;
+				reload_stats.signals++;
+				reload_config();
+			}
+		}
+
+		if ((fds[1].revents & POLLIN) && config_changed()) {
+			clock_gettime(CLOCK_MONOTONIC, &changed);
+			debouncing = 1;
+		}
+
+		if (debouncing && ts_elapsed_ns(&changed) >= CONFIG_DEBOUNCE_MS * 1000000LL) {
+			debouncing = 0;
+			reload_stats.file_events++;
+			reload_config();
+		}
+
+		write_reload_stats();
+	}
+
+	return NULL;
+}
+
+// Drains the inotify events, returns whether one was for the config file
+static int config_changed() {
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t length;
+	char *position;
+	int changed = 0;
+
+	while ((length = read(reload_watch_fd, buffer, sizeof(buffer))) > 0) {
+		for (position = buffer; position < buffer + length;
+		     position += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)position;
+			if (event->len > 0 && strcmp(event->name, config_name) == 0) {
+				changed = 1;
+			}
+		}
+	}
+
+	return changed;
+}
+
+// Loads the config and leaves it in pending_config for the sampler
+static void reload_config() {
+	struct timespec requested;
+	struct config *config;
+
+	clock_gettime(CLOCK_MONOTONIC, &requested);
+	config = load_config(config_path);
+	if (config == NULL) {
+		reload_stats.failed++;
+		fprintf(stderr, "Config reload failed, keeping the running config.\n");
+		return;
+	}
+	config->requested = requested;
+
+	// a config the sampler hasn't picked up yet is replaced
+	free_configs(__atomic_exchange_n(&pending_config, config, __ATOMIC_ACQ_REL));
+#ifdef DEBUG
+	fprintf(stdout, "Config reloaded, parsed in %lld us.\n", ts_elapsed_ns(&requested) / 1000);
+#endif
+}
+
+// Rewrites RELOAD_STATS when a counter moved:
+//	{"signals": n, "file_events": n, "failed": n, "applied": n,
+//	 "last_latency_us": n, "max_latency_us": n}
+// The latencies run from the start of a reload to the sampler using it.
+static void write_reload_stats() {
+	static struct reload_stats written;
+	struct reload_stats stats;
+	FILE *file;
+
+	stats.signals = reload_stats.signals;
+	stats.file_events = reload_stats.file_events;
+	stats.failed = reload_stats.failed;
+	stats.applied = __atomic_load_n(&reload_stats.applied, __ATOMIC_RELAXED);
+	stats.last_latency_ns = __atomic_load_n(&reload_stats.last_latency_ns, __ATOMIC_RELAXED);
+	stats.max_latency_ns = __atomic_load_n(&reload_stats.max_latency_ns, __ATOMIC_RELAXED);
+	if (stats.signals == written.signals && stats.file_events == written.file_events &&
+	    stats.failed == written.failed && stats.applied == written.applied) {
+		return;
+	}
+
+	file = fopen(RELOAD_STATS "~", "w");
+	if (file == NULL) {
+		fprintf(stderr, "Can't Open File %s\n", RELOAD_STATS "~");
+		return;
+	}
+	fprintf(file, "{\"signals\":%llu,\"file_events\":%llu,\"failed\":%llu,\"applied\":%llu,"
+		"\"last_latency_us\":%lld,\"max_latency_us\":%lld}\n",
+		stats.signals, stats.file_events, stats.failed, stats.applied,
+		stats.last_latency_ns / 1000, stats.max_latency_ns / 1000);
+	if (fclose(file) == 0 && rename(RELOAD_STATS "~", RELOAD_STATS) == 0) {
+		written = stats;
+	}
+}
+
+// Reads the whole config file with one read() sized by fstat(). The
+// buffer is NUL terminated for cJSON and must be freed by the caller.
+char *read_config(const char *path, size_t *length) {
+	struct stat st;
+	char *buffer;
+	ssize_t count;
+	size_t n = 0;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open config %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat() config");
+		close(fd);
+		return NULL;
+	}
+
+	buffer = malloc(st.st_size + 1);
+	if (buffer == NULL) {
+		perror("Can't allocate config buffer");
+		close(fd);
+		return NULL;
+	}
+
+	// a regular file is read in one go, the loop only covers signals
+	while (n < (size_t)st.st_size) {
+		count = read(fd, buffer + n, st.st_size - n);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			break;
+		}
+		n += count;
+	}
+	close(fd);
+
+	if (n != (size_t)st.st_size) {
+		fprintf(stderr, "Short read of config %s.\n", path);
+		free(buffer);
+		return NULL;
+	}
+
+	buffer[n] = '\0';
+	*length = n;
+	return buffer;
+}
+
 void init_signals() {
 	struct sigaction sa;
 	// initialize sigaction struct and signal handling
-	sa.sa_flags = SA_SIGINFO;
 	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_flags = SA_SIGINFO;
 	sigemptyset(&sa.sa_mask);
 	sa.sa_sigaction = sig_handler;
 
@@ -343,6 +1415,7 @@ static void sig_handler(int signo, siginfo_t *si, void *unused) {
 	switch (signo) {
 		case SIGHUP:
 			REREAD_CONFIG = 1;
+			wake_reload_thread();
 			break;
 
 		case SIGINT:
@@ -358,87 +1431,73 @@ static void sig_handler(int signo, siginfo_t *si, void *unused) {
 	}
 }
 
-int read_adc(int channel) {
-
-	void *base;
-        uint32_t *adc_base;
-        int memdevice_fd, value;
+// Maps the ADC registers once for the life of the daemon, every
+// conversion after that is a few register accesses on the same mapping
+void adc_open() {
 
 	// Open /dev/mem device
-	if( (memdevice_fd = open("/dev/mem", (O_RDWR | O_SYNC))) < 0) {
+	if( (adc_fd = open("/dev/mem", (O_RDWR | O_SYNC))) < 0) {
 			perror("Unable to open \"/dev/mem\".");
 			exit(EXIT_FAILURE);
 	}
 
 	// mmap the HPS registers
-	base = (uint32_t*) mmap(NULL, HW_REGS_SPAN, (PROT_READ | PROT_WRITE), MAP_SHARED, memdevice_fd, HW_REGS_BASE);
-	if(base == MAP_FAILED) {
+	adc_map = mmap(NULL, HW_REGS_SPAN, (PROT_READ | PROT_WRITE), MAP_SHARED, adc_fd, HW_REGS_BASE);
+	if(adc_map == MAP_FAILED) {
 			perror("mmap() failed.");
-			close(memdevice_fd);
+			close(adc_fd);
 			exit(EXIT_FAILURE);
 	}
 
 	// derive adc component base address from base HPS registers
-	adc_base = (uint32_t*) (base + ((ALT_LWFPGASLVS_OFST + ADC_LTC2308_0_BASE) & HW_REGS_MASK));
+	adc_base = (uint32_t*) (adc_map + ((ALT_LWFPGASLVS_OFST + ADC_LTC2308_0_BASE) & HW_REGS_MASK));
 
 	// initialize ADC Component's Buffer Size
 	*(adc_base + 0x01) = NUM_READS;
+}
 
-	value = get_adc_value(adc_base, channel);
+void adc_close() {
+	if (adc_base == NULL) {
+		return;
+	}
 
 	// unmap and close /dev/mem
-        if( munmap(base, HW_REGS_SPAN) < 0) {
-            perror("munmap() failed.");
-            close(memdevice_fd);
-            exit(EXIT_FAILURE);
-        }
+	if( munmap(adc_map, HW_REGS_SPAN) < 0) {
+		perror("munmap() failed.");
+	}
+	close(adc_fd);
+	adc_base = NULL;
+}
 
-        close(memdevice_fd);
+void read_adc(const struct channel *channel, struct sample *sample) {
+	sample->channel = channel->index;
+	sample->raw = get_adc_value(adc_base, channel->adc, &sample->taken);
+}
 
-	return value;
+// The voltage conversion is triggered as soon as the current's has been
+// read back, both are stamped at their own trigger so the pair skew is
+// the time between the two conversions and nothing else
+void read_adc_pair(const struct channel *current, struct sample *current_sample,
+		const struct channel *voltage, struct sample *voltage_sample) {
+	current_sample->channel = current->index;
+	voltage_sample->channel = voltage->index;
+	current_sample->raw = get_adc_value(adc_base, current->adc, &current_sample->taken);
+	voltage_sample->raw = get_adc_value(adc_base, voltage->adc, &voltage_sample->taken);
 }
 
-int get_adc_value(uint32_t *adc_base, int channel) {
+int get_adc_value(uint32_t *adc_base, int channel, struct timespec *taken) {
 
         // indicate to the adc component to begin reads.
         *adc_base = (channel << 1) | 0x00;
         *adc_base = (channel << 1) | 0x01;
         *adc_base = (channel << 1) | 0x00;
 
+        // timestamp the conversion as close to the trigger as possible
+        clock_gettime(CLOCK_MONOTONIC, taken);
+
         // wait for component to finish reading
         usleep(1);
         while( (*adc_base & 0x01) == 0x00);
 
         return *(adc_base + 0x01);
 }
-
-int get_date(char *date_buffer, size_t buffer_size) {
-	int ERR = -1;
-
-	time_t timer;
-	struct tm* tm_info;
-	const char format[] = "%Y-%m-%dT%H:%M:%S";
-
-	if (time(&timer) < 0) {
-#ifdef DEBUG
-		perror("Failed to get current time.");
-#endif
-		return ERR;
-	}
-
-	tm_info = localtime(&timer);
-	if (tm_info == NULL) {
-#ifdef DEBUG
-		perror("Failed to derive localtime from current time.");
-#endif
-		return ERR;
-	}
-
-	if (strftime(date_buffer, buffer_size, format, tm_info) == 0) {
-#ifdef DEBUG
-		perror("Failed to format localtime. Indeterminate Result.");
-#endif
-	}
-
-	return 0;
-}
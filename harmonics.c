@@ -0,0 +1,412 @@
+/*
+file: harmonics.c
+
+Description:
+	Real FFT harmonic analysis, see harmonics.h. An N point real block is
+	transformed as an N/2 point complex FFT followed by the split step.
+	Twiddles, bit reversal and the Hann window are tabulated per block
+	size at configure time and all buffers are static, so analysing a
+	block never allocates.
+
+	Handing blocks over: each channel has two block buffers. The sampler
+	fills one; when it is full and the worker has released the other
+	they are swapped and the worker is woken, otherwise the block is
+	dropped. Results go back through a per channel sequence lock.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "harmonics.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Energy of a Hann windowed sine over its peak bin and both neighbours is
+// A^2 * N^2 * 3/32
+#define HANN_AMPLITUDE_SCALE 3.2659863237109041	// sqrt(32 / 3)
+
+struct fft_tables;
+
+// FUNCTION SIGNATURES
+static void	*harmonics_worker(void *arg);
+static struct fft_tables	*tables_for(int block);
+static void	real_fft(const struct fft_tables *tables, float *data, float *spectrum);
+static double	bin_energy(const float *spectrum, int bin);
+static double	band_energy(const float *spectrum, int bin, int bins);
+
+// Tables for one block size, shared by every channel using it
+struct fft_tables {
+	int block;
+	float twiddle[HARMONICS_MAX_BLOCK];	// cos, -sin of 2 pi k / block, interleaved
+	float window[HARMONICS_MAX_BLOCK];
+	unsigned short reverse[HARMONICS_MAX_BLOCK / 2];
+};
+
+struct channel_harmonics {
+	struct harmonics_config config;	// block 0 when not analysed
+	struct fft_tables *tables;
+
+	// sampler side
+	float buffers[2][HARMONICS_MAX_BLOCK];
+	int filling;			// buffer the sampler writes
+	int count;
+	long long first_ns, last_ns;
+
+	// handed to the worker
+	int ready;			// set by the sampler, cleared by the worker
+	int ready_buffer;
+	double ready_rate;
+
+	// result, written by the worker under a sequence lock
+	unsigned int sequence;
+	unsigned int seen;		// sampler: last sequence annotated
+	struct record_harmonics result;
+};
+
+static struct channel_harmonics channels[HARMONICS_MAX_CHANNELS];
+static struct fft_tables tables[7];	// one per block size, 16 to 1024
+static int num_tables = 0;
+
+// worker scratch space, only touched by whoever runs harmonics_analyse()
+static float spectrum[HARMONICS_MAX_BLOCK + 2];
+
+static pthread_t worker;
+static sem_t pending;
+static volatile int running = 0;
+static unsigned long long dropped = 0;
+
+int harmonics_configure(int channel, const struct harmonics_config *config) {
+	struct channel_harmonics *state;
+	struct fft_tables *fft;
+
+	if (running || channel < 0 || channel >= HARMONICS_MAX_CHANNELS ||
+	    config->block < HARMONICS_MIN_BLOCK || config->block > HARMONICS_MAX_BLOCK ||
+	    (config->block & (config->block - 1)) != 0) {
+		return -1;
+	}
+
+	fft = tables_for(config->block);
+	if (fft == NULL) {
+		return -1;
+	}
+
+	state = &channels[channel];
+	state->tables = fft;
+
+	state->config = *config;
+	if (state->config.harmonics < 1 || state->config.harmonics > HARMONICS_MAX_ORDER) {
+		state->config.harmonics = HARMONICS_MAX_ORDER;
+	}
+	state->count = 0;
+	return 0;
+}
+
+int harmonics_start() {
+	if (running) {
+		return 0;
+	}
+
+	if (sem_init(&pending, 0, 0) < 0) {
+		perror("sem_init() failed for harmonics.");
+		return -1;
+	}
+	running = 1;
+	if (pthread_create(&worker, NULL, harmonics_worker, NULL) != 0) {
+		fprintf(stderr, "Failed to start the harmonics worker.\n");
+		running = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void harmonics_stop() {
+	if (!running) {
+		return;
+	}
+
+	running = 0;
+	sem_post(&pending);
+	pthread_join(worker, NULL);
+	sem_destroy(&pending);
+}
+
+// Sampler thread: adds a converted value to the channel block
+void harmonics_push(const struct sample *sample, int value) {
+	struct channel_harmonics *state;
+	long long now_ns;
+
+	if (!running || sample->channel < 0 || sample->channel >= HARMONICS_MAX_CHANNELS) {
+		return;
+	}
+
+	state = &channels[sample->channel];
+	if (state->config.block == 0) {
+		return;
+	}
+
+	now_ns = sample->taken.tv_sec * 1000000000LL + sample->taken.tv_nsec;
+	if (state->count == 0) {
+		state->first_ns = now_ns;
+	}
+	state->last_ns = now_ns;
+	state->buffers[state->filling][state->count++] = value;
+	if (state->count < state->config.block) {
+		return;
+	}
+
+	state->count = 0;
+	if (__atomic_load_n(&state->ready, __ATOMIC_ACQUIRE)) {
+		__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);	// worker still busy
+		return;
+	}
+
+	state->ready_rate = (state->config.block - 1) * 1e9 / (state->last_ns - state->first_ns);
+	state->ready_buffer = state->filling;
+	state->filling ^= 1;
+	__atomic_store_n(&state->ready, 1, __ATOMIC_RELEASE);
+	sem_post(&pending);
+}
+
+// Sampler thread: attaches a result the record's channel has not shown yet
+void harmonics_annotate(int channel, struct record *record) {
+	struct channel_harmonics *state;
+	unsigned int before, after;
+
+	if (channel < 0 || channel >= HARMONICS_MAX_CHANNELS) {
+		return;
+	}
+
+	state = &channels[channel];
+	before = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+	if (before == state->seen || (before & 1)) {
+		return;
+	}
+
+	record->harmonics = state->result;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	after = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+	if (before != after) {
+		return;		// torn, the next record picks it up
+	}
+
+	state->seen = before;
+	record->flags |= RECORD_HAS_HARMONICS;
+}
+
+unsigned long long harmonics_dropped() {
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+void harmonics_analyse(int channel, float *block, double sample_rate, struct record_harmonics *result) {
+	const struct channel_harmonics *state = &channels[channel];
+	const struct fft_tables *fft = state->tables;
+	double scale, fundamental, distortion, energy, offset, ratio;
+	int bins = fft->block / 2;
+	int bin, peak, order, harmonic;
+
+	real_fft(fft, block, spectrum);
+
+	// Fundamental: configured frequency or the strongest bin above DC
+	if (state->config.fundamental_hz > 0) {
+		peak = lround(state->config.fundamental_hz * fft->block / sample_rate);
+	} else {
+		peak = 1;
+		for (bin = 2; bin < bins; bin++) {
+			if (bin_energy(spectrum, bin) > bin_energy(spectrum, peak)) {
+				peak = bin;
+			}
+		}
+	}
+	if (peak < 1 || peak >= bins) {
+		peak = 1;
+	}
+
+	// Fractional position of the fundamental from the larger neighbour
+	// (Hann window interpolation), harmonics are looked for at multiples
+	// of it rather than of the whole bin
+	offset = 0;
+	if (bin_energy(spectrum, peak) > 0) {
+		if (bin_energy(spectrum, peak + 1) > bin_energy(spectrum, peak - 1)) {
+			ratio = sqrt(bin_energy(spectrum, peak + 1) / bin_energy(spectrum, peak));
+			offset = (2 * ratio - 1) / (ratio + 1);
+		} else {
+			ratio = sqrt(bin_energy(spectrum, peak - 1) / bin_energy(spectrum, peak));
+			offset = -(2 * ratio - 1) / (ratio + 1);
+		}
+		if (offset < -0.5 || offset > 0.5) {
+			offset = 0;
+		}
+	}
+
+	scale = HANN_AMPLITUDE_SCALE / fft->block;
+	fundamental = sqrt(band_energy(spectrum, peak, bins)) * scale;
+	distortion = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->fundamental_mhz = llround((peak + offset) * sample_rate / fft->block * 1000);
+	for (order = 1; order <= state->config.harmonics; order++) {
+		harmonic = lround(order * (peak + offset));
+		if (harmonic >= bins) {
+			break;
+		}
+		energy = band_energy(spectrum, harmonic, bins);
+		result->amplitude[order - 1] = lround(sqrt(energy) * scale);
+		result->count = order;
+		if (order > 1) {
+			distortion += energy;
+		}
+	}
+	result->thd = (fundamental > 0) ? lround(sqrt(distortion) * scale / fundamental * 1000) : 0;
+}
+
+static void *harmonics_worker(void *arg) {
+	struct channel_harmonics *state;
+	struct record_harmonics result;
+	int channel;
+
+	while (1) {
+		sem_wait(&pending);
+		if (!running) {
+			break;
+		}
+
+		for (channel = 0; channel < HARMONICS_MAX_CHANNELS; channel++) {
+			state = &channels[channel];
+			if (!__atomic_load_n(&state->ready, __ATOMIC_ACQUIRE)) {
+				continue;
+			}
+
+			harmonics_analyse(channel, state->buffers[state->ready_buffer], state->ready_rate, &result);
+			__atomic_store_n(&state->ready, 0, __ATOMIC_RELEASE);
+
+			__atomic_add_fetch(&state->sequence, 1, __ATOMIC_ACQ_REL);
+			state->result = result;
+			__atomic_add_fetch(&state->sequence, 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	return NULL;
+}
+
+static struct fft_tables *tables_for(int block) {
+	struct fft_tables *fft;
+	int bits, i, j;
+
+	for (i = 0; i < num_tables; i++) {
+		if (tables[i].block == block) {
+			return &tables[i];
+		}
+	}
+	if (num_tables == (int)(sizeof(tables) / sizeof(tables[0]))) {
+		return NULL;
+	}
+
+	fft = &tables[num_tables++];
+	fft->block = block;
+	for (i = 0; i < block / 2; i++) {
+		fft->twiddle[2 * i] = cos(2 * M_PI * i / block);
+		fft->twiddle[2 * i + 1] = -sin(2 * M_PI * i / block);
+	}
+	for (i = 0; i < block; i++) {
+		fft->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / block);
+	}
+
+	for (bits = 0; (1 << bits) < block / 2; bits++);
+	for (i = 0; i < block / 2; i++) {
+		for (j = 0, fft->reverse[i] = 0; j < bits; j++) {
+			fft->reverse[i] |= ((i >> j) & 1) << (bits - 1 - j);
+		}
+	}
+
+	return fft;
+}
+
+// Windows data (overwritten) and writes bins 0..block/2 of its spectrum
+// as interleaved re, im into spectrum
+static void real_fft(const struct fft_tables *fft, float *data, float *spectrum) {
+	int n = fft->block / 2;		// complex points
+	float re, im, wr, wi, tr, ti;
+	float er, ei, odr, odi;
+	int size, half, step, start, k, i;
+
+	for (i = 0; i < fft->block; i++) {
+		data[i] *= fft->window[i];
+	}
+
+	// even samples as real, odd as imaginary parts, in bit reversed order
+	for (i = 0; i < n; i++) {
+		spectrum[2 * fft->reverse[i]] = data[2 * i];
+		spectrum[2 * fft->reverse[i] + 1] = data[2 * i + 1];
+	}
+
+	// iterative radix 2, the n point twiddles are every other block one
+	for (size = 2; size <= n; size <<= 1) {
+		half = size / 2;
+		step = fft->block / size;
+		for (start = 0; start < n; start += size) {
+			for (k = 0; k < half; k++) {
+				wr = fft->twiddle[2 * k * step];
+				wi = fft->twiddle[2 * k * step + 1];
+				i = 2 * (start + k + half);
+				tr = wr * spectrum[i] - wi * spectrum[i + 1];
+				ti = wr * spectrum[i + 1] + wi * spectrum[i];
+				re = spectrum[2 * (start + k)];
+				im = spectrum[2 * (start + k) + 1];
+				spectrum[i] = re - tr;
+				spectrum[i + 1] = im - ti;
+				spectrum[2 * (start + k)] = re + tr;
+				spectrum[2 * (start + k) + 1] = im + ti;
+			}
+		}
+	}
+
+	// split: X[k] = E[k] + W^k O[k] with E, O from Z[k] and conj(Z[n - k]),
+	// pairs k and n - k are done together so it works in place
+	spectrum[2 * n] = spectrum[0] - spectrum[1];
+	spectrum[2 * n + 1] = 0;
+	spectrum[0] = spectrum[0] + spectrum[1];
+	spectrum[1] = 0;
+	for (k = 1; k <= n / 2; k++) {
+		re = spectrum[2 * k];
+		im = spectrum[2 * k + 1];
+		tr = spectrum[2 * (n - k)];
+		ti = spectrum[2 * (n - k) + 1];
+
+		er = (re + tr) / 2;
+		ei = (im - ti) / 2;
+		odr = (im + ti) / 2;
+		odi = (tr - re) / 2;
+
+		wr = fft->twiddle[2 * k];
+		wi = fft->twiddle[2 * k + 1];
+		spectrum[2 * k] = er + wr * odr - wi * odi;
+		spectrum[2 * k + 1] = ei + wr * odi + wi * odr;
+
+		// mirrored bin: conj(E) + W^(n-k) conj(O), and W^(n-k) = -conj(W^k)
+		spectrum[2 * (n - k)] = er - wr * odr + wi * odi;
+		spectrum[2 * (n - k) + 1] = -ei + wr * odi + wi * odr;
+	}
+}
+
+static double bin_energy(const float *spectrum, int bin) {
+	return (double)spectrum[2 * bin] * spectrum[2 * bin] + (double)spectrum[2 * bin + 1] * spectrum[2 * bin + 1];
+}
+
+// |X|^2 of bin and both neighbours, the Hann main lobe
+static double band_energy(const float *spectrum, int bin, int bins) {
+	double energy = bin_energy(spectrum, bin);
+
+	if (bin > 0) {
+		energy += bin_energy(spectrum, bin - 1);
+	}
+	if (bin < bins) {
+		energy += bin_energy(spectrum, bin + 1);
+	}
+	return energy;
+}
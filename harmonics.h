@@ -0,0 +1,45 @@
+/*
+file: harmonics.h
+
+Description:
+	Block FFT harmonic analysis for AC channels. The sampler only copies
+	each value into the channel's block; full blocks are handed to a
+	worker thread that windows them, runs a real FFT and works out the
+	fundamental, the first harmonics and the THD. The next record of the
+	channel carries the result.
+
+	The sample rate of a block is measured from its first and last
+	timestamps. The fundamental is the strongest bin unless the config
+	gives its frequency. Channels and block sizes are only read at
+	startup.
+*/
+
+#ifndef HARMONICS_H
+#define HARMONICS_H
+
+#include "record.h"
+#include "sample.h"
+
+#define HARMONICS_MAX_CHANNELS 16
+#define HARMONICS_MAX_BLOCK 1024	// samples, blocks are powers of two
+#define HARMONICS_MIN_BLOCK 16
+#define HARMONICS_MAX_ORDER RECORD_MAX_HARMONICS
+
+struct harmonics_config {
+	int block;			// samples per FFT
+	int harmonics;			// reported, fundamental included
+	double fundamental_hz;		// 0 to search for the strongest bin
+};
+
+int	harmonics_configure(int channel, const struct harmonics_config *config);
+int	harmonics_start();
+void	harmonics_stop();
+void	harmonics_push(const struct sample *sample, int value);
+void	harmonics_annotate(int channel, struct record *record);
+unsigned long long harmonics_dropped();
+
+// Analyses one block of the channel on the calling thread (the worker
+// uses it too), block is overwritten
+void	harmonics_analyse(int channel, float *block, double sample_rate, struct record_harmonics *result);
+
+#endif
@@ -0,0 +1,851 @@
+/*
+file: http.c
+
+Description:
+	Single threaded epoll HTTP/1.1 server with keep-alive and pipelining.
+
+	Responses are immutable, reference counted buffers holding the whole
+	reply (status line, headers and body). The sink worker builds a new
+	buffer for every record and swaps it in under a short lock, the
+	server thread only takes a reference and write()s it, so serving a
+	request never formats anything.
+
+	Server-Sent Events work the same way: each record is serialized once
+	into an event buffer which is handed to the server thread through a
+	ring and an eventfd. Every subscriber gets a reference to the same
+	buffer in its own small queue. A subscriber that is slower than its
+	minimum interval, or whose queue is full, simply skips events; the
+	acquisition side never waits for a client.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "encode.h"
+#include "http.h"
+#include "numfmt.h"
+#include "sinks.h"
+
+#define HTTP_HEADER_SIZE 160
+#define HTTP_MAX_EVENTS 64
+
+struct http_buffer {
+	int refs;
+	int sensor_index;		// events only: which sensor
+	int alarm;			// events only: never decimated
+	long long taken_ns;		// events only: CLOCK_MONOTONIC of the record
+	size_t length;
+	char data[];
+};
+
+struct http_conn {
+	int fd;
+	int close_after;		// close once the pending response is sent
+	int peer_closed;		// close once buffered requests are answered
+	size_t in_length;
+	char in[HTTP_REQUEST_SIZE];
+	struct http_buffer *out;	// response being written, NULL if idle
+	size_t out_offset;
+	struct http_conn *next_free;
+
+	// Server-Sent Events subscriber state
+	int sse;
+	int sse_index;			// position in sse_conns
+	long long min_interval_ns;
+	long long last_sent_ns[SINK_MAX_SENSORS];
+	struct http_buffer *sse_queue[HTTP_SSE_QUEUE_DEPTH];
+	unsigned int sse_head, sse_tail;
+};
+
+// FUNCTION SIGNATURES
+static int	http_sink_open(struct sink *sink);
+static int	http_sink_write(struct sink *sink, const struct record *record);
+static void	http_sink_flush(struct sink *sink);
+static void	http_sink_close(struct sink *sink);
+static void	*http_server(void *arg);
+static int	open_listener(const char *listen_address);
+static void	accept_connections();
+static void	dispatch_events();
+static void	sse_subscribe(struct http_conn *conn, const char *query);
+static void	sse_unsubscribe(struct http_conn *conn);
+static struct http_buffer *build_event(const struct record *record);
+static void	conn_close(struct http_conn *conn);
+static void	release_closed();
+static void	conn_read(struct http_conn *conn);
+static void	conn_process(struct http_conn *conn);
+static int	conn_flush(struct http_conn *conn);
+static struct http_buffer *route_request(struct http_conn *conn, char *request);
+static struct http_buffer *build_response(const char *status, const char *content_type, const void *body, size_t length);
+static struct http_buffer *acquire(struct http_buffer **slot);
+static void	swap_response(struct http_buffer **slot, struct http_buffer *buffer);
+static void	buffer_put(struct http_buffer *buffer);
+static const char *content_type(enum record_encoding encoding);
+
+const struct sink_ops http_sink_ops = {
+	"http", http_sink_open, http_sink_write, http_sink_flush, http_sink_close
+};
+
+static char listen_address[HTTP_LISTEN_SIZE] = HTTP_DEFAULT_LISTEN;
+
+// Latest responses, written by the sink worker, read by the server
+static pthread_mutex_t responses_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct http_buffer *sensor_responses[SINK_MAX_SENSORS];
+static struct http_buffer *all_response;
+
+// Fixed responses, never released
+static struct http_buffer *not_found;
+static struct http_buffer *bad_method;
+static struct http_buffer *too_large;
+static struct http_buffer *sse_start;
+
+// Sink worker side copy of the latest record of every sensor
+static struct record latest[SINK_MAX_SENSORS];
+static int latest_valid[SINK_MAX_SENSORS];
+static int latest_changed = 0;
+
+static struct http_conn connections[HTTP_MAX_CONNECTIONS];
+static struct http_conn *free_connections;
+// Closed during the current epoll batch, which may still hold events for
+// them. They only become free once the batch is done.
+static struct http_conn *closed_connections;
+static int listen_fd = -1;
+static int wake_fd = -1;
+static int epoll_fd = -1;
+static pthread_t server_thread;
+
+// Events handed from the sink worker to the server thread
+static struct http_buffer *event_queue[HTTP_EVENT_QUEUE_DEPTH];
+static unsigned int event_head, event_tail;
+static unsigned long long event_id = 0;
+static int event_fd = -1;
+
+// Server thread only, except sse_count which the sink worker reads
+static struct http_conn *sse_conns[HTTP_MAX_CONNECTIONS];
+static int sse_count = 0;
+static long long sse_min_interval_ns = 0;
+
+int http_configure(const char *listen) {
+	if (listen == NULL || strlen(listen) >= sizeof(listen_address)) {
+		return -1;
+	}
+
+	strcpy(listen_address, listen);
+	return 0;
+}
+
+void http_configure_sse(int min_interval_ms) {
+	sse_min_interval_ns = (min_interval_ms > 0) ? min_interval_ms * 1000000LL : 0;
+}
+
+static int http_sink_open(struct sink *sink) {
+	struct epoll_event event;
+	int i;
+
+	not_found = build_response("404 Not Found", "text/plain", "Not Found\n", 10);
+	bad_method = build_response("405 Method Not Allowed", "text/plain", "Method Not Allowed\n", 19);
+	too_large = build_response("431 Request Header Fields Too Large", "text/plain", "Too Large\n", 10);
+	sse_start = build_response("200 OK", "text/event-stream", "", 0);
+	if (sse_start != NULL) {
+		// an event stream has no length, drop the Content-Length header
+		sse_start->length = stpcpy(strstr(sse_start->data, "Content-Length"), "\r\n") - sse_start->data;
+	}
+
+	free_connections = closed_connections = NULL;
+	for (i = HTTP_MAX_CONNECTIONS - 1; i >= 0; i--) {
+		connections[i].fd = -1;
+		connections[i].next_free = free_connections;
+		free_connections = &connections[i];
+	}
+
+	listen_fd = open_listener(listen_address);
+	if (listen_fd < 0) {
+		return -1;
+	}
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	event_fd = eventfd(0, EFD_NONBLOCK);
+	epoll_fd = epoll_create1(0);
+	if (wake_fd < 0 || event_fd < 0 || epoll_fd < 0) {
+		perror("Failed to set up HTTP event loop.");
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.ptr = &listen_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+	event.data.ptr = &wake_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+	event.data.ptr = &event_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event);
+
+	if (pthread_create(&server_thread, NULL, http_server, NULL) != 0) {
+		fprintf(stderr, "Failed to start HTTP server.\n");
+		return -1;
+	}
+
+#ifdef DEBUG
+	fprintf(stdout, "HTTP server listening on %s\n", listen_address);
+#endif
+	return 0;
+}
+
+// Preformats the response for /sensors/{id}
+static int http_sink_write(struct sink *sink, const struct record *record) {
+	unsigned char body[RECORD_BUFFER_SIZE];
+	struct http_buffer *response, *event;
+	int index = record->sensor_id - 1;
+	unsigned int head;
+	uint64_t one = 1;
+	size_t length;
+
+	if (index < 0 || index >= SINK_MAX_SENSORS) {
+		return -1;
+	}
+
+	// One event buffer per record, shared by every subscriber
+	if (__atomic_load_n(&sse_count, __ATOMIC_RELAXED) > 0) {
+		head = event_head;
+		event = NULL;
+		if (head - __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE) < HTTP_EVENT_QUEUE_DEPTH) {
+			event = build_event(record);
+		}
+		if (event != NULL) {
+			event_queue[head & (HTTP_EVENT_QUEUE_DEPTH - 1)] = event;
+			__atomic_store_n(&event_head, head + 1, __ATOMIC_RELEASE);
+			if (write(event_fd, &one, sizeof(one)) < 0) {
+				// counter saturated, the server is already awake
+			}
+		}
+	}
+
+	length = record_encode(record, body, sink->encoding, 0);
+	response = build_response("200 OK", content_type(sink->encoding), body, length);
+	if (response == NULL) {
+		return -1;
+	}
+	swap_response(&sensor_responses[index], response);
+
+	latest[index] = *record;
+	latest_valid[index] = 1;
+	latest_changed = 1;
+	return 0;
+}
+
+// Preformats the response for /sensors once per drained batch
+static void http_sink_flush(struct sink *sink) {
+	unsigned char body[SINK_MAX_SENSORS * RECORD_BUFFER_SIZE + 16];
+	struct http_buffer *response;
+	unsigned char *out = body;
+	int count = 0;
+	int i;
+
+	if (!latest_changed) {
+		return;
+	}
+	latest_changed = 0;
+
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		count += latest_valid[i];
+	}
+
+	if (sink->encoding == ENCODING_CBOR) {
+		out = cbor_put_array(out, count);
+	} else if (sink->encoding == ENCODING_MSGPACK) {
+		out = mp_put_array(out, count);
+	} else {
+		*out++ = '[';
+	}
+
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		if (!latest_valid[i]) {
+			continue;
+		}
+		if (sink->encoding != ENCODING_JSON) {
+			out += record_to_binary(&latest[i], out, sink->encoding);
+			continue;
+		}
+		if (out != body + 1) {
+			*out++ = ',';
+		}
+		out += record_to_json(&latest[i], (char *)out, 0) - 1;	// drop newline
+	}
+
+	if (sink->encoding == ENCODING_JSON) {
+		out = (unsigned char *)stpcpy((char *)out, "]\n");
+	}
+
+	response = build_response("200 OK", content_type(sink->encoding), body, out - body);
+	if (response != NULL) {
+		swap_response(&all_response, response);
+	}
+}
+
+static void http_sink_close(struct sink *sink) {
+	uint64_t one = 1;
+	int i;
+
+	if (epoll_fd < 0) {
+		return;
+	}
+
+	if (write(wake_fd, &one, sizeof(one)) == sizeof(one)) {
+		pthread_join(server_thread, NULL);
+	}
+
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		if (connections[i].fd >= 0) {
+			conn_close(&connections[i]);
+		}
+	}
+
+	while (event_tail != event_head) {
+		buffer_put(event_queue[event_tail++ & (HTTP_EVENT_QUEUE_DEPTH - 1)]);
+	}
+
+	close(epoll_fd);
+	close(wake_fd);
+	close(event_fd);
+	close(listen_fd);
+	epoll_fd = wake_fd = event_fd = listen_fd = -1;
+}
+
+static void *http_server(void *arg) {
+	struct epoll_event events[HTTP_MAX_EVENTS];
+	struct http_conn *conn;
+	int count, i;
+
+	while (1) {
+		count = epoll_wait(epoll_fd, events, HTTP_MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait() failed.");
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (events[i].data.ptr == &wake_fd) {
+				return NULL;
+			}
+			if (events[i].data.ptr == &listen_fd) {
+				accept_connections();
+				continue;
+			}
+			if (events[i].data.ptr == &event_fd) {
+				dispatch_events();
+				continue;
+			}
+
+			conn = events[i].data.ptr;
+			if (conn->fd < 0) {
+				continue;	// closed earlier in this batch
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				conn_close(conn);
+				continue;
+			}
+			// readable, writable or peer hangup: all continue in conn_read
+			conn_read(conn);
+		}
+
+		release_closed();
+	}
+
+	return NULL;
+}
+
+static int open_listener(const char *address) {
+	struct sockaddr_in inet_address;
+	struct sockaddr_un unix_address;
+	char host[HTTP_LISTEN_SIZE];
+	char *port;
+	int fd, one = 1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		memset(&unix_address, 0, sizeof(unix_address));
+		unix_address.sun_family = AF_UNIX;
+		strncpy(unix_address.sun_path, address + 5, sizeof(unix_address.sun_path) - 1);
+		unlink(unix_address.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&unix_address, sizeof(unix_address)) < 0) {
+			perror("Failed to bind HTTP unix socket.");
+			goto fail;
+		}
+	} else {
+		strcpy(host, address);
+		port = strrchr(host, ':');
+		if (port == NULL) {
+			fprintf(stderr, "HTTP listen address %s has no port.\n", address);
+			return -1;
+		}
+		*port++ = '\0';
+
+		memset(&inet_address, 0, sizeof(inet_address));
+		inet_address.sin_family = AF_INET;
+		inet_address.sin_port = htons(atoi(port));
+		if (inet_pton(AF_INET, host, &inet_address.sin_addr) != 1) {
+			fprintf(stderr, "Bad HTTP listen address %s\n", address);
+			return -1;
+		}
+
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd < 0) {
+			perror("Failed to create HTTP socket.");
+			return -1;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *)&inet_address, sizeof(inet_address)) < 0) {
+			perror("Failed to bind HTTP socket.");
+			goto fail;
+		}
+	}
+
+	if (listen(fd, SOMAXCONN) < 0) {
+		perror("listen() failed.");
+		goto fail;
+	}
+
+	return fd;
+
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+static void accept_connections() {
+	struct epoll_event event;
+	struct http_conn *conn;
+	int fd, one = 1;
+
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		if (free_connections == NULL || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+			close(fd);
+			continue;
+		}
+
+		conn = free_connections;
+		free_connections = conn->next_free;
+		conn->fd = fd;
+		conn->close_after = 0;
+		conn->peer_closed = 0;
+		conn->in_length = 0;
+		conn->out = NULL;
+		conn->out_offset = 0;
+		conn->sse = 0;
+
+		// responses go out in one write, don't let Nagle hold them back
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = conn;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			conn_close(conn);
+		}
+	}
+}
+
+// Fans queued events out to the subscribers that are due one
+static void dispatch_events() {
+	struct http_buffer *event;
+	struct http_conn *conn;
+	uint64_t count;
+	int i;
+
+	if (read(event_fd, &count, sizeof(count)) < 0) {
+		// nothing pending, drain the ring anyway
+	}
+
+	while (event_tail != __atomic_load_n(&event_head, __ATOMIC_ACQUIRE)) {
+		event = event_queue[event_tail & (HTTP_EVENT_QUEUE_DEPTH - 1)];
+
+		for (i = 0; i < sse_count; i++) {
+			conn = sse_conns[i];
+			if (!event->alarm &&
+			    event->taken_ns - conn->last_sent_ns[event->sensor_index] < conn->min_interval_ns) {
+				continue;
+			}
+			if (conn->sse_head - conn->sse_tail == HTTP_SSE_QUEUE_DEPTH) {
+				continue;	// client is behind, it misses this one
+			}
+
+			__atomic_add_fetch(&event->refs, 1, __ATOMIC_RELAXED);
+			conn->sse_queue[conn->sse_head++ % HTTP_SSE_QUEUE_DEPTH] = event;
+			conn->last_sent_ns[event->sensor_index] = event->taken_ns;
+		}
+
+		__atomic_store_n(&event_tail, event_tail + 1, __ATOMIC_RELEASE);
+		buffer_put(event);
+	}
+
+	// Start writing to every idle subscriber, iterate backwards as a
+	// failed write unsubscribes the connection
+	for (i = sse_count - 1; i >= 0; i--) {
+		if (sse_conns[i]->out == NULL) {
+			conn_process(sse_conns[i]);
+		}
+	}
+}
+
+static void sse_subscribe(struct http_conn *conn, const char *query) {
+	const char *interval;
+	long long min_interval_ms = 0;
+
+	if (query != NULL && (interval = strstr(query, "min_interval_ms=")) != NULL) {
+		min_interval_ms = strtol(interval + 16, NULL, 10);
+	}
+
+	conn->sse = 1;
+	conn->sse_head = conn->sse_tail = 0;
+	conn->min_interval_ns = min_interval_ms * 1000000LL;
+	if (conn->min_interval_ns < sse_min_interval_ns) {
+		conn->min_interval_ns = sse_min_interval_ns;
+	}
+	memset(conn->last_sent_ns, 0, sizeof(conn->last_sent_ns));
+
+	conn->sse_index = sse_count;
+	sse_conns[sse_count] = conn;
+	__atomic_store_n(&sse_count, sse_count + 1, __ATOMIC_RELAXED);
+}
+
+static void sse_unsubscribe(struct http_conn *conn) {
+	int last = sse_count - 1;
+
+	while (conn->sse_tail != conn->sse_head) {
+		buffer_put(conn->sse_queue[conn->sse_tail++ % HTTP_SSE_QUEUE_DEPTH]);
+	}
+
+	sse_conns[conn->sse_index] = sse_conns[last];
+	sse_conns[conn->sse_index]->sse_index = conn->sse_index;
+	__atomic_store_n(&sse_count, last, __ATOMIC_RELAXED);
+	conn->sse = 0;
+}
+
+static void conn_close(struct http_conn *conn) {
+	if (conn->fd < 0) {
+		return;
+	}
+
+	if (conn->sse) {
+		sse_unsubscribe(conn);
+	}
+	close(conn->fd);
+	conn->fd = -1;
+	if (conn->out != NULL) {
+		buffer_put(conn->out);
+		conn->out = NULL;
+	}
+	conn->next_free = closed_connections;
+	closed_connections = conn;
+}
+
+// Called between epoll batches, when no stale event can name them anymore
+static void release_closed() {
+	struct http_conn *conn;
+
+	while (closed_connections != NULL) {
+		conn = closed_connections;
+		closed_connections = conn->next_free;
+		conn->next_free = free_connections;
+		free_connections = conn;
+	}
+}
+
+// Edge triggered: keep reading and answering until the socket is drained
+// or a response is waiting for room to be written.
+static void conn_read(struct http_conn *conn) {
+	ssize_t count;
+	int drained;
+
+	do {
+		drained = 1;
+		while (!conn->peer_closed && conn->in_length < sizeof(conn->in) - 1) {
+			count = read(conn->fd, conn->in + conn->in_length, sizeof(conn->in) - 1 - conn->in_length);
+			if (count > 0) {
+				conn->in_length += count;
+			} else if (count < 0 && errno == EINTR) {
+				continue;
+			} else {
+				if (count == 0 || errno != EAGAIN) {
+					// peer is gone, still answer what it already sent
+					conn->peer_closed = 1;
+				}
+				break;
+			}
+		}
+		if (conn->in_length == sizeof(conn->in) - 1) {
+			drained = 0;
+		}
+
+		conn_process(conn);
+	} while (!drained && conn->fd >= 0 && conn->out == NULL);
+}
+
+// Sends the pending response, then answers buffered requests one at a
+// time until a write would block or the input holds no full request.
+static void conn_process(struct http_conn *conn) {
+	char *end;
+	size_t request_length;
+
+	while (1) {
+		if (conn->sse) {
+			// subscribers only listen, whatever they send is ignored
+			conn->in_length = 0;
+			if (conn->peer_closed) {
+				conn_close(conn);
+			} else if (conn->out != NULL || conn->sse_tail != conn->sse_head) {
+				conn_flush(conn);
+			}
+			return;
+		}
+
+		if (conn->out != NULL) {
+			if (conn_flush(conn) != 0) {
+				return;
+			}
+			if (conn->close_after) {
+				conn_close(conn);
+				return;
+			}
+		}
+
+		conn->in[conn->in_length] = '\0';
+		end = strstr(conn->in, "\r\n\r\n");
+		if (end == NULL) {
+			if (conn->in_length == sizeof(conn->in) - 1) {
+				__atomic_add_fetch(&too_large->refs, 1, __ATOMIC_RELAXED);
+				conn->out = too_large;
+				conn->out_offset = 0;
+				conn->close_after = 1;
+				continue;
+			}
+			if (conn->peer_closed) {
+				conn_close(conn);
+			}
+			return;
+		}
+
+		*end = '\0';
+		request_length = end + 4 - conn->in;
+		conn->out = route_request(conn, conn->in);
+		conn->out_offset = 0;
+
+		memmove(conn->in, conn->in + request_length, conn->in_length - request_length);
+		conn->in_length -= request_length;
+	}
+}
+
+// Returns 0 once everything pending is sent, 1 if the socket is full and
+// -1 if the connection had to be closed.
+static int conn_flush(struct http_conn *conn) {
+	ssize_t count;
+
+	while (1) {
+		// subscribers move on to their next queued event
+		if (conn->out == NULL) {
+			if (!conn->sse || conn->sse_tail == conn->sse_head) {
+				return 0;
+			}
+			conn->out = conn->sse_queue[conn->sse_tail++ % HTTP_SSE_QUEUE_DEPTH];
+			conn->out_offset = 0;
+		}
+
+		while (conn->out_offset < conn->out->length) {
+			count = send(conn->fd, conn->out->data + conn->out_offset,
+				conn->out->length - conn->out_offset, MSG_NOSIGNAL);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN) {
+					// EPOLLOUT calls back in once there is room
+					return 1;
+				}
+				conn_close(conn);
+				return -1;
+			}
+			conn->out_offset += count;
+		}
+
+		buffer_put(conn->out);
+		conn->out = NULL;
+	}
+}
+
+// Picks the response for request (its header block, NUL terminated)
+static struct http_buffer *route_request(struct http_conn *conn, char *request) {
+	struct http_buffer *response = NULL;
+	char *header, *next, *value, *path, *path_end;
+	long id;
+
+	// Split off the request line, the headers follow it
+	header = strstr(request, "\r\n");
+	if (header != NULL) {
+		*header = '\0';
+		header += 2;
+	}
+
+	// HTTP/1.0 closes unless asked otherwise, 1.1 keeps alive unless asked
+	if (strstr(request, "HTTP/1.0") != NULL) {
+		conn->close_after = 1;
+	}
+	for (; header != NULL; header = next) {
+		next = strstr(header, "\r\n");
+		if (next != NULL) {
+			*next = '\0';
+			next += 2;
+		}
+		if (strncasecmp(header, "Connection:", 11) != 0) {
+			continue;
+		}
+		value = header + 11 + strspn(header + 11, " \t");
+		if (strncasecmp(value, "close", 5) == 0) {
+			conn->close_after = 1;
+		} else if (strncasecmp(value, "keep-alive", 10) == 0) {
+			conn->close_after = 0;
+		}
+	}
+
+	if (strncmp(request, "GET ", 4) != 0) {
+		response = bad_method;
+	} else {
+		path = request + 4;
+		path_end = path + strcspn(path, " ?");
+
+		if (path_end - path == 7 && strncmp(path, "/events", 7) == 0 && sse_start != NULL) {
+			sse_subscribe(conn, (*path_end == '?') ? path_end : NULL);
+			conn->close_after = 0;
+			__atomic_add_fetch(&sse_start->refs, 1, __ATOMIC_RELAXED);
+			return sse_start;
+		}
+
+		if (path_end - path >= 8 && strncmp(path, "/sensors", 8) == 0) {
+			if (path_end - path <= 9) {
+				// "/sensors" or "/sensors/"
+				response = acquire(&all_response);
+			} else if (path[8] == '/') {
+				id = strtol(path + 9, &next, 10);
+				if (next == path_end && id >= 1 && id <= SINK_MAX_SENSORS) {
+					response = acquire(&sensor_responses[id - 1]);
+				}
+			}
+			if (response != NULL) {
+				return response;
+			}
+		}
+	}
+
+	if (response == NULL) {
+		response = not_found;
+	}
+	__atomic_add_fetch(&response->refs, 1, __ATOMIC_RELAXED);
+	return response;
+}
+
+static struct http_buffer *build_response(const char *status, const char *content_type, const void *body, size_t length) {
+	struct http_buffer *buffer;
+	char *out;
+
+	buffer = malloc(sizeof(*buffer) + HTTP_HEADER_SIZE + length);
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	out = stpcpy(buffer->data, "HTTP/1.1 ");
+	out = stpcpy(out, status);
+	out = stpcpy(out, "\r\nContent-Type: ");
+	out = stpcpy(out, content_type);
+	out = stpcpy(out, "\r\nCache-Control: no-cache\r\nContent-Length: ");
+	out += fmt_u32(out, length);
+	out = stpcpy(out, "\r\n\r\n");
+	memcpy(out, body, length);
+
+	buffer->refs = 1;
+	buffer->length = out + length - buffer->data;
+	return buffer;
+}
+
+// Takes a reference to the current response in slot (or NULL)
+static struct http_buffer *acquire(struct http_buffer **slot) {
+	struct http_buffer *buffer;
+
+	pthread_mutex_lock(&responses_lock);
+	buffer = *slot;
+	if (buffer != NULL) {
+		__atomic_add_fetch(&buffer->refs, 1, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&responses_lock);
+
+	return buffer;
+}
+
+// Publishes buffer in slot and drops the slot's reference to the old one
+static void swap_response(struct http_buffer **slot, struct http_buffer *buffer) {
+	struct http_buffer *old;
+
+	pthread_mutex_lock(&responses_lock);
+	old = *slot;
+	*slot = buffer;
+	pthread_mutex_unlock(&responses_lock);
+
+	if (old != NULL) {
+		buffer_put(old);
+	}
+}
+
+// "id: N\nevent: sensor|alarm\ndata: {json}\n\n", always JSON as SSE is text
+static struct http_buffer *build_event(const struct record *record) {
+	struct http_buffer *buffer;
+	char *out;
+
+	buffer = malloc(sizeof(*buffer) + RECORD_BUFFER_SIZE + 64);
+	if (buffer == NULL) {
+		return NULL;
+	}
+
+	out = stpcpy(buffer->data, "id: ");
+	out += fmt_u64(out, ++event_id);
+	out = stpcpy(out, (record->flags & RECORD_HAS_ALARM) ? "\nevent: alarm\ndata: " : "\nevent: sensor\ndata: ");
+	out += record_to_json(record, out, 0);
+	*out++ = '\n';
+
+	buffer->refs = 1;
+	buffer->sensor_index = record->sensor_id - 1;
+	buffer->alarm = (record->flags & RECORD_HAS_ALARM) != 0;
+	buffer->taken_ns = record->taken.tv_sec * 1000000000LL + record->taken.tv_nsec;
+	buffer->length = out - buffer->data;
+	return buffer;
+}
+
+static void buffer_put(struct http_buffer *buffer) {
+	if (__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(buffer);
+	}
+}
+
+static const char *content_type(enum record_encoding encoding) {
+	switch (encoding) {
+		case ENCODING_CBOR:
+			return "application/cbor";
+		case ENCODING_MSGPACK:
+			return "application/msgpack";
+		default:
+			return "application/json";
+	}
+}
@@ -0,0 +1,37 @@
+/*
+file: http.h
+
+Description:
+	Minimal HTTP/1.1 endpoint serving the latest sensor values straight
+	from memory:
+
+		GET /sensors		every sensor
+		GET /sensors/{id}	one sensor
+		GET /events		Server-Sent Events stream of every record,
+					?min_interval_ms=N decimates it per sensor,
+					alarm events are always sent
+
+	It is registered as an output sink, the sink worker preformats the
+	complete responses and a single epoll thread serves them.
+*/
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include "output.h"
+
+#define HTTP_DEFAULT_LISTEN "127.0.0.1:8080"
+#define HTTP_MAX_CONNECTIONS 256
+#define HTTP_REQUEST_SIZE 2048
+#define HTTP_LISTEN_SIZE 108		// "unix:" plus a sun_path
+#define HTTP_EVENT_QUEUE_DEPTH 256	// sink worker -> server, power of two
+#define HTTP_SSE_QUEUE_DEPTH 16		// events buffered per SSE client
+
+extern const struct sink_ops http_sink_ops;
+
+// listen is "host:port" for TCP or "unix:/path/to/socket"
+int	http_configure(const char *listen);
+// lower bound for the per client min_interval_ms of /events
+void	http_configure_sse(int min_interval_ms);
+
+#endif
@@ -0,0 +1,227 @@
+/*
+file: metrics.c
+
+Description:
+	Sliding window sums for the derived metrics in metrics.h. The sums are
+	integers, so adding and evicting samples never drifts no matter how
+	long the daemon runs. Power is kept in uW and energy as whole mWh
+	plus a uW*ns remainder.
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "numfmt.h"
+#include "sinks.h"
+
+#define UWNS_PER_MWH 3600000000000000LL	// 1000 uW * 3600 s * 1e9 ns
+
+// FUNCTION SIGNATURES
+static int	energy_sink_write(struct sink *sink, const struct record *record);
+static void	energy_sink_flush(struct sink *sink);
+static void	energy_sink_close(struct sink *sink);
+static void	write_checkpoint();
+
+struct window_sample {
+	long long taken_ns;
+	int value;
+};
+
+struct channel_metrics {
+	long long window_ns;		// 0 when disabled
+	long long voltage_mv;
+	struct window_sample window[METRICS_WINDOW_SAMPLES];
+	unsigned int head, tail;
+	long long sum;
+	long long sum_squares;
+
+	long long last_ns;
+	long long last_power_uw;
+	long long energy_mwh;
+	long long energy_remainder;	// uW*ns below one mWh
+};
+
+// Latest energy per sensor as seen by the checkpoint sink
+struct energy_state {
+	long long energy_mwh[SINK_MAX_SENSORS];
+	int valid[SINK_MAX_SENSORS];
+	int dirty;
+	struct timespec last_write;
+};
+
+const struct sink_ops energy_sink_ops = {
+	"energy", NULL, energy_sink_write, energy_sink_flush, energy_sink_close
+};
+
+static struct channel_metrics channels[METRICS_MAX_CHANNELS];
+static struct energy_state energy;
+static int checkpoint_sec = METRICS_CHECKPOINT_SEC;
+
+// Changing the window restarts it, the energy counter is kept
+void metrics_configure(int channel, int window_ms, double voltage) {
+	struct channel_metrics *metrics;
+	long long window_ns = window_ms > 0 ? window_ms * 1000000LL : 0;
+
+	if (channel < 0 || channel >= METRICS_MAX_CHANNELS) {
+		return;
+	}
+
+	metrics = &channels[channel];
+	if (metrics->window_ns != window_ns) {
+		metrics->head = metrics->tail = 0;
+		metrics->sum = metrics->sum_squares = 0;
+		metrics->last_ns = 0;
+	}
+	metrics->window_ns = window_ns;
+	metrics->voltage_mv = llround(voltage * 1000);
+}
+
+void metrics_set_checkpoint(int seconds) {
+	__atomic_store_n(&checkpoint_sec, seconds > 0 ? seconds : METRICS_CHECKPOINT_SEC, __ATOMIC_RELAXED);
+}
+
+// Loads the energy counters saved by a previous run, lines of
+// "<sensor_id> <energy_mwh>". Must run before the sampler starts.
+int metrics_restore(const char *path) {
+	long long energy_mwh;
+	int sensor_id;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	while (fscanf(file, "%d %lld", &sensor_id, &energy_mwh) == 2) {
+		if (sensor_id < 1 || sensor_id > METRICS_MAX_CHANNELS) {
+			continue;
+		}
+		channels[sensor_id - 1].energy_mwh = energy_mwh;
+		energy.energy_mwh[sensor_id - 1] = energy_mwh;
+		energy.valid[sensor_id - 1] = 1;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+// Adds the record's value to the channel window and fills its metrics
+void metrics_update(int channel, struct record *record) {
+	struct channel_metrics *metrics;
+	struct window_sample *oldest;
+	long long now_ns, dt_ns, power_uw, count;
+
+	if (channel < 0 || channel >= METRICS_MAX_CHANNELS || channels[channel].window_ns == 0) {
+		return;
+	}
+
+	metrics = &channels[channel];
+	now_ns = record->taken.tv_sec * 1000000000LL + record->taken.tv_nsec;
+
+	// Evict what fell out of the window, or the oldest if the ring is full
+	while (metrics->tail != metrics->head) {
+		oldest = &metrics->window[metrics->tail & (METRICS_WINDOW_SAMPLES - 1)];
+		if (now_ns - oldest->taken_ns < metrics->window_ns &&
+		    metrics->head - metrics->tail < METRICS_WINDOW_SAMPLES) {
+			break;
+		}
+		metrics->sum -= oldest->value;
+		metrics->sum_squares -= (long long)oldest->value * oldest->value;
+		metrics->tail++;
+	}
+
+	metrics->window[metrics->head & (METRICS_WINDOW_SAMPLES - 1)].taken_ns = now_ns;
+	metrics->window[metrics->head & (METRICS_WINDOW_SAMPLES - 1)].value = record->value;
+	metrics->head++;
+	metrics->sum += record->value;
+	metrics->sum_squares += (long long)record->value * record->value;
+
+	// Trapezoidal energy integration between consecutive samples
+	power_uw = record->value * metrics->voltage_mv;
+	dt_ns = now_ns - metrics->last_ns;
+	if (metrics->last_ns != 0 && dt_ns > 0 && dt_ns <= METRICS_MAX_GAP_NS) {
+		metrics->energy_remainder += (metrics->last_power_uw + power_uw) * dt_ns / 2;
+		if (metrics->energy_remainder >= UWNS_PER_MWH || metrics->energy_remainder <= -UWNS_PER_MWH) {
+			metrics->energy_mwh += metrics->energy_remainder / UWNS_PER_MWH;
+			metrics->energy_remainder %= UWNS_PER_MWH;
+		}
+	}
+	metrics->last_ns = now_ns;
+	metrics->last_power_uw = power_uw;
+
+	count = metrics->head - metrics->tail;
+	record->flags |= RECORD_HAS_METRICS;
+	record->rms = (int)sqrt((double)metrics->sum_squares / count);
+	record->power_mw = metrics->sum * metrics->voltage_mv / count / 1000;
+	record->energy_mwh = metrics->energy_mwh;
+}
+
+static int energy_sink_write(struct sink *sink, const struct record *record) {
+	int index = record->sensor_id - 1;
+
+	if (!(record->flags & RECORD_HAS_METRICS) || index < 0 || index >= SINK_MAX_SENSORS) {
+		return 0;
+	}
+
+	if (energy.energy_mwh[index] != record->energy_mwh || !energy.valid[index]) {
+		energy.energy_mwh[index] = record->energy_mwh;
+		energy.valid[index] = 1;
+		energy.dirty = 1;
+	}
+	return 0;
+}
+
+static void energy_sink_flush(struct sink *sink) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!energy.dirty ||
+	    now.tv_sec - energy.last_write.tv_sec < __atomic_load_n(&checkpoint_sec, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	write_checkpoint();
+	energy.last_write = now;
+}
+
+static void energy_sink_close(struct sink *sink) {
+	if (energy.dirty) {
+		write_checkpoint();
+	}
+}
+
+// Same tmp file + rename() scheme as the other file sinks
+static void write_checkpoint() {
+	char buffer[SINK_MAX_SENSORS * (2 * NUMFMT_MAX_LENGTH + 2)];
+	char *out = buffer;
+	size_t written;
+	FILE *file;
+	int i;
+
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		if (!energy.valid[i]) {
+			continue;
+		}
+		out += fmt_i32(out, i + 1);
+		*out++ = ' ';
+		out += fmt_i64(out, energy.energy_mwh[i]);
+		*out++ = '\n';
+	}
+
+	file = fopen(ENERGY_CHECKPOINT "~", "w");
+	if (file == NULL) {
+		perror("Can't write energy checkpoint");
+		return;
+	}
+	written = fwrite(buffer, 1, out - buffer, file);
+	if (fclose(file) != 0 || written != (size_t)(out - buffer) ||
+	    rename(ENERGY_CHECKPOINT "~", ENERGY_CHECKPOINT) < 0) {
+		perror("Can't write energy checkpoint");
+		return;
+	}
+
+	energy.dirty = 0;
+}
@@ -0,0 +1,35 @@
+/*
+file: metrics.h
+
+Description:
+	Streaming derived metrics per channel: RMS of the value and average
+	power over a sliding time window plus an energy counter. Every update
+	is O(1) (amortized over window evictions) and fills the optional
+	metrics fields of the record being published.
+
+	Energy is checkpointed to ENERGY_CHECKPOINT by energy_sink_ops, which
+	runs on its own output worker so the sampler never touches the disk,
+	and restored on the next start.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "output.h"
+
+#define METRICS_MAX_CHANNELS 16
+#define METRICS_WINDOW_SAMPLES 2048	// per channel, must be a power of two
+#define METRICS_MAX_GAP_NS 100000000LL	// longer gaps are not integrated
+#define METRICS_CHECKPOINT_SEC 60
+#define ENERGY_CHECKPOINT "./energy.checkpoint"
+
+extern const struct sink_ops energy_sink_ops;
+
+// window_ms 0 disables metrics for the channel. Power is value * voltage,
+// so a channel in mA with voltage in V gives mW.
+void	metrics_configure(int channel, int window_ms, double voltage);
+void	metrics_set_checkpoint(int seconds);
+int	metrics_restore(const char *path);
+void	metrics_update(int channel, struct record *record);
+
+#endif
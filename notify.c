@@ -0,0 +1,190 @@
+/*
+file: notify.c
+
+Description:
+	Shared memory sequence words with futex wake ups, see notify.h.
+	Publishing is an atomic increment; the FUTEX_WAKE system call is only
+	made while some reader is actually waiting, so the daemon pays
+	nothing when nobody listens and readers use no CPU between updates.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "notify.h"
+
+// FUNCTION SIGNATURES
+static uint32_t	*sequence_word(struct notify_page *page, int sensor_id);
+static long	futex(uint32_t *word, int op, uint32_t value, const struct timespec *timeout);
+
+static struct notify_page *published = NULL;
+
+// Creates (or reuses) the shared page, the daemon runs fine without it
+int notify_open() {
+	int fd;
+
+	fd = shm_open(NOTIFY_SHM_NAME, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("Can't open notify page");
+		return -1;
+	}
+	if (ftruncate(fd, sizeof(struct notify_page)) < 0) {
+		perror("Can't size notify page");
+		close(fd);
+		return -1;
+	}
+
+	published = mmap(NULL, sizeof(struct notify_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (published == MAP_FAILED) {
+		perror("Can't map notify page");
+		published = NULL;
+		return -1;
+	}
+
+	__atomic_store_n(&published->version, NOTIFY_VERSION, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// Called from the sink workers once a file has been replaced. sensor_id 0
+// only bumps the global word (e.g. the snapshot file).
+void notify_publish(int sensor_id) {
+	if (published == NULL) {
+		return;
+	}
+
+	if (sensor_id > 0 && sensor_id <= SINK_MAX_SENSORS) {
+		__atomic_add_fetch(&published->sensor_sequence[sensor_id - 1], 1, __ATOMIC_RELEASE);
+	}
+	__atomic_add_fetch(&published->sequence, 1, __ATOMIC_RELEASE);
+
+	// Pairs with the waiters increment in notify_wait(): either the reader
+	// sees the new sequence or this sees the reader, never neither
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	// Waiters sleep on either word, wake both
+	if (__atomic_load_n(&published->waiters, __ATOMIC_RELAXED) > 0) {
+		futex(&published->sequence, FUTEX_WAKE, INT_MAX, NULL);
+		if (sensor_id > 0 && sensor_id <= SINK_MAX_SENSORS) {
+			futex(&published->sensor_sequence[sensor_id - 1], FUTEX_WAKE, INT_MAX, NULL);
+		}
+	}
+}
+
+// Marks the page dead, wakes every reader on every word and removes the
+// name. Waiting readers return -1 and attach again to the next page.
+void notify_close() {
+	int i;
+
+	if (published == NULL) {
+		return;
+	}
+
+	__atomic_store_n(&published->version, NOTIFY_CLOSED, __ATOMIC_SEQ_CST);
+	// A reader about to sleep sees the word change and rechecks the version
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		__atomic_add_fetch(&published->sensor_sequence[i], 1, __ATOMIC_SEQ_CST);
+		futex(&published->sensor_sequence[i], FUTEX_WAKE, INT_MAX, NULL);
+	}
+	__atomic_add_fetch(&published->sequence, 1, __ATOMIC_SEQ_CST);
+	futex(&published->sequence, FUTEX_WAKE, INT_MAX, NULL);
+
+	munmap(published, sizeof(struct notify_page));
+	shm_unlink(NOTIFY_SHM_NAME);
+	published = NULL;
+}
+
+struct notify_page *notify_attach() {
+	struct notify_page *page;
+	int fd;
+
+	fd = shm_open(NOTIFY_SHM_NAME, O_RDWR, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	// Readers need write access for the waiters count
+	page = mmap(NULL, sizeof(struct notify_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		return NULL;
+	}
+	if (__atomic_load_n(&page->version, __ATOMIC_ACQUIRE) != NOTIFY_VERSION) {
+		munmap(page, sizeof(struct notify_page));
+		return NULL;
+	}
+
+	return page;
+}
+
+void notify_detach(struct notify_page *page) {
+	if (page != NULL) {
+		munmap(page, sizeof(struct notify_page));
+	}
+}
+
+uint32_t notify_sequence(struct notify_page *page, int sensor_id) {
+	uint32_t *word = sequence_word(page, sensor_id);
+
+	return (word == NULL) ? 0 : __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+// Blocks until the sequence differs from *seen, then updates it. Returns 0
+// on an update, 1 on timeout (timeout_ms < 0 waits forever) and -1 on error
+// or once the daemon closed the page.
+int notify_wait(struct notify_page *page, int sensor_id, uint32_t *seen, int timeout_ms) {
+	uint32_t *word = sequence_word(page, sensor_id);
+	struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	uint32_t current;
+	int result = 0;
+
+	if (word == NULL) {
+		return -1;
+	}
+
+	__atomic_add_fetch(&page->waiters, 1, __ATOMIC_SEQ_CST);
+	while ((current = __atomic_load_n(word, __ATOMIC_SEQ_CST)) == *seen) {
+		if (__atomic_load_n(&page->version, __ATOMIC_ACQUIRE) != NOTIFY_VERSION) {
+			result = -1;
+			break;
+		}
+		// FUTEX_WAIT rechecks the word, a publish in between is not lost
+		if (futex(word, FUTEX_WAIT, current, (timeout_ms < 0) ? NULL : &timeout) < 0) {
+			if (errno == ETIMEDOUT) {
+				result = 1;
+				break;
+			}
+			if (errno != EAGAIN && errno != EINTR) {
+				result = -1;
+				break;
+			}
+		}
+	}
+	__atomic_sub_fetch(&page->waiters, 1, __ATOMIC_SEQ_CST);
+	if (result == 0 && __atomic_load_n(&page->version, __ATOMIC_ACQUIRE) != NOTIFY_VERSION) {
+		result = -1;	// woken by notify_close()
+	}
+
+	*seen = current;
+	return result;
+}
+
+static uint32_t *sequence_word(struct notify_page *page, int sensor_id) {
+	if (page == NULL || sensor_id < 0 || sensor_id > SINK_MAX_SENSORS) {
+		return NULL;
+	}
+
+	return (sensor_id == 0) ? &page->sequence : &page->sensor_sequence[sensor_id - 1];
+}
+
+// Not FUTEX_PRIVATE_FLAG, the words are shared between processes
+static long futex(uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+	return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
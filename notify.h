@@ -0,0 +1,49 @@
+/*
+file: notify.h
+
+Description:
+	Change notification for readers of the output files. The daemon
+	keeps a small page in POSIX shared memory whose sequence words are
+	bumped after every published file. Readers map the page and sleep
+	on the word with a futex instead of polling the files:
+
+		struct notify_page *page = notify_attach();
+		uint32_t seen = notify_sequence(page, 0);
+		while (notify_wait(page, 0, &seen, -1) >= 0) {
+			// read sensors / sensor_N files
+		}
+
+	notify_wait() returns -1 once the daemon has closed the page; the
+	reader then calls notify_detach() and notify_attach() again.
+*/
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include <stdint.h>
+
+#include "sinks.h"
+
+#define NOTIFY_SHM_NAME "/sensor-json"
+#define NOTIFY_VERSION 1
+#define NOTIFY_CLOSED 0			// version of a page the daemon has left
+
+struct notify_page {
+	uint32_t version;
+	uint32_t waiters;			// readers inside notify_wait()
+	uint32_t sequence;			// bumped on every update
+	uint32_t sensor_sequence[SINK_MAX_SENSORS];	// bumped per sensor_N file
+};
+
+// daemon side
+int	notify_open();
+void	notify_publish(int sensor_id);
+void	notify_close();
+
+// reader side, sensor_id 0 is "any update"
+struct notify_page *notify_attach();
+void	notify_detach(struct notify_page *page);
+uint32_t notify_sequence(struct notify_page *page, int sensor_id);
+int	notify_wait(struct notify_page *page, int sensor_id, uint32_t *seen, int timeout_ms);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+file: numfmt.c
+
+Description:
+	Digit-pair table based integer formatting. The number of digits is
+	worked out up front from the bit length, then the value is written
+	backwards two digits per division so a typical ADC reading (3-4
+	digits) costs two table copies.
+
+	64 bit values are split into 32 bit chunks of eight digits so the
+	inner loop never does a 64 bit division, which is a library call
+	on the ARM board.
+*/
+
+#include <string.h>
+
+#include "numfmt.h"
+
+// FUNCTION SIGNATURES
+static int	count_digits_u32(uint32_t value);
+static void	write_u32(char *end, uint32_t value);
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const uint32_t powers_of_ten[10] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000,
+	10000000, 100000000, 1000000000
+};
+
+size_t fmt_u32(char *out, uint32_t value) {
+	int length = count_digits_u32(value);
+
+	write_u32(out + length, value);
+	return length;
+}
+
+size_t fmt_i32(char *out, int32_t value) {
+	uint32_t magnitude = (uint32_t)value;
+
+	if (value < 0) {
+		*out++ = '-';
+		magnitude = 0 - magnitude;
+		return fmt_u32(out, magnitude) + 1;
+	}
+
+	return fmt_u32(out, magnitude);
+}
+
+size_t fmt_u64(char *out, uint64_t value) {
+	uint32_t high, middle, low;
+	size_t length;
+
+	if (value <= UINT32_MAX) {
+		return fmt_u32(out, (uint32_t)value);
+	}
+
+	// Split into 8 digit chunks, at most 20 digits in total
+	low = (uint32_t)(value % 100000000);
+	value /= 100000000;
+
+	if (value <= UINT32_MAX && (uint32_t)value < 100000000) {
+		length = fmt_u32(out, (uint32_t)value);
+	} else {
+		middle = (uint32_t)(value % 100000000);
+		high = (uint32_t)(value / 100000000);
+		length = fmt_u32(out, high);
+		fmt_padded_u32(out + length, middle, 8);
+		length += 8;
+	}
+
+	fmt_padded_u32(out + length, low, 8);
+	return length + 8;
+}
+
+size_t fmt_i64(char *out, int64_t value) {
+	uint64_t magnitude = (uint64_t)value;
+
+	if (value < 0) {
+		*out++ = '-';
+		magnitude = 0 - magnitude;
+		return fmt_u64(out, magnitude) + 1;
+	}
+
+	return fmt_u64(out, magnitude);
+}
+
+// Formats value / 10^decimals, e.g. (12345, 3) -> "12.345"
+size_t fmt_fixed(char *out, int64_t value, int decimals) {
+	uint64_t magnitude = (uint64_t)value;
+	uint32_t scale, fraction;
+	char *start = out;
+
+	if (decimals <= 0) {
+		return fmt_i64(out, value);
+	}
+	if (decimals > 9) {
+		decimals = 9;
+	}
+
+	if (value < 0) {
+		*out++ = '-';
+		magnitude = 0 - magnitude;
+	}
+
+	scale = powers_of_ten[decimals];
+	fraction = (uint32_t)(magnitude % scale);
+	out += fmt_u64(out, magnitude / scale);
+	*out++ = '.';
+	out += fmt_padded_u32(out, fraction, decimals);
+
+	return out - start;
+}
+
+// Writes exactly width digits, zero padded on the left
+size_t fmt_padded_u32(char *out, uint32_t value, int width) {
+	int length = count_digits_u32(value);
+
+	if (length < width) {
+		memset(out, '0', width - length);
+		write_u32(out + width, value);
+		return width;
+	}
+
+	write_u32(out + length, value);
+	return length;
+}
+
+static int count_digits_u32(uint32_t value) {
+	// bit length * log10(2) approximated as 1233 / 4096
+	int guess = ((32 - __builtin_clz(value | 1)) * 1233) >> 12;
+
+	// powers of ten above 1 are even so or-ing in 1 keeps 0 at one digit
+	return guess + 1 - ((value | 1) < powers_of_ten[guess]);
+}
+
+// Writes value so that its last digit lands just before end
+static void write_u32(char *end, uint32_t value) {
+	while (value >= 100) {
+		uint32_t pair = (value % 100) * 2;
+		value /= 100;
+		end -= 2;
+		end[0] = digit_pairs[pair];
+		end[1] = digit_pairs[pair + 1];
+	}
+
+	if (value >= 10) {
+		end -= 2;
+		end[0] = digit_pairs[value * 2];
+		end[1] = digit_pairs[value * 2 + 1];
+	} else {
+		*--end = '0' + value;
+	}
+}
@@ -0,0 +1,27 @@
+/*
+file: numfmt.h
+
+Description:
+	Integer and fixed-point decimal formatting for published values.
+	Replaces printf-family formatting on the output path; none of the
+	functions allocate, parse a format string or NUL terminate.
+*/
+
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest output of any function below: "-9223372036854775808" plus
+// a decimal point.
+#define NUMFMT_MAX_LENGTH 22
+
+size_t	fmt_u32(char *out, uint32_t value);
+size_t	fmt_i32(char *out, int32_t value);
+size_t	fmt_u64(char *out, uint64_t value);
+size_t	fmt_i64(char *out, int64_t value);
+size_t	fmt_fixed(char *out, int64_t value, int decimals);
+size_t	fmt_padded_u32(char *out, uint32_t value, int width);
+
+#endif
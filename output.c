@@ -0,0 +1,195 @@
+/*
+file: output.c
+
+Description:
+	Per-sink single producer / single consumer ring buffers and worker
+	threads. output_publish() runs on the sampler thread: it never takes
+	a lock or blocks, a full queue just counts the record as dropped for
+	that sink. Workers sleep on a semaphore while their queue is empty.
+*/
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+
+// FUNCTION SIGNATURES
+static void	*sink_worker(void *arg);
+static double	elapsed_sec(const struct timespec *since);
+
+struct sink_slot {
+	struct sink sink;
+	struct record queue[OUTPUT_QUEUE_DEPTH];
+	unsigned int head;		// written by the sampler only
+	unsigned int tail;		// written by the worker only
+	sem_t pending;
+	pthread_t thread;
+	struct timespec started;
+	unsigned long long written;
+	unsigned long long dropped;
+	unsigned long long failed;
+};
+
+static struct sink_slot sinks[OUTPUT_MAX_SINKS];
+static int num_sinks = 0;
+static int running = 0;
+static volatile int stopping = 0;
+
+int output_add_sink(const struct sink_ops *ops, void *context, enum record_encoding encoding) {
+	struct sink_slot *slot;
+
+	if (running || num_sinks == OUTPUT_MAX_SINKS) {
+		return -1;
+	}
+
+	slot = &sinks[num_sinks++];
+	memset(slot, 0, sizeof(*slot));
+	slot->sink.ops = ops;
+	slot->sink.context = context;
+	slot->sink.encoding = encoding;
+	return 0;
+}
+
+int output_start() {
+	int i;
+
+	stopping = 0;
+	for (i = 0; i < num_sinks; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &sinks[i].started);
+		if (sem_init(&sinks[i].pending, 0, 0) < 0) {
+			perror("sem_init() failed for output sink.");
+			return -1;
+		}
+		if (pthread_create(&sinks[i].thread, NULL, sink_worker, &sinks[i]) != 0) {
+			fprintf(stderr, "Failed to start output sink %s\n", sinks[i].sink.ops->name);
+			return -1;
+		}
+	}
+
+	running = 1;
+	return 0;
+}
+
+// Called from the sampler, copies the record into every sink queue.
+void output_publish(const struct record *record) {
+	struct sink_slot *slot;
+	unsigned int head, tail;
+	int i;
+
+	for (i = 0; i < num_sinks; i++) {
+		slot = &sinks[i];
+		head = slot->head;
+		tail = __atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE);
+
+		if (head - tail == OUTPUT_QUEUE_DEPTH) {
+			__atomic_add_fetch(&slot->dropped, 1, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		slot->queue[head & (OUTPUT_QUEUE_DEPTH - 1)] = *record;
+		__atomic_store_n(&slot->head, head + 1, __ATOMIC_RELEASE);
+		sem_post(&slot->pending);
+	}
+}
+
+void output_stop() {
+	int i;
+
+	if (!running) {
+		return;
+	}
+
+	stopping = 1;
+	for (i = 0; i < num_sinks; i++) {
+		sem_post(&sinks[i].pending);
+	}
+	for (i = 0; i < num_sinks; i++) {
+		pthread_join(sinks[i].thread, NULL);
+		sem_destroy(&sinks[i].pending);
+	}
+
+	running = 0;
+}
+
+int output_stats(struct sink_stats *stats, int max_sinks) {
+	double seconds;
+	int i;
+
+	for (i = 0; i < num_sinks && i < max_sinks; i++) {
+		stats[i].name = sinks[i].sink.ops->name;
+		stats[i].written = __atomic_load_n(&sinks[i].written, __ATOMIC_RELAXED);
+		stats[i].dropped = __atomic_load_n(&sinks[i].dropped, __ATOMIC_RELAXED);
+		stats[i].failed = __atomic_load_n(&sinks[i].failed, __ATOMIC_RELAXED);
+		seconds = elapsed_sec(&sinks[i].started);
+		stats[i].records_per_sec = seconds > 0 ? stats[i].written / seconds : 0;
+	}
+
+	return i;
+}
+
+void output_log_stats() {
+	struct sink_stats stats[OUTPUT_MAX_SINKS];
+	int count, i;
+
+	count = output_stats(stats, OUTPUT_MAX_SINKS);
+	for (i = 0; i < count; i++) {
+		fprintf(stdout, "sink %s: %llu written (%.1f/s), %llu dropped, %llu failed\n",
+			stats[i].name, stats[i].written, stats[i].records_per_sec,
+			stats[i].dropped, stats[i].failed);
+	}
+}
+
+static void *sink_worker(void *arg) {
+	struct sink_slot *slot = arg;
+	struct sink *sink = &slot->sink;
+	struct record record;
+	unsigned int head, tail;
+	int drained;
+
+	if (sink->ops->open != NULL && sink->ops->open(sink) < 0) {
+		fprintf(stderr, "Failed to open output sink %s\n", sink->ops->name);
+	}
+
+	while (1) {
+		sem_wait(&slot->pending);
+
+		// Drain everything that is queued, the semaphore count may lag
+		head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+		tail = slot->tail;
+		drained = (tail != head);
+		while (tail != head) {
+			record = slot->queue[tail & (OUTPUT_QUEUE_DEPTH - 1)];
+			__atomic_store_n(&slot->tail, ++tail, __ATOMIC_RELEASE);
+
+			if (sink->ops->write(sink, &record) < 0) {
+				__atomic_add_fetch(&slot->failed, 1, __ATOMIC_RELAXED);
+			} else {
+				__atomic_add_fetch(&slot->written, 1, __ATOMIC_RELAXED);
+			}
+			head = __atomic_load_n(&slot->head, __ATOMIC_ACQUIRE);
+		}
+
+		if (drained && sink->ops->flush != NULL) {
+			sink->ops->flush(sink);
+		}
+
+		if (stopping) {
+			break;
+		}
+	}
+
+	if (sink->ops->close != NULL) {
+		sink->ops->close(sink);
+	}
+
+	return NULL;
+}
+
+static double elapsed_sec(const struct timespec *since) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
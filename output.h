@@ -0,0 +1,54 @@
+/*
+file: output.h
+
+Description:
+	Fan-out output stage. The sampler publishes each record once and the
+	stage copies it into the queue of every registered sink. Each sink is
+	drained by its own worker thread so a slow sink only drops its own
+	records instead of stalling the sampler or the other sinks.
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "record.h"
+
+#define OUTPUT_MAX_SINKS 8
+#define OUTPUT_QUEUE_DEPTH 256	// records, must be a power of two
+
+struct sink;
+
+struct sink_ops {
+	const char *name;
+	// called once on the worker thread before the first record
+	int	(*open)(struct sink *sink);
+	// called on the worker thread for every dequeued record
+	int	(*write)(struct sink *sink, const struct record *record);
+	// called on the worker thread whenever the queue has been drained
+	void	(*flush)(struct sink *sink);
+	// called once on the worker thread when the stage stops
+	void	(*close)(struct sink *sink);
+};
+
+struct sink_stats {
+	const char *name;
+	unsigned long long written;	// records handed to write()
+	unsigned long long dropped;	// records lost to a full queue
+	unsigned long long failed;	// write() calls that returned < 0
+	double records_per_sec;		// since the sink was started
+};
+
+struct sink {
+	const struct sink_ops *ops;
+	void *context;			// sink private state
+	enum record_encoding encoding;	// how the sink serializes records
+};
+
+int	output_add_sink(const struct sink_ops *ops, void *context, enum record_encoding encoding);
+int	output_start();
+void	output_publish(const struct record *record);
+void	output_stop();
+int	output_stats(struct sink_stats *stats, int max_sinks);
+void	output_log_stats();
+
+#endif
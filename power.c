@@ -0,0 +1,142 @@
+/*
+file: power.c
+
+Description:
+	Sliding window sums of i * v, i^2 and v^2 per channel pair, see
+	power.h. Everything runs on the sampler thread. Like metrics.c the
+	sums are integers so evictions are exact.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "power.h"
+
+// FUNCTION SIGNATURES
+static struct power_pair	*find_pair(int current_channel);
+
+struct window_product {
+	long long taken_ns;
+	long long power_uw;		// i * v
+	long long current_squared;
+	long long voltage_squared;
+};
+
+struct power_pair {
+	int current_channel;
+	int voltage_channel;
+	long long window_ns;
+	struct window_product window[POWER_WINDOW_SAMPLES];
+	unsigned int head, tail;
+	long long sum_power_uw;
+	long long sum_current_squared;
+	long long sum_voltage_squared;
+
+	// latest result, picked up by power_annotate()
+	int fresh;
+	long long instant_power_uw;
+	long long skew_ns;
+};
+
+static struct power_pair pairs[POWER_MAX_PAIRS];
+static int num_pairs = 0;
+
+void power_clear() {
+	num_pairs = 0;
+}
+
+// A channel may only be part of one pair
+int power_add_pair(int current_channel, int voltage_channel, int window_ms) {
+	struct power_pair *pair;
+	int i;
+
+	if (num_pairs == POWER_MAX_PAIRS || window_ms <= 0 ||
+	    current_channel < 0 || voltage_channel < 0 || current_channel == voltage_channel) {
+		return -1;
+	}
+	for (i = 0; i < num_pairs; i++) {
+		if (pairs[i].current_channel == current_channel || pairs[i].current_channel == voltage_channel ||
+		    pairs[i].voltage_channel == current_channel || pairs[i].voltage_channel == voltage_channel) {
+			return -1;
+		}
+	}
+
+	pair = &pairs[num_pairs++];
+	memset(pair, 0, sizeof(*pair));
+	pair->current_channel = current_channel;
+	pair->voltage_channel = voltage_channel;
+	pair->window_ns = window_ms * 1000000LL;
+	return 0;
+}
+
+void power_update(const struct sample *current, int current_value,
+		const struct sample *voltage, int voltage_value) {
+	struct power_pair *pair = find_pair(current->channel);
+	struct window_product *oldest, *newest;
+	long long now_ns;
+
+	if (pair == NULL) {
+		return;
+	}
+
+	now_ns = current->taken.tv_sec * 1000000000LL + current->taken.tv_nsec;
+
+	while (pair->tail != pair->head) {
+		oldest = &pair->window[pair->tail & (POWER_WINDOW_SAMPLES - 1)];
+		if (now_ns - oldest->taken_ns < pair->window_ns &&
+		    pair->head - pair->tail < POWER_WINDOW_SAMPLES) {
+			break;
+		}
+		pair->sum_power_uw -= oldest->power_uw;
+		pair->sum_current_squared -= oldest->current_squared;
+		pair->sum_voltage_squared -= oldest->voltage_squared;
+		pair->tail++;
+	}
+
+	newest = &pair->window[pair->head++ & (POWER_WINDOW_SAMPLES - 1)];
+	newest->taken_ns = now_ns;
+	newest->power_uw = (long long)current_value * voltage_value;
+	newest->current_squared = (long long)current_value * current_value;
+	newest->voltage_squared = (long long)voltage_value * voltage_value;
+	pair->sum_power_uw += newest->power_uw;
+	pair->sum_current_squared += newest->current_squared;
+	pair->sum_voltage_squared += newest->voltage_squared;
+
+	pair->fresh = 1;
+	pair->instant_power_uw = newest->power_uw;
+	pair->skew_ns = (voltage->taken.tv_sec - current->taken.tv_sec) * 1000000000LL +
+		voltage->taken.tv_nsec - current->taken.tv_nsec;
+}
+
+// Fills the power fields of the current channel's record after an update
+void power_annotate(int channel, struct record *record) {
+	struct power_pair *pair = find_pair(channel);
+	long long count;
+	double apparent_uw;
+
+	if (pair == NULL || !pair->fresh) {
+		return;
+	}
+	pair->fresh = 0;
+
+	count = pair->head - pair->tail;
+	apparent_uw = sqrt((double)pair->sum_current_squared * pair->sum_voltage_squared) / count;
+
+	record->flags |= RECORD_HAS_POWER;
+	record->instant_power_mw = pair->instant_power_uw / 1000;
+	record->real_power_mw = pair->sum_power_uw / count / 1000;
+	record->apparent_power_mva = llround(apparent_uw / 1000);
+	record->power_factor = (apparent_uw > 0) ? lround(pair->sum_power_uw / count * 1000 / apparent_uw) : 0;
+	record->skew_ns = pair->skew_ns;
+}
+
+static struct power_pair *find_pair(int current_channel) {
+	int i;
+
+	for (i = 0; i < num_pairs; i++) {
+		if (pairs[i].current_channel == current_channel) {
+			return &pairs[i];
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,30 @@
+/*
+file: power.h
+
+Description:
+	Real power from configured current/voltage channel pairs. The sampler
+	reads the two channels of a pair back to back and hands both values
+	to power_update(), which keeps a sliding window of the products. The
+	current channel's record then carries instantaneous, real and
+	apparent power, the power factor and the time between the two
+	conversions (the pair skew, the source of phase error).
+
+	Currents are expected in mA and voltages in mV, powers are in mW.
+*/
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "record.h"
+#include "sample.h"
+
+#define POWER_MAX_PAIRS 4
+#define POWER_WINDOW_SAMPLES 1024	// per pair, must be a power of two
+
+void	power_clear();
+int	power_add_pair(int current_channel, int voltage_channel, int window_ms);
+void	power_update(const struct sample *current, int current_value,
+		const struct sample *voltage, int voltage_value);
+void	power_annotate(int channel, struct record *record);
+
+#endif
@@ -0,0 +1,422 @@
+/*
+file: record.c
+
+Description:
+	JSON serialization of output records. The pretty layout matches what
+	json-c produced with JSON_C_TO_STRING_PRETTY so existing readers of
+	sensor_N.json keep working, the compact layout is one line per record
+	for logs and streams.
+
+	CBOR and MessagePack records carry the same five fields as a map, the
+	Date is a text string or an integer in epoch mode just like in JSON.
+	Optional fields (record.flags) follow the Unit in every encoding.
+*/
+
+#include <string.h>
+#include <strings.h>
+
+#include "encode.h"
+#include "numfmt.h"
+#include "record.h"
+#include "timestamp.h"
+
+struct binary_encoder;
+
+// FUNCTION SIGNATURES
+static int	record_date(const struct record *record, char *buffer, long long *epoch);
+static char	*json_stats(char *out, const struct record *record);
+static char	*json_alarms(char *out, const struct record *record);
+static char	*json_harmonics(char *out, const struct record *record);
+static unsigned char	*binary_stats(const struct binary_encoder *encoder, unsigned char *out, const struct record *record);
+static unsigned char	*binary_alarms(const struct binary_encoder *encoder, unsigned char *out, const struct record *record);
+static unsigned char	*binary_harmonics(const struct binary_encoder *encoder, unsigned char *out, const struct record *record);
+
+struct binary_encoder {
+	unsigned char *(*put_map)(unsigned char *out, uint32_t pairs);
+	unsigned char *(*put_array)(unsigned char *out, uint32_t items);
+	unsigned char *(*put_int)(unsigned char *out, int64_t value);
+	unsigned char *(*put_double)(unsigned char *out, double value);
+	unsigned char *(*put_text)(unsigned char *out, const char *text, size_t length);
+};
+
+static const struct binary_encoder cbor_encoder = {
+	cbor_put_map, cbor_put_array, cbor_put_int, cbor_put_double, cbor_put_text
+};
+
+static const struct binary_encoder msgpack_encoder = {
+	mp_put_map, mp_put_array, mp_put_int, mp_put_double, mp_put_text
+};
+
+#define PUT_KEY(encoder, out, key) (encoder)->put_text(out, key, sizeof(key) - 1)
+
+static const char *const alarm_state_names[] = { "normal", "low", "high" };
+
+int record_parse_encoding(const char *name, enum record_encoding *encoding) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, "json") == 0) {
+		*encoding = ENCODING_JSON;
+	} else if (strcasecmp(name, "cbor") == 0) {
+		*encoding = ENCODING_CBOR;
+	} else if (strcasecmp(name, "msgpack") == 0) {
+		*encoding = ENCODING_MSGPACK;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+// File name extension (with the dot) for files holding encoding
+const char *record_extension(enum record_encoding encoding) {
+	switch (encoding) {
+		case ENCODING_CBOR:
+			return ".cbor";
+		case ENCODING_MSGPACK:
+			return ".msgpack";
+		default:
+			return ".json";
+	}
+}
+
+size_t record_encode(const struct record *record, unsigned char *buffer, enum record_encoding encoding, int pretty) {
+	if (encoding == ENCODING_JSON) {
+		return record_to_json(record, (char *)buffer, pretty);
+	}
+
+	return record_to_binary(record, buffer, encoding);
+}
+
+// Serializes record as a CBOR or MessagePack map into buffer (at least
+// RECORD_BUFFER_SIZE bytes) and returns the length.
+size_t record_to_binary(const struct record *record, unsigned char *buffer, enum record_encoding encoding) {
+	const struct binary_encoder *encoder;
+	char date_buffer[TS_BUFFER_SIZE];
+	long long epoch;
+	unsigned char *out = buffer;
+	uint32_t pairs;
+	int length;
+
+	encoder = (encoding == ENCODING_CBOR) ? &cbor_encoder : &msgpack_encoder;
+	length = record_date(record, date_buffer, &epoch);
+
+	pairs = 5;
+	if (record->flags & RECORD_HAS_METRICS) {
+		pairs += 3;
+	}
+	if (record->flags & RECORD_HAS_POWER) {
+		pairs += 5;
+	}
+	if (record->flags & RECORD_HAS_STATS) {
+		pairs += 1;
+	}
+	if (record->flags & RECORD_HAS_ALARM) {
+		pairs += 1;
+	}
+	if (record->flags & RECORD_HAS_HARMONICS) {
+		pairs += 1;
+	}
+	if (record->flags & RECORD_HAS_ANOMALY) {
+		pairs += 1;
+	}
+
+	out = encoder->put_map(out, pairs);
+	out = PUT_KEY(encoder, out, "Sensor_ID");
+	out = encoder->put_int(out, record->sensor_id);
+	out = PUT_KEY(encoder, out, "Current");
+	out = encoder->put_int(out, record->value);
+	out = PUT_KEY(encoder, out, "Date");
+	if (length < 0) {
+		out = encoder->put_int(out, epoch);
+	} else {
+		out = encoder->put_text(out, date_buffer, length);
+	}
+	out = PUT_KEY(encoder, out, "Unit");
+	out = encoder->put_text(out, record->unit, strlen(record->unit));
+	if (record->flags & RECORD_HAS_METRICS) {
+		out = PUT_KEY(encoder, out, "RMS");
+		out = encoder->put_int(out, record->rms);
+		out = PUT_KEY(encoder, out, "Power_mW");
+		out = encoder->put_int(out, record->power_mw);
+		out = PUT_KEY(encoder, out, "Energy_mWh");
+		out = encoder->put_int(out, record->energy_mwh);
+	}
+	if (record->flags & RECORD_HAS_POWER) {
+		out = PUT_KEY(encoder, out, "Instant_Power_mW");
+		out = encoder->put_int(out, record->instant_power_mw);
+		out = PUT_KEY(encoder, out, "Real_Power_mW");
+		out = encoder->put_int(out, record->real_power_mw);
+		out = PUT_KEY(encoder, out, "Apparent_Power_mVA");
+		out = encoder->put_int(out, record->apparent_power_mva);
+		out = PUT_KEY(encoder, out, "Power_Factor");
+		out = encoder->put_double(out, record->power_factor / 1000.0);
+		out = PUT_KEY(encoder, out, "Pair_Skew_ns");
+		out = encoder->put_int(out, record->skew_ns);
+	}
+	if (record->flags & RECORD_HAS_STATS) {
+		out = PUT_KEY(encoder, out, "Stats");
+		out = binary_stats(encoder, out, record);
+	}
+	if (record->flags & RECORD_HAS_ALARM) {
+		out = PUT_KEY(encoder, out, "Alarms");
+		out = binary_alarms(encoder, out, record);
+	}
+	if (record->flags & RECORD_HAS_HARMONICS) {
+		out = PUT_KEY(encoder, out, "Harmonics");
+		out = binary_harmonics(encoder, out, record);
+	}
+	if (record->flags & RECORD_HAS_ANOMALY) {
+		out = PUT_KEY(encoder, out, "Anomaly_Score");
+		out = encoder->put_double(out, record->anomaly_score / 1000.0);
+	}
+	out = PUT_KEY(encoder, out, "Latency_us");
+	out = encoder->put_int(out, ts_elapsed_ns(&record->taken) / 1000);
+
+	return out - buffer;
+}
+
+// "Stats" as an array of maps, the same layout as in JSON
+static unsigned char *binary_stats(const struct binary_encoder *encoder, unsigned char *out, const struct record *record) {
+	const struct record_stats *stats;
+	int i;
+
+	out = encoder->put_array(out, record->num_stats);
+	for (i = 0; i < record->num_stats; i++) {
+		stats = &record->stats[i];
+		out = encoder->put_map(out, stats->tumbling_valid ? 6 : 5);
+		out = PUT_KEY(encoder, out, "Window_ms");
+		out = encoder->put_int(out, stats->window_ms);
+		out = PUT_KEY(encoder, out, "Min");
+		out = encoder->put_int(out, stats->min);
+		out = PUT_KEY(encoder, out, "Max");
+		out = encoder->put_int(out, stats->max);
+		out = PUT_KEY(encoder, out, "Mean");
+		out = encoder->put_double(out, stats->mean / 1000.0);
+		out = PUT_KEY(encoder, out, "Stddev");
+		out = encoder->put_double(out, stats->stddev / 1000.0);
+		if (stats->tumbling_valid) {
+			out = PUT_KEY(encoder, out, "Tumbling");
+			out = encoder->put_map(out, 4);
+			out = PUT_KEY(encoder, out, "Min");
+			out = encoder->put_int(out, stats->tumbling_min);
+			out = PUT_KEY(encoder, out, "Max");
+			out = encoder->put_int(out, stats->tumbling_max);
+			out = PUT_KEY(encoder, out, "Mean");
+			out = encoder->put_double(out, stats->tumbling_mean / 1000.0);
+			out = PUT_KEY(encoder, out, "Stddev");
+			out = encoder->put_double(out, stats->tumbling_stddev / 1000.0);
+		}
+	}
+
+	return out;
+}
+
+static unsigned char *binary_alarms(const struct binary_encoder *encoder, unsigned char *out, const struct record *record) {
+	const struct record_alarm *alarm;
+	int i;
+
+	out = encoder->put_array(out, record->num_alarms);
+	for (i = 0; i < record->num_alarms; i++) {
+		alarm = &record->alarms[i];
+		out = encoder->put_map(out, 4);
+		out = PUT_KEY(encoder, out, "Source");
+		out = encoder->put_text(out, alarm->source, strlen(alarm->source));
+		out = PUT_KEY(encoder, out, "State");
+		out = encoder->put_text(out, alarm_state_names[alarm->state], strlen(alarm_state_names[alarm->state]));
+		out = PUT_KEY(encoder, out, "Limit");
+		out = encoder->put_int(out, alarm->limit);
+		out = PUT_KEY(encoder, out, "Value");
+		out = encoder->put_int(out, alarm->value);
+	}
+
+	return out;
+}
+
+static unsigned char *binary_harmonics(const struct binary_encoder *encoder, unsigned char *out, const struct record *record) {
+	const struct record_harmonics *harmonics = &record->harmonics;
+	int i;
+
+	out = encoder->put_map(out, 3);
+	out = PUT_KEY(encoder, out, "Fundamental_Hz");
+	out = encoder->put_double(out, harmonics->fundamental_mhz / 1000.0);
+	out = PUT_KEY(encoder, out, "THD");
+	out = encoder->put_double(out, harmonics->thd / 1000.0);
+	out = PUT_KEY(encoder, out, "Amplitudes");
+	out = encoder->put_array(out, harmonics->count);
+	for (i = 0; i < harmonics->count; i++) {
+		out = encoder->put_int(out, harmonics->amplitude[i]);
+	}
+
+	return out;
+}
+
+// The record's date as ts_date() gives it: -1 and *epoch when numeric,
+// else the length of its text
+static int record_date(const struct record *record, char *buffer, long long *epoch) {
+	struct timespec wall;
+
+	ts_mono_to_wall(&record->taken, &wall);
+	return ts_date(&wall, buffer, epoch);
+}
+
+// Serializes record into buffer (at least RECORD_BUFFER_SIZE bytes) and
+// returns the length. The output is newline terminated but not NUL
+// terminated.
+size_t record_to_json(const struct record *record, char *buffer, int pretty) {
+	const char *separator = pretty ? ",\n  \"" : ",\"";
+	char date_buffer[TS_BUFFER_SIZE];
+	long long latency_us, epoch;
+	char *out = buffer;
+	int length;
+
+	length = record_date(record, date_buffer, &epoch);
+
+	// How stale the value is by the time it is serialized for a sink
+	latency_us = ts_elapsed_ns(&record->taken) / 1000;
+
+	out = stpcpy(out, pretty ? "{\n  \"Sensor_ID\":" : "{\"Sensor_ID\":");
+	out += fmt_i32(out, record->sensor_id);
+	out = stpcpy(stpcpy(out, separator), "Current\":");
+	out += fmt_i32(out, record->value);
+	out = stpcpy(stpcpy(out, separator), "Date\":");
+	if (length < 0) {
+		out += fmt_i64(out, epoch);
+	} else {
+		*out++ = '"';
+		memcpy(out, date_buffer, length);
+		out += length;
+		*out++ = '"';
+	}
+	// calib_compile() only accepts units that need no escaping
+	out = stpcpy(stpcpy(out, separator), "Unit\":\"");
+	out = stpcpy(out, record->unit);
+	*out++ = '"';
+	if (record->flags & RECORD_HAS_METRICS) {
+		out = stpcpy(stpcpy(out, separator), "RMS\":");
+		out += fmt_i32(out, record->rms);
+		out = stpcpy(stpcpy(out, separator), "Power_mW\":");
+		out += fmt_i64(out, record->power_mw);
+		out = stpcpy(stpcpy(out, separator), "Energy_mWh\":");
+		out += fmt_i64(out, record->energy_mwh);
+	}
+	if (record->flags & RECORD_HAS_POWER) {
+		out = stpcpy(stpcpy(out, separator), "Instant_Power_mW\":");
+		out += fmt_i64(out, record->instant_power_mw);
+		out = stpcpy(stpcpy(out, separator), "Real_Power_mW\":");
+		out += fmt_i64(out, record->real_power_mw);
+		out = stpcpy(stpcpy(out, separator), "Apparent_Power_mVA\":");
+		out += fmt_i64(out, record->apparent_power_mva);
+		out = stpcpy(stpcpy(out, separator), "Power_Factor\":");
+		out += fmt_fixed(out, record->power_factor, 3);
+		out = stpcpy(stpcpy(out, separator), "Pair_Skew_ns\":");
+		out += fmt_i64(out, record->skew_ns);
+	}
+	if (record->flags & RECORD_HAS_STATS) {
+		out = stpcpy(stpcpy(out, separator), "Stats\":");
+		out = json_stats(out, record);
+	}
+	if (record->flags & RECORD_HAS_ALARM) {
+		out = stpcpy(stpcpy(out, separator), "Alarms\":");
+		out = json_alarms(out, record);
+	}
+	if (record->flags & RECORD_HAS_HARMONICS) {
+		out = stpcpy(stpcpy(out, separator), "Harmonics\":");
+		out = json_harmonics(out, record);
+	}
+	if (record->flags & RECORD_HAS_ANOMALY) {
+		out = stpcpy(stpcpy(out, separator), "Anomaly_Score\":");
+		out += fmt_fixed(out, record->anomaly_score, 3);
+	}
+	out = stpcpy(stpcpy(out, separator), "Latency_us\":");
+	out += fmt_i64(out, latency_us);
+	out = stpcpy(out, pretty ? "\n}\n" : "}\n");
+
+	return out - buffer;
+}
+
+// "Stats":[{"Window_ms":1000,"Min":..,"Max":..,"Mean":..,"Stddev":..,
+// "Tumbling":{...}},...] on one line in both layouts
+static char *json_stats(char *out, const struct record *record) {
+	const struct record_stats *stats;
+	int i;
+
+	*out++ = '[';
+	for (i = 0; i < record->num_stats; i++) {
+		stats = &record->stats[i];
+		if (i > 0) {
+			*out++ = ',';
+		}
+		out = stpcpy(out, "{\"Window_ms\":");
+		out += fmt_i32(out, stats->window_ms);
+		out = stpcpy(out, ",\"Min\":");
+		out += fmt_i32(out, stats->min);
+		out = stpcpy(out, ",\"Max\":");
+		out += fmt_i32(out, stats->max);
+		out = stpcpy(out, ",\"Mean\":");
+		out += fmt_fixed(out, stats->mean, 3);
+		out = stpcpy(out, ",\"Stddev\":");
+		out += fmt_fixed(out, stats->stddev, 3);
+		if (stats->tumbling_valid) {
+			out = stpcpy(out, ",\"Tumbling\":{\"Min\":");
+			out += fmt_i32(out, stats->tumbling_min);
+			out = stpcpy(out, ",\"Max\":");
+			out += fmt_i32(out, stats->tumbling_max);
+			out = stpcpy(out, ",\"Mean\":");
+			out += fmt_fixed(out, stats->tumbling_mean, 3);
+			out = stpcpy(out, ",\"Stddev\":");
+			out += fmt_fixed(out, stats->tumbling_stddev, 3);
+			*out++ = '}';
+		}
+		*out++ = '}';
+	}
+	*out++ = ']';
+
+	return out;
+}
+
+// "Alarms":[{"Source":"Value","State":"high","Limit":1500,"Value":1612}]
+static char *json_alarms(char *out, const struct record *record) {
+	const struct record_alarm *alarm;
+	int i;
+
+	*out++ = '[';
+	for (i = 0; i < record->num_alarms; i++) {
+		alarm = &record->alarms[i];
+		if (i > 0) {
+			*out++ = ',';
+		}
+		out = stpcpy(stpcpy(out, "{\"Source\":\""), alarm->source);
+		out = stpcpy(stpcpy(out, "\",\"State\":\""), alarm_state_names[alarm->state]);
+		out = stpcpy(out, "\",\"Limit\":");
+		out += fmt_i32(out, alarm->limit);
+		out = stpcpy(out, ",\"Value\":");
+		out += fmt_i32(out, alarm->value);
+		*out++ = '}';
+	}
+	*out++ = ']';
+
+	return out;
+}
+
+// "Harmonics":{"Fundamental_Hz":60.000,"THD":0.224,"Amplitudes":[996,0,200]}
+static char *json_harmonics(char *out, const struct record *record) {
+	const struct record_harmonics *harmonics = &record->harmonics;
+	int i;
+
+	out = stpcpy(out, "{\"Fundamental_Hz\":");
+	out += fmt_fixed(out, harmonics->fundamental_mhz, 3);
+	out = stpcpy(out, ",\"THD\":");
+	out += fmt_fixed(out, harmonics->thd, 3);
+	out = stpcpy(out, ",\"Amplitudes\":[");
+	for (i = 0; i < harmonics->count; i++) {
+		if (i > 0) {
+			*out++ = ',';
+		}
+		out += fmt_i32(out, harmonics->amplitude[i]);
+	}
+	out = stpcpy(out, "]}");
+
+	return out;
+}
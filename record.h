@@ -0,0 +1,111 @@
+/*
+file: record.h
+
+Description:
+	A processed sensor value as handed to the output stage. Records are
+	copied by value into every sink queue and can outlive the config
+	they were converted with, so they only hold plain data and pointers
+	to static strings.
+*/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Upper bound of a serialized record in any encoding
+#define RECORD_BUFFER_SIZE 2048
+#define RECORD_MAX_STATS 3
+#define RECORD_MAX_ALARMS 3
+#define RECORD_MAX_HARMONICS 8
+#define RECORD_UNIT_SIZE 8
+
+// Encodings a sink can be configured with
+enum record_encoding {
+	ENCODING_JSON = 0,
+	ENCODING_CBOR,
+	ENCODING_MSGPACK
+};
+
+// Optional parts of a record, see record.flags
+#define RECORD_HAS_METRICS (1 << 0)	// rms, power_mw, energy_mwh
+#define RECORD_HAS_POWER (1 << 1)	// instant_power_mw .. skew_ns
+#define RECORD_HAS_STATS (1 << 2)	// num_stats, stats
+#define RECORD_HAS_ALARM (1 << 3)	// num_alarms, alarms
+#define RECORD_HAS_HARMONICS (1 << 4)	// harmonics
+#define RECORD_HAS_ANOMALY (1 << 5)	// anomaly_score
+
+// Statistics over one window, means and deviations in thousandths of unit
+struct record_stats {
+	int window_ms;
+	int min, max;			// sliding window
+	long long mean, stddev;
+	int tumbling_valid;		// a tumbling period has completed
+	int tumbling_min, tumbling_max;	// last complete period
+	long long tumbling_mean, tumbling_stddev;
+};
+
+// Result of one FFT block, see harmonics.h
+struct record_harmonics {
+	long long fundamental_mhz;	// millihertz
+	int thd;			// thousandths of the fundamental
+	int count;
+	int amplitude[RECORD_MAX_HARMONICS];	// peak in unit, [0] is the fundamental
+};
+
+enum record_alarm_state {
+	ALARM_NORMAL = 0,
+	ALARM_LOW,
+	ALARM_HIGH
+};
+
+// One alarm state change, see alarm.h
+struct record_alarm {
+	const char *source;		// "Value", "Raw" or "Anomaly"
+	enum record_alarm_state state;	// the state entered
+	int limit;			// limit crossed or returned within
+	int value;			// value that caused the change
+};
+
+struct record {
+	int sensor_id;		// one based sensor number
+	int value;		// converted value in unit
+	char unit[RECORD_UNIT_SIZE];	// e.g. "mA" or "mV"
+	struct timespec taken;	// CLOCK_MONOTONIC at conversion
+	unsigned int flags;	// RECORD_HAS_* bits
+
+	// derived metrics over the channel window, see metrics.h
+	int rms;				// in unit
+	long long power_mw;			// average power
+	long long energy_mwh;			// since first start
+
+	// current/voltage pair this channel is the current of, see power.h
+	long long instant_power_mw;
+	long long real_power_mw;		// mean of i * v over the window
+	long long apparent_power_mva;		// Irms * Vrms
+	int power_factor;			// thousandths
+	long long skew_ns;			// voltage taken - current taken
+
+	// windowed statistics, see stats.h
+	int num_stats;
+	struct record_stats stats[RECORD_MAX_STATS];
+
+	// alarm state changes caused by this sample
+	int num_alarms;
+	struct record_alarm alarms[RECORD_MAX_ALARMS];
+
+	// latest completed FFT block of the channel
+	struct record_harmonics harmonics;
+
+	// z-score of value against the channel's usual readings, thousandths
+	long long anomaly_score;
+};
+
+size_t	record_to_json(const struct record *record, char *buffer, int pretty);
+size_t	record_to_binary(const struct record *record, unsigned char *buffer, enum record_encoding encoding);
+size_t	record_encode(const struct record *record, unsigned char *buffer, enum record_encoding encoding, int pretty);
+int	record_parse_encoding(const char *name, enum record_encoding *encoding);
+const char *record_extension(enum record_encoding encoding);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+file: sample.h
+
+Description:
+	A single raw ADC reading together with the moment it was taken.
+	The timestamp is captured on CLOCK_MONOTONIC right after the ADC
+	conversion is triggered so that any later processing or output
+	delay does not show up as timestamp error.
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <time.h>
+
+struct sample {
+	int channel;		// zero based ADC channel
+	int raw;		// value read back from the ADC (mV)
+	struct timespec taken;	// CLOCK_MONOTONIC at conversion trigger
+};
+
+#endif
@@ -0,0 +1,282 @@
+/*
+file: sinks.c
+
+Description:
+	File based output sinks. All of them run on their own output worker
+	thread (see output.c) and replace files atomically with rename() so
+	readers never see a partially written file.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "encode.h"
+#include "http.h"
+#include "notify.h"
+#include "numfmt.h"
+#include "sinks.h"
+
+#define PATH_BUFFER_SIZE 40
+#define SNAPSHOT_NAME "./sensors"
+#define HISTORY_NAME "./history"
+
+// FUNCTION SIGNATURES
+static int	file_sink_write(struct sink *sink, const struct record *record);
+static int	snapshot_sink_write(struct sink *sink, const struct record *record);
+static void	snapshot_sink_flush(struct sink *sink);
+static int	history_sink_open(struct sink *sink);
+static int	history_sink_write(struct sink *sink, const struct record *record);
+static void	history_sink_flush(struct sink *sink);
+static void	history_sink_close(struct sink *sink);
+static int	replace_file(const char *temp_path, const char *path, const void *data, size_t length);
+static void	sensor_path(char *path_buffer, int channel, const char *suffix, enum record_encoding encoding);
+static void	named_path(char *path_buffer, const char *name, const char *suffix, enum record_encoding encoding);
+
+struct snapshot_state {
+	struct record latest[SINK_MAX_SENSORS];
+	int valid[SINK_MAX_SENSORS];
+};
+
+struct history_state {
+	FILE *file;
+};
+
+const struct sink_ops file_sink_ops = {
+	"files", NULL, file_sink_write, NULL, NULL
+};
+
+const struct sink_ops snapshot_sink_ops = {
+	"snapshot", NULL, snapshot_sink_write, snapshot_sink_flush, NULL
+};
+
+const struct sink_ops history_sink_ops = {
+	"history", history_sink_open, history_sink_write, history_sink_flush, history_sink_close
+};
+
+static struct snapshot_state snapshot;
+static struct history_state history;
+
+int sinks_parse_name(const char *name) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, file_sink_ops.name) == 0) {
+		return SINK_FILES;
+	} else if (strcasecmp(name, snapshot_sink_ops.name) == 0) {
+		return SINK_SNAPSHOT;
+	} else if (strcasecmp(name, history_sink_ops.name) == 0) {
+		return SINK_HISTORY;
+	} else if (strcasecmp(name, http_sink_ops.name) == 0) {
+		return SINK_HTTP;
+	}
+
+	return -1;
+}
+
+// Registers one of the SINK_* sinks, each may only be registered once
+int sinks_register(int sink, enum record_encoding encoding) {
+	static int registered = 0;
+	int result = -1;
+
+	if (registered & sink) {
+		return -1;
+	}
+
+	switch (sink) {
+		case SINK_FILES:
+			result = output_add_sink(&file_sink_ops, NULL, encoding);
+			break;
+		case SINK_SNAPSHOT:
+			result = output_add_sink(&snapshot_sink_ops, &snapshot, encoding);
+			break;
+		case SINK_HISTORY:
+			result = output_add_sink(&history_sink_ops, &history, encoding);
+			break;
+		case SINK_HTTP:
+			result = output_add_sink(&http_sink_ops, NULL, encoding);
+			break;
+		default:
+			break;
+	}
+
+	if (result == 0) {
+		registered |= sink;
+	}
+	return result;
+}
+
+// sensor_N.json, same content the daemon always wrote (or .cbor/.msgpack)
+static int file_sink_write(struct sink *sink, const struct record *record) {
+	char path_buffer_temp[PATH_BUFFER_SIZE];
+	char path_buffer[PATH_BUFFER_SIZE];
+	unsigned char record_buffer[RECORD_BUFFER_SIZE];
+	size_t length;
+
+	length = record_encode(record, record_buffer, sink->encoding, 1);
+
+	//Generate path buffers (temp has a ~)
+	sensor_path(path_buffer_temp, record->sensor_id, "~", sink->encoding);
+	sensor_path(path_buffer, record->sensor_id, "", sink->encoding);
+
+	if (replace_file(path_buffer_temp, path_buffer, record_buffer, length) < 0) {
+		return -1;
+	}
+
+	notify_publish(record->sensor_id);
+	return 0;
+}
+
+static int snapshot_sink_write(struct sink *sink, const struct record *record) {
+	struct snapshot_state *state = sink->context;
+	int index = record->sensor_id - 1;
+
+	if (index < 0 || index >= SINK_MAX_SENSORS) {
+		return -1;
+	}
+
+	state->latest[index] = *record;
+	state->valid[index] = 1;
+	return 0;
+}
+
+// sensors.json, rewritten once per drained batch rather than per record
+static void snapshot_sink_flush(struct sink *sink) {
+	struct snapshot_state *state = sink->context;
+	unsigned char buffer[SINK_MAX_SENSORS * RECORD_BUFFER_SIZE + 16];
+	char path_buffer_temp[PATH_BUFFER_SIZE];
+	char path_buffer[PATH_BUFFER_SIZE];
+	unsigned char *out = buffer;
+	int count = 0;
+	int i;
+
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		count += state->valid[i];
+	}
+
+	if (sink->encoding == ENCODING_CBOR) {
+		out = cbor_put_array(out, count);
+	} else if (sink->encoding == ENCODING_MSGPACK) {
+		out = mp_put_array(out, count);
+	} else {
+		*out++ = '[';
+	}
+
+	for (i = 0; i < SINK_MAX_SENSORS; i++) {
+		if (!state->valid[i]) {
+			continue;
+		}
+		if (sink->encoding != ENCODING_JSON) {
+			out += record_to_binary(&state->latest[i], out, sink->encoding);
+			continue;
+		}
+		if (out != buffer + 1) {
+			*out++ = ',';
+		}
+		*out++ = '\n';
+		out += record_to_json(&state->latest[i], (char *)out, 0) - 1;	// drop newline
+	}
+
+	if (sink->encoding == ENCODING_JSON) {
+		out = (unsigned char *)stpcpy((char *)out, "\n]\n");
+	}
+
+	named_path(path_buffer_temp, SNAPSHOT_NAME, "~", sink->encoding);
+	named_path(path_buffer, SNAPSHOT_NAME, "", sink->encoding);
+	if (replace_file(path_buffer_temp, path_buffer, buffer, out - buffer) < 0) {
+		fprintf(stderr, "Can't write %s\n", path_buffer);
+		return;
+	}
+
+	notify_publish(0);
+}
+
+// history.log, newline delimited JSON appended for every record. Binary
+// encodings are self delimiting and go to history.cbor/history.msgpack.
+static int history_sink_open(struct sink *sink) {
+	struct history_state *state = sink->context;
+	char path_buffer[PATH_BUFFER_SIZE];
+
+	if (sink->encoding == ENCODING_JSON) {
+		strcpy(path_buffer, HISTORY_NAME ".log");
+	} else {
+		named_path(path_buffer, HISTORY_NAME, "", sink->encoding);
+	}
+
+	state->file = fopen(path_buffer, "a");
+	if (state->file == NULL) {
+		perror("Can't open history file");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int history_sink_write(struct sink *sink, const struct record *record) {
+	struct history_state *state = sink->context;
+	unsigned char record_buffer[RECORD_BUFFER_SIZE];
+	size_t length;
+
+	if (state->file == NULL) {
+		return -1;
+	}
+
+	length = record_encode(record, record_buffer, sink->encoding, 0);
+	if (fwrite(record_buffer, 1, length, state->file) != length) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void history_sink_flush(struct sink *sink) {
+	struct history_state *state = sink->context;
+
+	if (state->file != NULL) {
+		fflush(state->file);
+	}
+}
+
+static void history_sink_close(struct sink *sink) {
+	struct history_state *state = sink->context;
+
+	if (state->file != NULL) {
+		fclose(state->file);
+		state->file = NULL;
+	}
+}
+
+// Writes data to temp_path and renames it over path (rename is atomic)
+static int replace_file(const char *temp_path, const char *path, const void *data, size_t length) {
+	int fd;
+	ssize_t written;
+
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		fprintf(stderr, "Can't Open File %s\n", temp_path);
+		return -1;
+	}
+
+	written = write(fd, data, length);
+	close(fd);
+	if (written != (ssize_t)length) {
+		return -1;
+	}
+
+	return rename(temp_path, path);
+}
+
+// Builds "./sensor_<channel><suffix>.<ext>" without going through printf
+static void sensor_path(char *path_buffer, int channel, const char *suffix, enum record_encoding encoding) {
+	char *out = stpcpy(path_buffer, "./sensor_");
+	out += fmt_i32(out, channel);
+	strcpy(stpcpy(out, suffix), record_extension(encoding));
+}
+
+// Builds "<name><suffix>.<ext>"
+static void named_path(char *path_buffer, const char *name, const char *suffix, enum record_encoding encoding) {
+	strcpy(stpcpy(stpcpy(path_buffer, name), suffix), record_extension(encoding));
+}
@@ -0,0 +1,29 @@
+/*
+file: sinks.h
+
+Description:
+	Output sinks that write to the working directory
+	(/var/tmp/sensor-json when running as the daemon).
+*/
+
+#ifndef SINKS_H
+#define SINKS_H
+
+#include "output.h"
+
+#define SINK_MAX_SENSORS 64
+
+// Bit flags used by the "outputs" config entry
+#define SINK_FILES	(1 << 0)	// sensor_N.<ext>, one file per channel
+#define SINK_SNAPSHOT	(1 << 1)	// sensors.<ext>, latest value of every channel
+#define SINK_HISTORY	(1 << 2)	// history.log (or .<ext>), every record
+#define SINK_HTTP	(1 << 3)	// embedded HTTP server, see http.h
+
+extern const struct sink_ops file_sink_ops;
+extern const struct sink_ops snapshot_sink_ops;
+extern const struct sink_ops history_sink_ops;
+
+int	sinks_parse_name(const char *name);
+int	sinks_register(int sink, enum record_encoding encoding);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+file: stats.c
+
+Description:
+	Sliding and tumbling window statistics, see stats.h. The sliding
+	mean and variance use integer sums instead of Welford: removing
+	samples from a Welford accumulator slowly loses precision, the sums
+	stay exact. Deques hold sample sequence numbers into the history
+	ring. Everything runs on the sampler thread.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define HISTORY_MASK (STATS_HISTORY_SAMPLES - 1)
+
+struct channel_stats;
+struct window;
+
+// FUNCTION SIGNATURES
+static void	window_push(struct channel_stats *stats, struct window *window, unsigned int sequence);
+static void	window_evict(struct channel_stats *stats, struct window *window, long long now_ns);
+static void	tumbling_push(struct window *window, long long now_ns, int value);
+static long long	stddev_thousandths(double variance);
+
+struct deque {
+	unsigned int items[STATS_HISTORY_SAMPLES];	// sample sequence numbers
+	unsigned int head, tail;
+};
+
+struct window {
+	long long length_ns;
+
+	// sliding
+	unsigned int first;		// oldest sequence number in the window
+	long long sum;
+	long long sum_squares;
+	struct deque min;		// increasing values
+	struct deque max;		// decreasing values
+
+	// tumbling
+	long long started_ns;
+	long long count;
+	double mean;
+	double m2;
+	int low, high;
+	int complete;
+	struct record_stats last;
+};
+
+struct channel_stats {
+	long long taken_ns[STATS_HISTORY_SAMPLES];
+	int value[STATS_HISTORY_SAMPLES];
+	unsigned int next;		// sequence number of the next sample
+	struct window windows[RECORD_MAX_STATS];
+};
+
+static struct channel_stats channels[STATS_MAX_CHANNELS];
+static int num_windows = 0;
+
+// Restarts every window, an empty list turns the statistics off
+void stats_configure(const int *windows_ms, int count) {
+	struct window *window;
+	int channel, i;
+
+	if (count > RECORD_MAX_STATS) {
+		count = RECORD_MAX_STATS;
+	}
+
+	for (channel = 0; channel < STATS_MAX_CHANNELS; channel++) {
+		channels[channel].next = 0;
+		for (i = 0; i < count; i++) {
+			window = &channels[channel].windows[i];
+			memset(window, 0, sizeof(*window));
+			window->length_ns = windows_ms[i] * 1000000LL;
+		}
+	}
+	num_windows = count;
+}
+
+void stats_update(int channel, struct record *record) {
+	struct channel_stats *stats;
+	struct window *window;
+	struct record_stats *result;
+	unsigned int sequence;
+	long long now_ns, count;
+	double mean;
+	int i;
+
+	if (channel < 0 || channel >= STATS_MAX_CHANNELS || num_windows == 0) {
+		return;
+	}
+
+	stats = &channels[channel];
+	now_ns = record->taken.tv_sec * 1000000000LL + record->taken.tv_nsec;
+
+	// The slot about to be reused must have left every window first
+	sequence = stats->next++;
+	for (i = 0; i < num_windows; i++) {
+		window_evict(stats, &stats->windows[i], now_ns);
+	}
+	stats->taken_ns[sequence & HISTORY_MASK] = now_ns;
+	stats->value[sequence & HISTORY_MASK] = record->value;
+
+	record->flags |= RECORD_HAS_STATS;
+	record->num_stats = num_windows;
+	for (i = 0; i < num_windows; i++) {
+		window = &stats->windows[i];
+		window_push(stats, window, sequence);
+		tumbling_push(window, now_ns, record->value);
+
+		result = &record->stats[i];
+		*result = window->last;
+		count = sequence + 1 - window->first;
+		mean = (double)window->sum / count;
+		result->window_ms = window->length_ns / 1000000;
+		result->min = stats->value[window->min.items[window->min.tail & HISTORY_MASK] & HISTORY_MASK];
+		result->max = stats->value[window->max.items[window->max.tail & HISTORY_MASK] & HISTORY_MASK];
+		result->mean = llround(mean * 1000);
+		result->stddev = stddev_thousandths((double)window->sum_squares / count - mean * mean);
+		result->tumbling_valid = window->complete;
+	}
+}
+
+static void window_push(struct channel_stats *stats, struct window *window, unsigned int sequence) {
+	int value = stats->value[sequence & HISTORY_MASK];
+
+	window->sum += value;
+	window->sum_squares += (long long)value * value;
+
+	while (window->min.head != window->min.tail &&
+	       stats->value[window->min.items[(window->min.head - 1) & HISTORY_MASK] & HISTORY_MASK] >= value) {
+		window->min.head--;
+	}
+	window->min.items[window->min.head++ & HISTORY_MASK] = sequence;
+
+	while (window->max.head != window->max.tail &&
+	       stats->value[window->max.items[(window->max.head - 1) & HISTORY_MASK] & HISTORY_MASK] <= value) {
+		window->max.head--;
+	}
+	window->max.items[window->max.head++ & HISTORY_MASK] = sequence;
+}
+
+// Drops samples older than the window, and the oldest one when the
+// history ring is about to overwrite it
+static void window_evict(struct channel_stats *stats, struct window *window, long long now_ns) {
+	unsigned int oldest;
+	int value;
+
+	while (window->first != stats->next - 1) {
+		oldest = window->first;
+		if (now_ns - stats->taken_ns[oldest & HISTORY_MASK] < window->length_ns &&
+		    stats->next - oldest <= STATS_HISTORY_SAMPLES) {
+			break;
+		}
+
+		value = stats->value[oldest & HISTORY_MASK];
+		window->sum -= value;
+		window->sum_squares -= (long long)value * value;
+		if (window->min.items[window->min.tail & HISTORY_MASK] == oldest) {
+			window->min.tail++;
+		}
+		if (window->max.items[window->max.tail & HISTORY_MASK] == oldest) {
+			window->max.tail++;
+		}
+		window->first++;
+	}
+}
+
+// Welford over the current period, published once the period is over
+static void tumbling_push(struct window *window, long long now_ns, int value) {
+	double delta;
+
+	if (window->count > 0 && now_ns - window->started_ns >= window->length_ns) {
+		window->last.tumbling_min = window->low;
+		window->last.tumbling_max = window->high;
+		window->last.tumbling_mean = llround(window->mean * 1000);
+		window->last.tumbling_stddev = stddev_thousandths(window->m2 / window->count);
+		window->complete = 1;
+		window->count = 0;
+	}
+
+	if (window->count == 0) {
+		window->started_ns = now_ns;
+		window->mean = 0;
+		window->m2 = 0;
+		window->low = window->high = value;
+	}
+
+	window->count++;
+	delta = value - window->mean;
+	window->mean += delta / window->count;
+	window->m2 += delta * (value - window->mean);
+	if (value < window->low) {
+		window->low = value;
+	}
+	if (value > window->high) {
+		window->high = value;
+	}
+}
+
+// Population standard deviation, rounding can make the variance dip below 0
+static long long stddev_thousandths(double variance) {
+	return (variance > 0) ? llround(sqrt(variance) * 1000) : 0;
+}
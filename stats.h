@@ -0,0 +1,29 @@
+/*
+file: stats.h
+
+Description:
+	Windowed statistics per channel, updated once per sample in constant
+	time whatever the window length:
+
+		sliding		min/max from monotonic deques, mean/stddev
+				from exact integer sums over the last window_ms
+		tumbling	Welford mean/variance plus min/max over
+				back to back window_ms periods, the last
+				complete period is reported
+
+	All windows of a channel share one ring of recent samples, so the
+	longest sliding window is bounded by STATS_HISTORY_SAMPLES.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "record.h"
+
+#define STATS_MAX_CHANNELS 16
+#define STATS_HISTORY_SAMPLES 8192	// per channel, must be a power of two
+
+void	stats_configure(const int *windows_ms, int count);
+void	stats_update(int channel, struct record *record);
+
+#endif
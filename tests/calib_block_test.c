@@ -0,0 +1,202 @@
+/*
+file: tests/calib_block_test.c
+
+Description:
+	calib_apply_block(), calib_apply_block_scalar() and
+	calib_convert_sweep() against calib_apply() sample by sample. Linear
+	calibrations go through the SSE2 or NEON path when it is compiled in
+	(the name is printed), including ones that need bitmap corrections,
+	blocks of every length up to 67 at every alignment, every code in
+	one block, and codes outside the ADC range mixed in. Exits non zero
+	on any difference.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../calib.h"
+
+#define MAX_BLOCK 67
+#define SWEEP_SAMPLES 1000
+
+// FUNCTION SIGNATURES
+static void	check_blocks(const char *name, const struct calib_spec *spec, uint64_t *state);
+static void	check_sweep(uint64_t *state);
+static int32_t	random_code(uint64_t *state);
+static uint64_t	next_random(uint64_t *state);
+
+static int failures = 0;
+static long long blocks_checked = 0;
+
+int main() {
+	struct calib_spec spec;
+	uint64_t state = 0x2545f4914f6cdd1dULL;
+	int i;
+
+	printf("vector path: %s\n", calib_simd_name());
+
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.unit = "mA";
+
+	// current_sensor_N defaults, negative gains
+	spec.coefficients[1] = -13.3333;
+	spec.origin = 2500;
+	check_blocks("current sensor", &spec, &state);
+	spec.coefficients[1] = -1.0 / 3;
+	spec.origin = 1650.25;
+	check_blocks("current sensor 1/3", &spec, &state);
+
+	// positive and negative gains, some with corrections
+	spec.origin = 0;
+	for (i = 1; i <= 64; i++) {
+		spec.coefficients[0] = -(double)i;
+		spec.coefficients[1] = 1.0 / i;
+		check_blocks("linear 1/n", &spec, &state);
+		spec.coefficients[1] = -i / 10.0;
+		check_blocks("linear -n/10", &spec, &state);
+	}
+	// products that land exactly on the rounding half of the Horner step
+	spec.coefficients[0] = 5;
+	spec.coefficients[1] = -1.0 / (1LL << 36);
+	check_blocks("linear, half LSB steps", &spec, &state);
+	spec.coefficients[1] = 1.0 / (1LL << 36);
+	check_blocks("linear, half LSB steps", &spec, &state);
+	for (i = 0; i < 50; i++) {
+		spec.coefficients[0] = (double)(int64_t)next_random(&state) / (1LL << 50);
+		spec.coefficients[1] = (double)(int64_t)next_random(&state) / (1LL << 56);
+		check_blocks("linear random", &spec, &state);
+	}
+
+	// the other kinds only use the scalar loop but share the entry point
+	spec.kind = CALIB_POLY;
+	spec.order = 2;
+	spec.coefficients[2] = 1e-4;
+	check_blocks("poly", &spec, &state);
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_PIECEWISE;
+	spec.points = 3;
+	spec.code[1] = 1000.5;
+	spec.code[2] = 4000;
+	spec.value[1] = 250;
+	spec.value[2] = -90.25;
+	spec.unit = "degC";
+	check_blocks("piecewise", &spec, &state);
+	spec.kind = CALIB_RAW;
+	check_blocks("raw", &spec, &state);
+
+	check_sweep(&state);
+
+	printf("%lld blocks checked, %d failures\n", blocks_checked, failures);
+	return failures != 0;
+}
+
+static void check_blocks(const char *name, const struct calib_spec *spec, uint64_t *state) {
+	static int32_t all_codes[CALIB_CODES], all_values[CALIB_CODES];
+	int32_t codes[MAX_BLOCK + 4];
+	int32_t block[MAX_BLOCK + 4], scalar[MAX_BLOCK + 4];
+	struct calib calib;
+	int length, start, i;
+
+	if (calib_compile(spec, &calib) < 0) {
+		printf("FAIL %s: refused\n", name);
+		failures++;
+		return;
+	}
+
+	for (i = 0; i < CALIB_CODES; i++) {
+		all_codes[i] = i;
+	}
+	calib_apply_block(&calib, all_codes, all_values, CALIB_CODES);
+	for (i = 0; i < CALIB_CODES; i++) {
+		if (all_values[i] != calib_apply(&calib, i)) {
+			printf("FAIL %s code %d: block %d, calib_apply %d\n", name, i, all_values[i], calib_apply(&calib, i));
+			failures++;
+			return;
+		}
+	}
+	blocks_checked++;
+
+	for (length = 0; length <= MAX_BLOCK; length++) {
+		for (start = 0; start < 4; start++) {
+			for (i = 0; i < length; i++) {
+				codes[start + i] = random_code(state);
+			}
+			calib_apply_block(&calib, codes + start, block + start, length);
+			calib_apply_block_scalar(&calib, codes + start, scalar + start, length);
+
+			for (i = 0; i < length; i++) {
+				if (block[start + i] != calib_apply(&calib, codes[start + i]) ||
+				    scalar[start + i] != calib_apply(&calib, codes[start + i])) {
+					printf("FAIL %s code %d: block %d, scalar %d, calib_apply %d\n", name,
+						codes[start + i], block[start + i], scalar[start + i],
+						calib_apply(&calib, codes[start + i]));
+					failures++;
+					return;
+				}
+			}
+			blocks_checked++;
+		}
+	}
+}
+
+// One sweep over channels of every kind, channel major
+static void check_sweep(uint64_t *state) {
+	static int32_t codes[4 * SWEEP_SAMPLES], values[4 * SWEEP_SAMPLES];
+	struct calib calibration[4];
+	struct calib_spec spec;
+	int channel, i;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.unit = "mV";
+	spec.kind = CALIB_RAW;
+	calib_compile(&spec, &calibration[0]);
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.coefficients[1] = -13.3333;
+	spec.origin = 2500;
+	calib_compile(&spec, &calibration[1]);
+	spec.coefficients[1] = 0.7;
+	spec.origin = 0;
+	calib_compile(&spec, &calibration[2]);
+	spec.kind = CALIB_POLY;
+	spec.order = 2;
+	spec.coefficients[2] = -3e-5;
+	calib_compile(&spec, &calibration[3]);
+
+	for (i = 0; i < 4 * SWEEP_SAMPLES; i++) {
+		codes[i] = random_code(state);
+	}
+	calib_convert_sweep(calibration, 4, codes, values, SWEEP_SAMPLES);
+
+	for (channel = 0; channel < 4; channel++) {
+		for (i = channel * SWEEP_SAMPLES; i < (channel + 1) * SWEEP_SAMPLES; i++) {
+			if (values[i] != calib_apply(&calibration[channel], codes[i])) {
+				printf("FAIL sweep channel %d code %d: %d, calib_apply %d\n",
+					channel, codes[i], values[i], calib_apply(&calibration[channel], codes[i]));
+				failures++;
+				return;
+			}
+		}
+	}
+	blocks_checked += 4;
+}
+
+// Mostly ADC codes, one in 32 outside the range
+static int32_t random_code(uint64_t *state) {
+	uint64_t bits = next_random(state);
+
+	if ((bits & 31) == 0) {
+		return (bits & 32) ? -(int32_t)(bits >> 54) - 1 : CALIB_CODES + (int32_t)(bits >> 54);
+	}
+	return (bits >> 20) % CALIB_CODES;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
@@ -0,0 +1,204 @@
+/*
+file: tests/calib_test.c
+
+Description:
+	calib_apply() against the double formulas over the whole ADC code
+	range: the legacy current conversion (int)(m * (max_avg_voltage -
+	mV)) for the sensor multipliers and voltages configs use, and
+	(int)calib_reference() for random linear, poly and piecewise
+	calibrations. Also checks which specs and units calib_compile()
+	refuses. Prints the number of failures and exits non zero on any.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../calib.h"
+
+// FUNCTION SIGNATURES
+static void	check_legacy(double multiplier, double max_voltage);
+static void	check_reference(const char *name, const struct calib_spec *spec);
+static void	check_refused(const char *name, const struct calib_spec *spec);
+static double	random_unit(uint64_t *state);
+
+static int failures = 0;
+static long long codes_checked = 0;
+static long long codes_corrected = 0;
+
+int main() {
+	static const double multipliers[] = {
+		1, 2.5, 10, 13.3333, 100, 0.1, 0.01, 1.0 / 3, 0.6103515625, 7.8125e-3, 1234.5678
+	};
+	static const double voltages[] = { 0, 1650.25, 2500, 2500.5, 3299.9, 4095 };
+	struct calib_spec spec;
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	unsigned int i, j;
+	int k;
+
+	for (i = 0; i < sizeof(multipliers) / sizeof(multipliers[0]); i++) {
+		for (j = 0; j < sizeof(voltages) / sizeof(voltages[0]); j++) {
+			check_legacy(multipliers[i], voltages[j]);
+			check_legacy(-multipliers[i], voltages[j]);
+		}
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.unit = "mV";
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	for (i = 0; i < 200; i++) {
+		spec.coefficients[0] = (random_unit(&state) - 0.5) * 20000;
+		spec.coefficients[1] = (random_unit(&state) - 0.5) * 100;
+		check_reference("linear", &spec);
+	}
+	// gains that make many values exact integers
+	for (i = 1; i <= 64; i++) {
+		spec.coefficients[0] = -(double)i;
+		spec.coefficients[1] = 1.0 / i;
+		check_reference("linear 1/n", &spec);
+		spec.coefficients[1] = i / 10.0;
+		check_reference("linear n/10", &spec);
+	}
+
+	spec.kind = CALIB_POLY;
+	for (i = 0; i < 200; i++) {
+		spec.order = 2 + i % (CALIB_MAX_ORDER - 1);
+		spec.origin = (i & 1) ? random_unit(&state) * 4096 : 0;
+		for (k = 0; k <= spec.order; k++) {
+			spec.coefficients[k] = (random_unit(&state) - 0.5) * 4000 / pow(4096, k);
+		}
+		check_reference("poly", &spec);
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	spec.unit = "degC";
+	spec.kind = CALIB_PIECEWISE;
+	for (i = 0; i < 200; i++) {
+		spec.points = 2 + i % (CALIB_MAX_POINTS - 1);
+		spec.code[0] = (random_unit(&state) - 0.25) * 400;
+		spec.value[0] = (random_unit(&state) - 0.5) * 1000;
+		for (k = 1; k < spec.points; k++) {
+			spec.code[k] = spec.code[k - 1] + 1 + random_unit(&state) * (8192.0 / spec.points);
+			spec.value[k] = spec.value[k - 1] + (random_unit(&state) - 0.5) * 2000;
+		}
+		check_reference("piecewise", &spec);
+	}
+
+	// Refused specs
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.coefficients[1] = 1;
+	spec.unit = NULL;
+	check_refused("no unit", &spec);
+	spec.unit = "milliamp";
+	check_refused("unit too long", &spec);
+	spec.unit = "m\"A";
+	check_refused("unit with quote", &spec);
+	spec.unit = "m\\A";
+	check_refused("unit with backslash", &spec);
+	spec.unit = "m\nA";
+	check_refused("unit with newline", &spec);
+	spec.unit = "mA";
+	spec.coefficients[1] = 1e6;
+	check_refused("value out of range", &spec);
+	spec.coefficients[1] = NAN;
+	check_refused("NaN gain", &spec);
+	spec.kind = CALIB_PIECEWISE;
+	spec.points = 2;
+	spec.code[0] = spec.code[1] = 100;
+	check_refused("piecewise codes not increasing", &spec);
+
+	// Raw passes codes through untouched, including out of range ones
+	spec.kind = CALIB_RAW;
+	spec.unit = "mV";
+	check_reference("raw", &spec);
+
+	printf("%lld codes checked, %lld (%.3f%%) corrected by the bitmaps, %d failures\n",
+		codes_checked, codes_corrected, 100.0 * codes_corrected / codes_checked, failures);
+	return failures != 0;
+}
+
+// What get_current() computed before calibrations were compiled
+static void check_legacy(double multiplier, double max_voltage) {
+	struct calib_spec spec;
+	struct calib calib;
+	int code, expected;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.kind = CALIB_LINEAR;
+	spec.order = 1;
+	spec.coefficients[1] = -multiplier;
+	spec.origin = max_voltage;
+	spec.unit = "mA";
+
+	if (calib_compile(&spec, &calib) < 0) {
+		// only refused when the values can't be represented
+		if (fabs(multiplier) * 4096 < (1 << 26) / 2) {
+			printf("FAIL legacy m=%g max=%g: refused\n", multiplier, max_voltage);
+			failures++;
+		}
+		return;
+	}
+
+	for (code = 0; code < CALIB_CODES; code++) {
+		expected = multiplier * (max_voltage - ((double)code));
+		if (calib_apply(&calib, code) != expected) {
+			printf("FAIL legacy m=%g max=%g code %d: %d, expected %d\n",
+				multiplier, max_voltage, code, calib_apply(&calib, code), expected);
+			failures++;
+			return;
+		}
+	}
+	codes_checked += CALIB_CODES;
+	codes_corrected += calib.corrections;
+}
+
+static void check_reference(const char *name, const struct calib_spec *spec) {
+	struct calib calib;
+	int code, expected;
+
+	if (calib_compile(spec, &calib) < 0) {
+		printf("FAIL %s: refused\n", name);
+		failures++;
+		return;
+	}
+	if (strcmp(calib.unit, spec->unit) != 0) {
+		printf("FAIL %s: unit %s, expected %s\n", name, calib.unit, spec->unit);
+		failures++;
+	}
+
+	for (code = 0; code < CALIB_CODES; code++) {
+		expected = (int)calib_reference(spec, code);
+		if (calib_apply(&calib, code) != expected) {
+			printf("FAIL %s code %d: %d, expected %d\n", name, code, calib_apply(&calib, code), expected);
+			failures++;
+			return;
+		}
+	}
+	if (spec->kind == CALIB_RAW && (calib_apply(&calib, -5) != -5 || calib_apply(&calib, 5000) != 5000)) {
+		printf("FAIL %s: out of range codes changed\n", name);
+		failures++;
+	}
+	codes_checked += CALIB_CODES;
+	codes_corrected += calib.corrections;
+}
+
+static void check_refused(const char *name, const struct calib_spec *spec) {
+	struct calib calib;
+
+	if (calib_compile(spec, &calib) == 0) {
+		printf("FAIL %s: accepted\n", name);
+		failures++;
+	}
+}
+
+// Uniform in [0, 1), deterministic across runs
+static double random_unit(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
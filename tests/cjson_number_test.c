@@ -0,0 +1,215 @@
+/*
+file: tests/cjson_number_test.c
+
+Description:
+	cJSON's number parser against strtod(), bit for bit: random doubles
+	printed with %.17g and %.15g, mantissas longer than the 19 digits
+	the fast path keeps, subnormals, overflow and underflow, the 2^53
+	and 1e22 limits of the fast path, and signed zeros. Each number must
+	also be read to its end. A long number whose copy for strtod() can't
+	be allocated must fail the parse. Exits non zero on any failure.
+*/
+
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cjson/cJSON.h"
+
+#define RANDOM_DOUBLES 200000
+#define LONG_MANTISSAS 20000
+#define SUBNORMALS 50000
+
+// FUNCTION SIGNATURES
+static void	check(const char *text);
+static void	check_edges();
+static void	check_allocation_failure();
+static void	*failing_malloc(size_t size);
+static double	random_double(uint64_t *state);
+static uint64_t	next_random(uint64_t *state);
+
+static int failures = 0;
+static long long numbers_checked = 0;
+static size_t failing_size = 0;
+
+int main() {
+	char text[1100];
+	uint64_t state = 0x853c49e6748fea9bULL;
+	double value;
+	int i, digits, left, length;
+
+	check_edges();
+
+	for (i = 0; i < RANDOM_DOUBLES; i++) {
+		value = random_double(&state);
+		snprintf(text, sizeof(text), "%.17g", value);
+		check(text);
+		snprintf(text, sizeof(text), "%.15g", value);
+		check(text);
+		snprintf(text, sizeof(text), "%.6e", value);
+		check(text);
+	}
+
+	// 20 to 800 digits, some with a point and an exponent
+	for (i = 0; i < LONG_MANTISSAS; i++) {
+		digits = 20 + next_random(&state) % 781;
+		length = 0;
+		if (i & 1) {
+			text[length++] = '-';
+		}
+		text[length++] = '1' + next_random(&state) % 9;
+		for (left = digits - 1; left > 0; left--) {
+			if (left == 10 && (i & 2)) {
+				text[length++] = '.';
+			}
+			if (i & 4) {
+				// mostly zeros or mostly nines, close to a rounding boundary
+				text[length++] = (next_random(&state) % 8) ? ((i & 8) ? '9' : '0') : '5';
+			} else {
+				text[length++] = '0' + next_random(&state) % 10;
+			}
+		}
+		if (i & 16) {
+			length += snprintf(text + length, sizeof(text) - length, "e%d",
+				(int)(next_random(&state) % 700) - 350 - digits);
+		}
+		text[length] = '\0';
+		check(text);
+	}
+
+	for (i = 0; i < SUBNORMALS; i++) {
+		uint64_t bits = next_random(&state) & 0x000fffffffffffffULL;
+
+		memcpy(&value, &bits, sizeof(value));
+		snprintf(text, sizeof(text), "%.17g", value);
+		check(text);
+		snprintf(text, sizeof(text), "%.15g", value);
+		check(text);
+	}
+
+	check_allocation_failure();
+
+	// The slow path hands strtod() the locale's decimal point
+	if (setlocale(LC_NUMERIC, "de_DE.UTF-8") != NULL || setlocale(LC_NUMERIC, "fr_FR.UTF-8") != NULL) {
+		printf("decimal point of the locale: %s\n", localeconv()->decimal_point);
+		check_edges();
+		setlocale(LC_NUMERIC, "C");
+	}
+
+	printf("%lld numbers checked, %d failures\n", numbers_checked, failures);
+	return failures != 0;
+}
+
+// The JSON number text must give what strtod() gives in the C locale
+static void check(const char *text) {
+	char *locale = setlocale(LC_NUMERIC, NULL);
+	char saved[64];
+	const char *end = NULL;
+	double expected;
+	cJSON *item;
+
+	snprintf(saved, sizeof(saved), "%s", locale);
+	setlocale(LC_NUMERIC, "C");
+	expected = strtod(text, NULL);
+	setlocale(LC_NUMERIC, saved);
+
+	numbers_checked++;
+	item = cJSON_ParseWithOpts(text, &end, 1);
+	if (item == NULL || !cJSON_IsNumber(item)) {
+		printf("FAIL %s: not parsed (stopped at \"%.20s\")\n", text, end ? end : "");
+		failures++;
+	} else if (memcmp(&item->valuedouble, &expected, sizeof(expected)) != 0) {
+		printf("FAIL %s: %.17g, strtod %.17g\n", text, item->valuedouble, expected);
+		failures++;
+	} else if (item->valueint != (expected >= INT_MAX ? INT_MAX : expected <= INT_MIN ? INT_MIN : (int)expected)) {
+		printf("FAIL %s: valueint %d\n", text, item->valueint);
+		failures++;
+	}
+	cJSON_Delete(item);
+}
+
+static void check_edges() {
+	static const char *const edges[] = {
+		"0", "-0", "0.0", "-0.0", "0e5", "-0E-5", "0.000", "1", "-1", "0.1", "1e0", "1E+2", "1e-0",
+		// 2^53 and the odd integers around it
+		"9007199254740991", "9007199254740992", "9007199254740993", "9007199254740995",
+		"-9007199254740993", "9007199254740993e-3", "9007199254740993e3", "900719925474099.3",
+		"9007199254740992e22", "9007199254740992e-22", "9007199254740993e-22",
+		// 19 and 20 significant digits
+		"1844674407370955161", "18446744073709551615", "18446744073709551616", "9999999999999999999",
+		"99999999999999999999", "10000000000000000000", "12345678901234567890123", "0.12345678901234567890",
+		// exactly representable powers of ten and beyond
+		"1e22", "1e23", "123e-22", "123e-23", "4503599627370496e22", "4503599627370497e-22", "8.589973e9",
+		"1e15", "1e-15", "1e16", "1e-16", "0.1e23", "0.0000000000000000000000001",
+		// largest double, its rounding boundary and overflow
+		"1.7976931348623157e308", "1.7976931348623158e308", "1.7976931348623159e308",
+		"1e308", "1e309", "-1e309", "1e99999999", "123456789e99999", "179769313486231580793728971405301e276",
+		// smallest normal and subnormals, underflow
+		"2.2250738585072014e-308", "2.2250738585072011e-308", "2.2250738585072012e-308",
+		"4.9406564584124654e-324", "5e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+		"3e-324", "1e-400", "-1e-400", "1e-99999999",
+		// values ints saturate at
+		"2147483647", "2147483648", "-2147483648", "-2147483649", "2147483647.5",
+		// classic hard cases for strtod
+		"0.500000000000000166533453693773481063544750213623046875",
+		"3.518437208883201171875e13", "62.5364939768271845828", "8.10109172351e-10",
+		"1.00000005960464477550", "7.7030735707052815e-282", "1448997445238699", "9.5e-324",
+		"1.797693134862315807937289714053e308", "4.9e-324", "1e-323"
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+		check(edges[i]);
+	}
+}
+
+// Fails the copy of one long number, the parse must fail with it
+static void check_allocation_failure() {
+	cJSON_Hooks hooks = { failing_malloc, free };
+	char text[256];
+	cJSON *item;
+
+	memset(text, '7', 200);
+	strcpy(text + 200, "e-100");
+	failing_size = strlen(text) + 1;
+
+	cJSON_InitHooks(&hooks);
+	item = cJSON_Parse(text);
+	cJSON_InitHooks(NULL);
+	numbers_checked++;
+	if (item != NULL) {
+		printf("FAIL long number parsed without its copy: %.17g\n", item->valuedouble);
+		failures++;
+		cJSON_Delete(item);
+	}
+
+	failing_size = 0;
+	check(text);
+}
+
+static void *failing_malloc(size_t size) {
+	return (size == failing_size) ? NULL : malloc(size);
+}
+
+// Uniform over the bit patterns of finite doubles, so all exponents are equally likely
+static double random_double(uint64_t *state) {
+	uint64_t bits;
+	double value;
+
+	do {
+		bits = next_random(state);
+		memcpy(&value, &bits, sizeof(value));
+	} while (!isfinite(value));
+	return value;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
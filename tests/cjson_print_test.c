@@ -0,0 +1,239 @@
+/*
+file: tests/cjson_print_test.c
+
+Description:
+	cJSON's number printer. Every printed double has to read back as
+	the same bits with strtod(), in the notation its magnitude calls
+	for: fixed from 1e-6 up to 1e9, otherwise a mantissa and an
+	exponent of at least two digits. Grisu2 works in a slightly narrowed
+	interval, so a few values get up to 17 digits where a shorter
+	string would read back; more than one in a thousand fails the
+	test. Integers keep
+	the "%.0f" output up to 1e60, "-0" included, and NaN and infinity
+	print as null. Random doubles of every exponent and subnormals are
+	checked along with fixed cases. Exits non zero on any failure.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../cjson/cJSON.h"
+
+#define RANDOM_DOUBLES 200000
+#define SUBNORMALS 100000
+#define INTEGERS 100000
+#define MAX_LONGER 0.001	// fraction of the non integers printed longer than the shortest
+
+// FUNCTION SIGNATURES
+static char	*print(double value, char *text, size_t size);
+static void	check_exact(double value, const char *expected);
+static void	check_round_trip(double value);
+static int	significant_digits(const char *text);
+static int	shortest_digits(double value);
+static double	random_double(uint64_t *state);
+static uint64_t	next_random(uint64_t *state);
+
+static int failures = 0;
+static long long numbers_checked = 0;
+static long long fractions_checked = 0;
+static long long longer_than_shortest = 0;
+
+int main() {
+	static const char *const fixed[] = {
+		"0.1", "0.3", "0.7", "1.5", "-2.5", "3.14159", "0.000001", "-0.000001", "0.0000015",
+		"999999999.5", "123456789.123", "0.3333333333333333", "2.718281828459045", "1.7976931348623157e+308",
+		"1e-07", "9.99e-07", "-1.5e-07", "1.0000000005e+09", "1.2345e+60", "1.5e+60", "5e-324",
+		"2.2250738585072014e-308", "1e+300", "1.5e+300", "1e-100", "1e+60",
+		"0.30000000000000004", "100000000.5"
+	};
+	char text[64];
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+	double value;
+	unsigned int i;
+	int exponent;
+
+	// the shortest strings that read back, printed as they are
+	for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+		check_exact(strtod(fixed[i], NULL), fixed[i]);
+	}
+	check_exact(4.9406564584124654e-324, "5e-324");
+	check_exact(0.1 + 0.2, "0.30000000000000004");
+
+	// integers, with the output they always had
+	check_exact(0, "0");
+	check_exact(-0.0, "-0");
+	check_exact(1, "1");
+	check_exact(-1, "-1");
+	check_exact(9007199254740993.0, "9007199254740992");
+	check_exact(999999999999999999.0, "1000000000000000000");
+	check_exact(1e18, "1000000000000000000");
+	check_exact(-1e18, "-1000000000000000000");
+	check_exact(1e59, "99999999999999997168788049560464200849936328366177157906432");
+	check_exact(NAN, "null");
+	check_exact(INFINITY, "null");
+	check_exact(-INFINITY, "null");
+
+	for (exponent = 18; exponent < 60; exponent++) {
+		for (i = 0; i < INTEGERS / 42; i++) {
+			value = floor(pow(10, exponent + (next_random(&state) >> 11) * (1.0 / 9007199254740992.0)));
+			snprintf(text, sizeof(text), "%.0f", value);
+			check_exact(value, text);
+			snprintf(text, sizeof(text), "%.0f", -value);
+			check_exact(-value, text);
+		}
+	}
+	for (i = 0; i < INTEGERS; i++) {
+		value = (double)(int64_t)(next_random(&state) >> (next_random(&state) % 64)) * ((i & 1) ? -1 : 1);
+		snprintf(text, sizeof(text), "%.0f", value);
+		check_exact(value, text);
+	}
+
+	// the edges of fixed notation, either side
+	for (exponent = -8; exponent <= 10; exponent++) {
+		value = pow(10, exponent);
+		check_round_trip(value);
+		check_round_trip(nextafter(value, 0));
+		check_round_trip(nextafter(value, INFINITY));
+		check_round_trip(-value * 1.5);
+	}
+
+	for (i = 0; i < RANDOM_DOUBLES; i++) {
+		check_round_trip(random_double(&state));
+	}
+	for (i = 0; i < SUBNORMALS; i++) {
+		uint64_t bits = next_random(&state) & 0x000fffffffffffffULL;
+
+		memcpy(&value, &bits, sizeof(value));
+		check_round_trip(value);
+	}
+	// values near 1, where most sensor readings are
+	for (i = 0; i < RANDOM_DOUBLES; i++) {
+		check_round_trip((next_random(&state) >> 11) * (1.0 / 9007199254740992.0) * 4096);
+	}
+
+	if (longer_than_shortest > fractions_checked * MAX_LONGER) {
+		printf("FAIL %lld of %lld printed longer than the shortest\n", longer_than_shortest, fractions_checked);
+		failures++;
+	}
+
+	printf("%lld numbers checked, %lld of %lld non integers longer than the shortest, %d failures\n",
+		numbers_checked, longer_than_shortest, fractions_checked, failures);
+	return failures != 0;
+}
+
+static char *print(double value, char *text, size_t size) {
+	cJSON *item = cJSON_CreateNumber(value);
+	char *printed = cJSON_PrintUnformatted(item);
+
+	snprintf(text, size, "%s", printed ? printed : "(print failed)");
+	free(printed);
+	cJSON_Delete(item);
+	return text;
+}
+
+static void check_exact(double value, const char *expected) {
+	char text[128];
+
+	numbers_checked++;
+	if (strcmp(print(value, text, sizeof(text)), expected) != 0) {
+		printf("FAIL %.17g: printed %s, expected %s\n", value, text, expected);
+		failures++;
+	}
+}
+
+// Reads back exactly, in the right notation, with at most 17 digits
+static void check_round_trip(double value) {
+	char text[128], *end;
+	double read;
+	const char *exponent;
+	int digits, shortest;
+
+	numbers_checked++;
+	print(value, text, sizeof(text));
+	read = strtod(text, &end);
+	if (*end != '\0' || memcmp(&read, &value, sizeof(value)) != 0) {
+		printf("FAIL %.17g: printed %s, reads back as %.17g\n", value, text, read);
+		failures++;
+		return;
+	}
+
+	// no other double prints as 1e-06 or 1e+09, so the notation follows the value
+	exponent = strchr(text, 'e');
+	if ((value == floor(value) && fabs(value) < 1e60) ? exponent != NULL :
+	    ((fabs(value) >= 1e-6 && fabs(value) < 1e9) != (exponent == NULL))) {
+		printf("FAIL %.17g: printed %s, wrong notation\n", value, text);
+		failures++;
+		return;
+	}
+	if (exponent != NULL && ((exponent[1] != '+' && exponent[1] != '-') || strlen(exponent + 2) < 2 ||
+	    (strlen(exponent + 2) == 3 && exponent[2] == '0'))) {
+		printf("FAIL %.17g: printed %s, malformed exponent\n", value, text);
+		failures++;
+		return;
+	}
+
+	if (value != floor(value)) {
+		digits = significant_digits(text);
+		shortest = shortest_digits(value);
+		if (digits > 17) {
+			printf("FAIL %.17g: printed %s, %d digits where %d are enough\n", value, text, digits, shortest);
+			failures++;
+		}
+		fractions_checked++;
+		longer_than_shortest += digits > shortest;
+	}
+}
+
+// Digits from the first non zero one to the last non zero one before the exponent
+static int significant_digits(const char *text) {
+	int count = 0, zeros = 0, started = 0;
+
+	for (; *text != '\0' && *text != 'e'; text++) {
+		if (*text < '0' || *text > '9') {
+			continue;
+		}
+		if (*text == '0') {
+			zeros += started;
+			continue;
+		}
+		count += zeros + 1;
+		zeros = 0;
+		started = 1;
+	}
+	return count;
+}
+
+static int shortest_digits(double value) {
+	char text[64];
+	int precision;
+
+	for (precision = 1; precision < 17; precision++) {
+		snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+		if (strtod(text, NULL) == value) {
+			break;
+		}
+	}
+	return precision;
+}
+
+// Uniform over the bit patterns of finite doubles, so all exponents are equally likely
+static double random_double(uint64_t *state) {
+	uint64_t bits;
+	double value;
+
+	do {
+		bits = next_random(state);
+		memcpy(&value, &bits, sizeof(value));
+	} while (!isfinite(value));
+	return value;
+}
+
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
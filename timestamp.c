@@ -0,0 +1,258 @@
+/*
+file: timestamp.c
+
+Description:
+	Formats sample timestamps without calling localtime()/strftime()
+	for every sample. Each thread keeps the formatted "date + seconds"
+	prefix of the last second it saw and only the millisecond or
+	microsecond fraction is written per call, so samples taken within
+	the same second are still distinguishable.
+
+	The cache is thread local and the configuration (format, precision
+	and a generation counter) is packed into one word that is published
+	and read atomically, so no locking is needed and a reader never
+	sees the format of one configuration with the precision of another.
+
+	Samples are stamped on CLOCK_MONOTONIC and converted to wall time
+	with an offset that is re-measured every TS_OFFSET_REFRESH_NS, so
+	NTP steps are picked up without a realtime read per sample.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "numfmt.h"
+#include "timestamp.h"
+
+// FUNCTION SIGNATURES
+static int	format_fraction(char *out, long nsec, enum ts_precision precision);
+static int	refresh_prefix(time_t sec, enum ts_format format);
+static long long timespec_ns(const struct timespec *ts);
+static void	refresh_offset(long long mono_ns);
+static long long epoch_in(const struct timespec *wall, enum ts_precision precision);
+static int	format_with(int cfg, const struct timespec *wall, char *buffer);
+
+// generation << 8 | precision << 4 | format
+#define TS_CFG(generation, format, precision) (((generation) << 8) | ((precision) << 4) | (format))
+#define TS_CFG_FORMAT(cfg) ((enum ts_format)((cfg) & 0xf))
+#define TS_CFG_PRECISION(cfg) ((enum ts_precision)(((cfg) >> 4) & 0xf))
+#define TS_CFG_GENERATION(cfg) ((cfg) >> 8)
+
+static int ts_cfg = TS_CFG(1, TS_FORMAT_LOCAL, TS_PRECISION_MILLIS);
+
+// CLOCK_REALTIME - CLOCK_MONOTONIC in ns and when it was last measured
+static long long ts_offset_ns = 0;
+static long long ts_offset_taken_ns = 0;
+
+// Per thread cache of the formatted whole second
+static __thread struct {
+	int generation;
+	time_t sec;
+	size_t length;
+	char prefix[TS_BUFFER_SIZE];
+} ts_cache;
+
+void ts_configure(enum ts_format format, enum ts_precision precision) {
+	int old = __atomic_load_n(&ts_cfg, __ATOMIC_RELAXED);
+	int generation;
+	int new;
+
+	do {
+		// 0 is what an unused thread cache holds, skip it on wrap
+		generation = (TS_CFG_GENERATION(old) + 1) & 0x7fffff;
+		new = TS_CFG(generation ? generation : 1, format, precision);
+	} while (!__atomic_compare_exchange_n(&ts_cfg, &old, new, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+int ts_parse_format(const char *name, enum ts_format *format) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, "local") == 0) {
+		*format = TS_FORMAT_LOCAL;
+	} else if (strcasecmp(name, "utc") == 0) {
+		*format = TS_FORMAT_UTC;
+	} else if (strcasecmp(name, "epoch") == 0) {
+		*format = TS_FORMAT_EPOCH;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+int ts_parse_precision(const char *name, enum ts_precision *precision) {
+	if (name == NULL) {
+		return -1;
+	}
+
+	if (strcasecmp(name, "ms") == 0) {
+		*precision = TS_PRECISION_MILLIS;
+	} else if (strcasecmp(name, "us") == 0) {
+		*precision = TS_PRECISION_MICROS;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+// The date of a record: -1 with *epoch set when the format is numeric,
+// otherwise the length of the text in buffer (at least TS_BUFFER_SIZE),
+// 0 if it can't be formatted. Both come from one load of the config so a
+// reload can't mix a text format with an epoch or the other way round.
+int ts_date(const struct timespec *wall, char *buffer, long long *epoch) {
+	int cfg = __atomic_load_n(&ts_cfg, __ATOMIC_ACQUIRE);
+	int length;
+
+	if (TS_CFG_FORMAT(cfg) == TS_FORMAT_EPOCH) {
+		*epoch = epoch_in(wall, TS_CFG_PRECISION(cfg));
+		return -1;
+	}
+
+	length = format_with(cfg, wall, buffer);
+	return length > 0 ? length : 0;
+}
+
+static long long epoch_in(const struct timespec *wall, enum ts_precision precision) {
+	if (precision == TS_PRECISION_MICROS) {
+		return (long long)wall->tv_sec * 1000000LL + wall->tv_nsec / 1000;
+	}
+
+	return (long long)wall->tv_sec * 1000LL + wall->tv_nsec / 1000000;
+}
+
+int ts_format(const struct timespec *wall, char *buffer, size_t buffer_size) {
+	if (buffer_size < TS_BUFFER_SIZE) {
+		return -1;
+	}
+
+	// One load, so format, precision and generation belong together
+	return format_with(__atomic_load_n(&ts_cfg, __ATOMIC_ACQUIRE), wall, buffer);
+}
+
+static int format_with(int cfg, const struct timespec *wall, char *buffer) {
+	enum ts_format format = TS_CFG_FORMAT(cfg);
+	enum ts_precision precision = TS_CFG_PRECISION(cfg);
+	int generation = TS_CFG_GENERATION(cfg);
+	int length;
+
+	if (format == TS_FORMAT_EPOCH) {
+		length = fmt_i64(buffer, epoch_in(wall, precision));
+		buffer[length] = '\0';
+		return length;
+	}
+
+	// Only pay for localtime_r()/strftime() when the second rolls over
+	if (ts_cache.generation != generation || ts_cache.sec != wall->tv_sec) {
+		if (refresh_prefix(wall->tv_sec, format) < 0) {
+			return -1;
+		}
+		ts_cache.generation = generation;
+	}
+
+	memcpy(buffer, ts_cache.prefix, ts_cache.length);
+	length = ts_cache.length;
+	length += format_fraction(buffer + length, wall->tv_nsec, precision);
+
+	if (format == TS_FORMAT_UTC) {
+		buffer[length++] = 'Z';
+	}
+	buffer[length] = '\0';
+
+	return length;
+}
+
+int ts_now(char *buffer, size_t buffer_size) {
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_REALTIME, &now) < 0) {
+#ifdef DEBUG
+		perror("Failed to get current time.");
+#endif
+		return -1;
+	}
+
+	return ts_format(&now, buffer, buffer_size);
+}
+
+void ts_mono_to_wall(const struct timespec *mono, struct timespec *wall) {
+	long long mono_ns = timespec_ns(mono);
+	long long wall_ns;
+
+	if (__atomic_load_n(&ts_offset_taken_ns, __ATOMIC_ACQUIRE) == 0 ||
+	    mono_ns - __atomic_load_n(&ts_offset_taken_ns, __ATOMIC_ACQUIRE) > TS_OFFSET_REFRESH_NS) {
+		refresh_offset(mono_ns);
+	}
+
+	wall_ns = mono_ns + __atomic_load_n(&ts_offset_ns, __ATOMIC_ACQUIRE);
+	wall->tv_sec = wall_ns / 1000000000LL;
+	wall->tv_nsec = wall_ns % 1000000000LL;
+}
+
+long long ts_elapsed_ns(const struct timespec *since) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_ns(&now) - timespec_ns(since);
+}
+
+static long long timespec_ns(const struct timespec *ts) {
+	return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static void refresh_offset(long long mono_ns) {
+	struct timespec before, real, after;
+	long long mono_mid;
+
+	// Bracket the realtime read with two monotonic reads and use the
+	// midpoint, the error is at most half the bracket width.
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	clock_gettime(CLOCK_REALTIME, &real);
+	clock_gettime(CLOCK_MONOTONIC, &after);
+
+	mono_mid = (timespec_ns(&before) + timespec_ns(&after)) / 2;
+	__atomic_store_n(&ts_offset_ns, timespec_ns(&real) - mono_mid, __ATOMIC_RELEASE);
+	__atomic_store_n(&ts_offset_taken_ns, mono_ns, __ATOMIC_RELEASE);
+}
+
+static int refresh_prefix(time_t sec, enum ts_format format) {
+	struct tm tm_info;
+	const char format_string[] = "%Y-%m-%dT%H:%M:%S";
+	size_t length;
+
+	if (format == TS_FORMAT_UTC) {
+		if (gmtime_r(&sec, &tm_info) == NULL) {
+			return -1;
+		}
+	} else {
+		if (localtime_r(&sec, &tm_info) == NULL) {
+#ifdef DEBUG
+			perror("Failed to derive localtime from current time.");
+#endif
+			return -1;
+		}
+	}
+
+	length = strftime(ts_cache.prefix, sizeof(ts_cache.prefix), format_string, &tm_info);
+	if (length == 0) {
+#ifdef DEBUG
+		perror("Failed to format localtime. Indeterminate Result.");
+#endif
+		return -1;
+	}
+
+	ts_cache.sec = sec;
+	ts_cache.length = length;
+	return 0;
+}
+
+static int format_fraction(char *out, long nsec, enum ts_precision precision) {
+	int digits = (precision == TS_PRECISION_MICROS) ? 6 : 3;
+	long value = (precision == TS_PRECISION_MICROS) ? nsec / 1000 : nsec / 1000000;
+
+	out[0] = '.';
+	return fmt_padded_u32(out + 1, value, digits) + 1;
+}
@@ -0,0 +1,42 @@
+/*
+file: timestamp.h
+
+Description:
+	Cached, sub-second timestamp formatting for published samples.
+	The date/time prefix is only rebuilt when the second changes, the
+	fraction is appended from clock_gettime().
+*/
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stddef.h>
+#include <time.h>
+
+// Date representations selectable from config.json
+enum ts_format {
+	TS_FORMAT_LOCAL = 0,	// 2017-03-12T14:05:09.123
+	TS_FORMAT_UTC,		// 2017-03-12T21:05:09.123Z
+	TS_FORMAT_EPOCH		// 1489352709123 (numeric, in precision units)
+};
+
+enum ts_precision {
+	TS_PRECISION_MILLIS = 0,
+	TS_PRECISION_MICROS
+};
+
+#define TS_BUFFER_SIZE 40
+
+// How often the CLOCK_MONOTONIC -> CLOCK_REALTIME offset is re-measured
+#define TS_OFFSET_REFRESH_NS 1000000000LL
+
+void	ts_configure(enum ts_format format, enum ts_precision precision);
+int	ts_parse_format(const char *name, enum ts_format *format);
+int	ts_parse_precision(const char *name, enum ts_precision *precision);
+int	ts_date(const struct timespec *wall, char *buffer, long long *epoch);
+int	ts_format(const struct timespec *wall, char *buffer, size_t buffer_size);
+int	ts_now(char *buffer, size_t buffer_size);
+void	ts_mono_to_wall(const struct timespec *mono, struct timespec *wall);
+long long ts_elapsed_ns(const struct timespec *since);
+
+#endif